@@ -38,10 +38,12 @@
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <sys/epoll.h>
 
 #ifdef HAVE_SYS_XATTR_H
 #include <sys/xattr.h>
@@ -50,15 +52,35 @@
 #include "log.h"
 #include "protocol.h"
 
-// Cache configuration
-#define CACHE_THRESHOLD (3 * 1024 * 1024)  // 3MB - files larger than this won't be cached
-#define CACHE_TTL_SECONDS 5                 // Cache expiration time in seconds
+// Read cache configuration
+#define READ_CACHE_DEFAULT_BYTES (128 * 1024 * 1024)  // 128MB - default total cache budget
+#define READ_CACHE_SHARDS 16                 // Independently locked cache shards
+#define READ_CACHE_BUCKETS 64                // Hash buckets per shard
+#define READ_CACHE_WHOLE_FILE_DIVISOR 32     // Files up to budget/32 are cached whole
+#define READ_CACHE_WINDOW_DIVISOR 8          // Readahead windows are at most budget/8
+#define MYFS_STATS_XATTR "user.myfs.stats"   // Virtual xattr exposing cache counters
 
 // Read optimization for large files
-#define LARGE_FILE_THRESHOLD (1 * 1024 * 1024)  // 1MB - files larger than this are considered "large"
-#define MIN_READ_AHEAD_SIZE (4 * 1024 * 1024)   // 4MB - minimum read-ahead for large files
 #define READAHEAD_WINDOW_SIZE (16 * 1024 * 1024) // 16MB - sliding window for large file reads
 
+// Write buffering
+#define WRITE_BUFFER_CAPACITY (8 * 1024 * 1024)  // 8MB per-file buffer to reduce flushes
+#define WRITE_STREAM_PIECE (WRITE_BUFFER_CAPACITY / 2) // Larger writes are buffered in pieces this big
+#define WRITE_BUFFER_BUCKETS 64                   // Hash buckets of the per-file buffer table
+#define PARITY_DELTA_LOCKS 64                     // Locks serializing parity-delta updates, by object
+#define MAX_DIRTY_BYTES (64 * 1024 * 1024)        // 64MB - total dirty data across all files
+#define DIRTY_BACKGROUND_BYTES (MAX_DIRTY_BYTES / 4) // Flusher starts writing back above this
+#define DIRTY_EXPIRE_SECS 5                       // Flusher writes back data dirty this long
+#define FLUSHER_INTERVAL_SECS 1                   // Flusher wakes up at least this often
+#define WRITEBACK_BATCH 16                        // Buffers taken per bucket in one flusher pass
+
+// Stripe layout
+#define STRIPE_UNIT_DEFAULT_BYTES (64 * 1024)     // Contiguous bytes per fragment per stripe
+#define MYFS_LAYOUT_XATTR "user.myfs.layout"      // Layout of a file, kept on its metadata file
+#define MYFS_LAYOUT_LEGACY 1                      // Byte round-robin striping (no xattr)
+#define MYFS_LAYOUT_STRIPED 2                     // Block-interleaved striping
+#define MYFS_OBJECT_ID_LEN 32                     // Hex digits of a file's object ID
+
 //  All the paths I see are relative to the root of the mounted
 //  filesystem.  In order to get to the underlying filesystem, I need to
 //  have the mountpoint.  I'll save it away early on in main(), and then
@@ -78,27 +100,48 @@ static void bb_fullpath(char fpath[PATH_MAX], const char *path)
 // MYFS Helper Functions
 ///////////////////////////////////////////////////////////
 
-// Helper function to send all data (handles partial sends)
-static ssize_t send_all(int sockfd, const void* buf, size_t len) {
-    size_t total_sent = 0;
-    const char* ptr = (const char*)buf;
-    
-    while (total_sent < len) {
-        ssize_t sent = send(sockfd, ptr + total_sent, len - total_sent, 0);
-        if (sent < 0) {
-            if (errno == EINTR) continue;  // Interrupted, retry
-            return -1;  // Error
-        }
-        if (sent == 0) {
-            return -1;  // Connection closed
-        }
-        total_sent += sent;
+// Put a node socket into non-blocking mode for the I/O engine
+static int set_nonblocking(int sock) {
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+#define NODE_HANDSHAKE_TIMEOUT_SECS 5  // Wait this long for a node's hello
+
+// Open a connection with the v2 hello exchange (see protocol.h) and
+// return the capabilities and credits the node granted
+static int negotiate_protocol(int sock, uint32_t* capabilities, uint16_t* credits) {
+    myfs_hello_t hello;
+    myfs_encode_hello(&hello, MYFS_CAPABILITIES, 0);
+    
+    struct timeval tv = { NODE_HANDSHAKE_TIMEOUT_SECS, 0 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    
+    if (send(sock, &hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello) ||
+        recv(sock, &hello, sizeof(hello), MSG_WAITALL) != sizeof(hello)) {
+        perror("protocol handshake");
+        return -1;
+    }
+    if (MYFS_GET(hello.magic) != MYFS_MAGIC || MYFS_GET(hello.version) < MYFS_PROTOCOL_VERSION) {
+        fprintf(stderr, "[MYFS] Storage node does not speak protocol v%d\n", MYFS_PROTOCOL_VERSION);
+        return -1;
     }
-    return total_sent;
+    *capabilities = MYFS_GET(hello.capabilities) & MYFS_CAPABILITIES;
+    *credits = (uint16_t)MYFS_GET(hello.credits);
+    
+    // Timeouts are handled by the I/O engine from here on
+    memset(&tv, 0, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    return 0;
 }
 
 // Connect to a storage node
-static int connect_to_node(const char* host, int port) {
+static int connect_to_node(const char* host, int port, uint32_t* capabilities, uint16_t* credits) {
     int sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0) {
         perror("socket");
@@ -128,564 +171,4544 @@ static int connect_to_node(const char* host, int port) {
         return -1;
     }
     
-    return sock;
-}
-
-// Reconnect to a specific node
-static int reconnect_to_node(int node_id) {
-    struct bb_state* state = BB_DATA;
-    
-    if (node_id < 0 || node_id >= state->num_nodes) {
+    if (negotiate_protocol(sock, capabilities, credits) < 0) {
+        close(sock);
         return -1;
     }
     
-    fprintf(stderr, "[MYFS] Attempting to reconnect to node %d (%s:%d)...\n",
-            node_id, state->nodes[node_id].host, state->nodes[node_id].port);
-    log_msg("[MYFS] Reconnecting to node %d\n", node_id);
-    
-    // Close old socket if still open
-    if (state->nodes[node_id].socket_fd >= 0) {
-        close(state->nodes[node_id].socket_fd);
-        state->nodes[node_id].socket_fd = -1;
-    }
-    
-    // Try to reconnect
-    state->nodes[node_id].socket_fd = connect_to_node(state->nodes[node_id].host, 
-                                                       state->nodes[node_id].port);
-    if (state->nodes[node_id].socket_fd < 0) {
-        fprintf(stderr, "[MYFS] ✗ Reconnection to node %d failed\n", node_id);
-        log_msg("[MYFS] Reconnection to node %d failed\n", node_id);
+    // All node traffic goes through the I/O thread
+    if (set_nonblocking(sock) < 0) {
+        perror("fcntl");
+        close(sock);
         return -1;
     }
     
-    fprintf(stderr, "[MYFS] ✓ Reconnected to node %d, new socket fd=%d\n", 
-            node_id, state->nodes[node_id].socket_fd);
-    log_msg("[MYFS] Reconnected to node %d, socket fd=%d\n", 
-            node_id, state->nodes[node_id].socket_fd);
-    return 0;
+    return sock;
 }
 
-// Initialize connections to all nodes
-static int init_node_connections() {
-    struct bb_state* state = BB_DATA;
-    
-    fprintf(stderr, "[MYFS] Initializing connections to %d storage nodes...\n", state->num_nodes);
-    log_msg("[MYFS] Initializing connections to %d storage nodes...\n", state->num_nodes);
-    
-    for (int i = 0; i < state->num_nodes; i++) {
-        fprintf(stderr, "[MYFS] Connecting to node %d: %s:%d\n", i, state->nodes[i].host, state->nodes[i].port);
-        log_msg("[MYFS] Connecting to node %d: %s:%d\n", i, state->nodes[i].host, state->nodes[i].port);
-        
-        // Initialize mutex for this node's socket
-        pthread_mutex_init(&state->nodes[i].socket_mutex, NULL);
-        
-        state->nodes[i].socket_fd = connect_to_node(state->nodes[i].host, state->nodes[i].port);
-        if (state->nodes[i].socket_fd < 0) {
-            fprintf(stderr, "[MYFS ERROR] Failed to connect to node %d (%s:%d)\n", 
-                    i, state->nodes[i].host, state->nodes[i].port);
-            log_msg("[MYFS ERROR] Failed to connect to node %d (%s:%d)\n", 
-                    i, state->nodes[i].host, state->nodes[i].port);
-            return -1;
+///////////////////////////////////////////////////////////
+// XOR parity kernels
+//
+// xor_buffers() computes dest = srcs[0] ^ srcs[1] ^ ... in a single
+// pass over memory.  The widest kernel the CPU supports is selected
+// once at startup (select_xor_kernel); every kernel finishes the
+// unaligned tail with the portable word loop.
+///////////////////////////////////////////////////////////
+
+typedef void (*xor_kernel_t)(char* dest, const char* const* srcs, int nsrcs, size_t size);
+
+// Portable kernel: 8 bytes at a time, then single bytes
+static void xor_kernel_scalar(char* dest, const char* const* srcs, int nsrcs, size_t size) {
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t acc, word;
+        memcpy(&acc, srcs[0] + i, sizeof(acc));
+        for (int s = 1; s < nsrcs; s++) {
+            memcpy(&word, srcs[s] + i, sizeof(word));
+            acc ^= word;
         }
-        
-        fprintf(stderr, "[MYFS] ✓ Connected to node %d, socket fd=%d\n", i, state->nodes[i].socket_fd);
-        log_msg("[MYFS] Connected to node %d, socket fd=%d\n", i, state->nodes[i].socket_fd);
+        memcpy(dest + i, &acc, sizeof(acc));
+    }
+    for (; i < size; i++) {
+        char acc = srcs[0][i];
+        for (int s = 1; s < nsrcs; s++) {
+            acc ^= srcs[s][i];
+        }
+        dest[i] = acc;
     }
-    
-    fprintf(stderr, "[MYFS] ✓ All nodes connected successfully!\n");
-    log_msg("[MYFS] All nodes connected successfully!\n");
-    return 0;
 }
 
-// Forward declarations
-static int myfs_flush_write_buffer(const char* path);
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
 
-// XOR data buffers for parity calculation
-static void xor_buffers(char* dest, const char* src, size_t size) {
-    for (size_t i = 0; i < size; i++) {
-        dest[i] ^= src[i];
+// Finish the bytes a vector kernel left over
+static void xor_kernel_tail(char* dest, const char* const* srcs, int nsrcs, size_t done, size_t size) {
+    const char* tail[MAX_NODES];
+    for (int s = 0; s < nsrcs; s++) {
+        tail[s] = srcs[s] + done;
     }
+    xor_kernel_scalar(dest + done, tail, nsrcs, size - done);
 }
 
-// Buffer for accumulating writes before sending to storage nodes
-typedef struct {
-    char* buffer;
-    size_t size;
-    size_t capacity;
-    off_t max_offset;
-    size_t total_written;  // Track total bytes written to remote nodes
-} write_buffer_t;
+__attribute__((target("sse2")))
+static void xor_kernel_sse2(char* dest, const char* const* srcs, int nsrcs, size_t size) {
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m128i a0 = _mm_loadu_si128((const __m128i*)(srcs[0] + i));
+        __m128i a1 = _mm_loadu_si128((const __m128i*)(srcs[0] + i + 16));
+        for (int s = 1; s < nsrcs; s++) {
+            a0 = _mm_xor_si128(a0, _mm_loadu_si128((const __m128i*)(srcs[s] + i)));
+            a1 = _mm_xor_si128(a1, _mm_loadu_si128((const __m128i*)(srcs[s] + i + 16)));
+        }
+        _mm_storeu_si128((__m128i*)(dest + i), a0);
+        _mm_storeu_si128((__m128i*)(dest + i + 16), a1);
+    }
+    xor_kernel_tail(dest, srcs, nsrcs, i, size);
+}
 
-// Read cache to avoid repeatedly reading same file from network
-typedef struct {
-    char* buffer;           // Cached file content
-    size_t size;            // Size of cached content
-    char path[PATH_MAX];    // Path of cached file
-    time_t timestamp;       // When was this cached
-} read_cache_t;
+__attribute__((target("avx2")))
+static void xor_kernel_avx2(char* dest, const char* const* srcs, int nsrcs, size_t size) {
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        __m256i a0 = _mm256_loadu_si256((const __m256i*)(srcs[0] + i));
+        __m256i a1 = _mm256_loadu_si256((const __m256i*)(srcs[0] + i + 32));
+        for (int s = 1; s < nsrcs; s++) {
+            a0 = _mm256_xor_si256(a0, _mm256_loadu_si256((const __m256i*)(srcs[s] + i)));
+            a1 = _mm256_xor_si256(a1, _mm256_loadu_si256((const __m256i*)(srcs[s] + i + 32)));
+        }
+        _mm256_storeu_si256((__m256i*)(dest + i), a0);
+        _mm256_storeu_si256((__m256i*)(dest + i + 32), a1);
+    }
+    xor_kernel_tail(dest, srcs, nsrcs, i, size);
+}
 
-// Read-ahead window for large files (sliding window approach)
-typedef struct {
-    char* buffer;           // Window buffer (READAHEAD_WINDOW_SIZE bytes)
-    off_t start_offset;     // Starting offset of this window in the file
-    size_t valid_size;      // Valid data size in the window
-    char path[PATH_MAX];    // Path of the file this window belongs to
-    time_t timestamp;       // When was this window loaded
-} readahead_window_t;
+__attribute__((target("avx512f")))
+static void xor_kernel_avx512(char* dest, const char* const* srcs, int nsrcs, size_t size) {
+    size_t i = 0;
+    for (; i + 128 <= size; i += 128) {
+        __m512i a0 = _mm512_loadu_si512((const void*)(srcs[0] + i));
+        __m512i a1 = _mm512_loadu_si512((const void*)(srcs[0] + i + 64));
+        for (int s = 1; s < nsrcs; s++) {
+            a0 = _mm512_xor_si512(a0, _mm512_loadu_si512((const void*)(srcs[s] + i)));
+            a1 = _mm512_xor_si512(a1, _mm512_loadu_si512((const void*)(srcs[s] + i + 64)));
+        }
+        _mm512_storeu_si512((void*)(dest + i), a0);
+        _mm512_storeu_si512((void*)(dest + i + 64), a1);
+    }
+    xor_kernel_tail(dest, srcs, nsrcs, i, size);
+}
+#endif
 
-static write_buffer_t* get_write_buffer(const char* path, int create) {
-    // For simplicity, use a static buffer for now
-    // In production, you'd want a hash table of buffers per file
-    static write_buffer_t buffer = {NULL, 0, 0, 0, 0};
-    static char last_path[PATH_MAX] = "";
-    
-    // If different file, flush old buffer
-    if (buffer.buffer && strcmp(last_path, path) != 0) {
-        free(buffer.buffer);
-        buffer.buffer = NULL;
-        buffer.size = 0;
-        buffer.capacity = 0;
-        buffer.max_offset = 0;
-        buffer.total_written = 0;
+static xor_kernel_t xor_kernel = xor_kernel_scalar;
+static const char* xor_kernel_name = "scalar";
+
+// Pick the widest XOR kernel this CPU supports (called from bb_init)
+static void select_xor_kernel(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        xor_kernel = xor_kernel_avx512;
+        xor_kernel_name = "avx512";
+    } else if (__builtin_cpu_supports("avx2")) {
+        xor_kernel = xor_kernel_avx2;
+        xor_kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        xor_kernel = xor_kernel_sse2;
+        xor_kernel_name = "sse2";
     }
-    
-    strncpy(last_path, path, PATH_MAX - 1);
-    
-    if (create && !buffer.buffer) {
-        buffer.capacity = 8 * 1024 * 1024;  // 8MB buffer to reduce flushes
-        buffer.buffer = (char*)malloc(buffer.capacity);
-        buffer.size = 0;
-        buffer.max_offset = 0;
-        buffer.total_written = 0;
+#endif
+    fprintf(stderr, "[MYFS] Using %s XOR parity kernel\n", xor_kernel_name);
+    log_msg("[MYFS] Using %s XOR parity kernel\n", xor_kernel_name);
+}
+
+// XOR nsrcs equally sized buffers into dest (dest must not alias a source)
+static void xor_buffers(char* dest, const char* const* srcs, int nsrcs, size_t size) {
+    if (nsrcs <= 0) {
+        memset(dest, 0, size);
+        return;
     }
-    
-    return &buffer;
+    xor_kernel(dest, srcs, nsrcs, size);
 }
 
-// Get or create read cache for a file
-static read_cache_t* get_read_cache(const char* path, int create) {
-    static read_cache_t cache = {NULL, 0, "", 0};
-    
-    // If different file, free old cache
-    if (cache.buffer && strcmp(cache.path, path) != 0) {
-        fprintf(stderr, "[MYFS READ CACHE] Evicting cache for %s\n", cache.path);
-        free(cache.buffer);
-        cache.buffer = NULL;
-        cache.size = 0;
-        cache.path[0] = '\0';
-        cache.timestamp = 0;
+///////////////////////////////////////////////////////////
+// Stripe layout
+//
+// File data is cut into stripes of k stripe units; unit f of every
+// stripe goes to data fragment f, so each fragment holds runs of
+// stripe_unit contiguous file bytes.  The m parity fragments follow
+// the data fragments, and parity position p covers position p of
+// every data fragment.  Files written before layouts existed have no
+// MYFS_LAYOUT_XATTR and use byte round-robin striping with one XOR
+// parity, which is the same scheme with a stripe unit of 1.
+//
+// The layout also names the file's object: fragments are stored on
+// the nodes under a random object ID, so renaming a file (or a
+// directory above it) only renames its metadata file.  Files created
+// before object IDs existed keep using their path.
+///////////////////////////////////////////////////////////
+
+typedef struct {
+    int version;            // MYFS_LAYOUT_LEGACY or MYFS_LAYOUT_STRIPED
+    size_t stripe_unit;     // Contiguous file bytes per fragment per stripe
+    int data_fragments;     // k
+    int parity_fragments;   // m, any k of the k + m fragments rebuild the data
+    char object_id[MYFS_OBJECT_ID_LEN + 1];  // Fragment name on the nodes, "" = the path
+} myfs_layout_t;
+
+// Name of a file's fragments on the nodes
+static const char* layout_object_name(const myfs_layout_t* layout, const char* path) {
+    return layout->object_id[0] ? layout->object_id : path + 1;  // Skip leading '/'
+}
+
+static size_t layout_stripe_width(const myfs_layout_t* layout) {
+    return layout->stripe_unit * layout->data_fragments;
+}
+
+// Number of bytes of data fragment `frag` that hold file bytes before
+// `pos`; for pos = a range start/end this gives the fragment positions
+// covering the range.  Fragment 0 is always the longest.
+static size_t layout_frag_offset(const myfs_layout_t* layout, int frag, size_t pos) {
+    size_t unit = layout->stripe_unit;
+    size_t width = layout_stripe_width(layout);
+    size_t in_stripe = pos % width;
+    size_t unit_start = (size_t)frag * unit;
+    size_t in_unit = 0;
+    
+    if (in_stripe > unit_start) {
+        in_unit = in_stripe - unit_start;
+        if (in_unit > unit) {
+            in_unit = unit;
+        }
     }
-    
-    // If same file, check if cache is still valid (within CACHE_TTL_SECONDS)
-    if (cache.buffer && strcmp(cache.path, path) == 0) {
-        time_t now = time(NULL);
-        if (now - cache.timestamp > CACHE_TTL_SECONDS) {
-            // Cache expired, invalidate it
-            fprintf(stderr, "[MYFS READ CACHE] Cache expired for %s\n", path);
-            free(cache.buffer);
-            cache.buffer = NULL;
-            cache.size = 0;
-            cache.path[0] = '\0';
-            cache.timestamp = 0;
+    return pos / width * unit + in_unit;
+}
+
+// Fragment positions [*frag_start, *frag_end) of the parity covering
+// file bytes [start, end): the union of the data fragments' positions
+static void layout_parity_range(const myfs_layout_t* layout, size_t start, size_t end,
+                                size_t* frag_start, size_t* frag_end) {
+    *frag_start = SIZE_MAX;
+    *frag_end = 0;
+    for (int i = 0; i < layout->data_fragments; i++) {
+        size_t lo = layout_frag_offset(layout, i, start);
+        size_t hi = layout_frag_offset(layout, i, end);
+        if (lo < hi) {
+            *frag_start = (lo < *frag_start) ? lo : *frag_start;
+            *frag_end = (hi > *frag_end) ? hi : *frag_end;
         }
     }
-    
-    if (create && !cache.buffer) {
-        strncpy(cache.path, path, PATH_MAX - 1);
-        cache.timestamp = time(NULL);
+    if (*frag_start > *frag_end) {
+        *frag_start = *frag_end;  // Empty range
     }
-    
-    return &cache;
 }
 
-// Invalidate read cache for a file (called after write/truncate)
-static void invalidate_read_cache(const char* path) {
-    read_cache_t* cache = get_read_cache(path, 0);
-    if (cache && cache->buffer && strcmp(cache->path, path) == 0) {
-        fprintf(stderr, "[MYFS READ CACHE] Invalidating cache for %s\n", path);
-        free(cache->buffer);
-        cache->buffer = NULL;
-        cache->size = 0;
-        cache->path[0] = '\0';
-        cache->timestamp = 0;
+// Copy file bytes [start, start + len) into the data fragment buffers,
+// which hold fragment positions starting at frag_base
+static void layout_scatter(const myfs_layout_t* layout, char** fragments, size_t frag_base,
+                           const char* src, size_t start, size_t len) {
+    size_t unit = layout->stripe_unit;
+    size_t width = layout_stripe_width(layout);
+    size_t pos = start;
+    
+    while (pos < start + len) {
+        size_t in_stripe = pos % width;
+        size_t in_unit = in_stripe % unit;
+        size_t chunk = unit - in_unit;
+        if (chunk > start + len - pos) {
+            chunk = start + len - pos;
+        }
+        memcpy(fragments[in_stripe / unit] + (pos / width * unit + in_unit - frag_base),
+               src + (pos - start), chunk);
+        pos += chunk;
     }
 }
 
-// Get or manage readahead window for large files
-static readahead_window_t* get_readahead_window(const char* path, int create) {
-    static readahead_window_t window = {NULL, -1, 0, "", 0};
-    
-    // If different file, free old window
-    if (window.buffer && strcmp(window.path, path) != 0) {
-        fprintf(stderr, "[MYFS READAHEAD] Evicting window for %s\n", window.path);
-        free(window.buffer);
-        window.buffer = NULL;
-        window.start_offset = -1;
-        window.valid_size = 0;
-        window.path[0] = '\0';
-        window.timestamp = 0;
+// Reassemble file bytes [start, start + len) from data fragment buffers
+// holding positions [frag_base, frag_base + frag_len); bytes past the
+// fetched positions read as zeros
+static void layout_gather(const myfs_layout_t* layout, char* dest, char** fragments,
+                          size_t frag_base, size_t frag_len, size_t start, size_t len) {
+    size_t unit = layout->stripe_unit;
+    size_t width = layout_stripe_width(layout);
+    size_t pos = start;
+    
+    while (pos < start + len) {
+        size_t in_stripe = pos % width;
+        size_t in_unit = in_stripe % unit;
+        size_t chunk = unit - in_unit;
+        if (chunk > start + len - pos) {
+            chunk = start + len - pos;
+        }
+        size_t frag_pos = pos / width * unit + in_unit - frag_base;
+        size_t avail = (frag_pos < frag_len) ? frag_len - frag_pos : 0;
+        if (avail > chunk) {
+            avail = chunk;
+        }
+        memcpy(dest + (pos - start), fragments[in_stripe / unit] + frag_pos, avail);
+        memset(dest + (pos - start) + avail, 0, chunk - avail);
+        pos += chunk;
     }
+}
+
+// Read the layout of a file from its metadata file.  Files without the
+// attribute predate layouts and use byte round-robin striping.
+static int load_file_layout(const char* fpath, int num_nodes, myfs_layout_t* layout) {
+    char value[128];
+#ifdef HAVE_SYS_XATTR_H
+    ssize_t len = lgetxattr(fpath, MYFS_LAYOUT_XATTR, value, sizeof(value) - 1);
+#else
+    ssize_t len = -1;
+    errno = ENOTSUP;
+#endif
     
-    // Check if window has expired (use same TTL as cache)
-    if (window.buffer && strcmp(window.path, path) == 0) {
-        time_t now = time(NULL);
-        if (now - window.timestamp > CACHE_TTL_SECONDS) {
-            fprintf(stderr, "[MYFS READAHEAD] Window expired for %s\n", path);
-            free(window.buffer);
-            window.buffer = NULL;
-            window.start_offset = -1;
-            window.valid_size = 0;
-            window.path[0] = '\0';
-            window.timestamp = 0;
+    layout->object_id[0] = '\0';
+    if (len < 0) {
+        if (errno != ENODATA && errno != ENOTSUP) {
+            return -errno;
         }
+        layout->version = MYFS_LAYOUT_LEGACY;
+        layout->stripe_unit = 1;
+        layout->data_fragments = num_nodes - 1;
+        layout->parity_fragments = 1;
+        return 0;
     }
-    
-    if (create && !window.buffer) {
-        strncpy(window.path, path, PATH_MAX - 1);
-        window.timestamp = time(NULL);
+    value[len] = '\0';
+    
+    // Layouts written before Reed-Solomon support have a single parity,
+    // and ones written before object IDs no oid
+    unsigned long unit = 0;
+    layout->parity_fragments = 1;
+    int fields = sscanf(value, "version=%d unit=%lu data=%d parity=%d oid=%32[0-9a-f]",
+                        &layout->version, &unit, &layout->data_fragments,
+                        &layout->parity_fragments, layout->object_id);
+    if (fields < 3 || layout->version != MYFS_LAYOUT_STRIPED || unit == 0 ||
+        layout->data_fragments < 1 || layout->parity_fragments < 1) {
+        fprintf(stderr, "[MYFS LAYOUT ERROR] %s: unrecognised layout \"%s\"\n", fpath, value);
+        log_msg("[MYFS LAYOUT ERROR] %s: unrecognised layout \"%s\"\n", fpath, value);
+        return -EIO;
     }
+    layout->stripe_unit = unit;
     
-    return &window;
+    if (layout->data_fragments + layout->parity_fragments != num_nodes) {
+        fprintf(stderr, "[MYFS LAYOUT ERROR] %s was written as %d+%d fragments, mounted with %d nodes\n",
+                fpath, layout->data_fragments, layout->parity_fragments, num_nodes);
+        log_msg("[MYFS LAYOUT ERROR] %s: %d+%d fragments on %d nodes\n",
+                fpath, layout->data_fragments, layout->parity_fragments, num_nodes);
+        return -EIO;
+    }
+    return 0;
 }
 
-// Invalidate readahead window for a file (called after write/truncate)
-static void invalidate_readahead_window(const char* path) {
-    readahead_window_t* window = get_readahead_window(path, 0);
-    if (window && window->buffer && strcmp(window->path, path) == 0) {
-        fprintf(stderr, "[MYFS READAHEAD] Invalidating window for %s\n", path);
-        free(window->buffer);
-        window->buffer = NULL;
-        window->start_offset = -1;
-        window->valid_size = 0;
-        window->path[0] = '\0';
-        window->timestamp = 0;
+// Pick a random object ID
+static void new_object_id(char id[MYFS_OBJECT_ID_LEN + 1]) {
+    static unsigned long counter = 0;
+    unsigned char bytes[MYFS_OBJECT_ID_LEN / 2];
+    
+    int fd = open("/dev/urandom", O_RDONLY);
+    ssize_t n = (fd >= 0) ? read(fd, bytes, sizeof(bytes)) : -1;
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (n != (ssize_t)sizeof(bytes)) {
+        // No entropy source: time, pid and a counter are still unique
+        unsigned long long parts[2] = {
+            (unsigned long long)time(NULL) ^ ((unsigned long long)getpid() << 32),
+            __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED) ^ (unsigned long long)clock()
+        };
+        memcpy(bytes, parts, sizeof(bytes) < sizeof(parts) ? sizeof(bytes) : sizeof(parts));
+    }
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        sprintf(id + 2 * i, "%02x", bytes[i]);
     }
 }
 
-// Distributed write function
-static int myfs_write(const char* path, const char* buf, size_t size, off_t offset) {
+// Give an empty file the configured layout.  A file emptied by a
+// truncate keeps its object ID, so its old fragments are overwritten
+// rather than orphaned.  Falls back to byte round-robin striping under
+// the path when the metadata filesystem has no user xattrs.
+static void create_file_layout(const char* fpath, int num_nodes, myfs_layout_t* layout) {
     struct bb_state* state = BB_DATA;
-    int num_nodes = state->num_nodes;
-    int num_data_fragments = num_nodes - 1;  // n-1 data fragments
-    
-    // Invalidate read cache and readahead window since file is being modified
-    invalidate_read_cache(path);
-    invalidate_readahead_window(path);
-    
-    fprintf(stderr, "[MYFS WRITE] path=%s, size=%zu, offset=%ld\n", 
-            path, size, offset);
-    log_msg("\n[MYFS WRITE] path=%s, size=%zu, offset=%ld, num_nodes=%d\n", 
-            path, size, offset, num_nodes);
+    char value[128];
     
-    // Get or create write buffer for this file
-    write_buffer_t* wb = get_write_buffer(path, 1);
-    if (!wb || !wb->buffer) {
-        fprintf(stderr, "[MYFS WRITE ERROR] Failed to allocate write buffer\n");
-        return -ENOMEM;
+    myfs_layout_t old;
+    if (load_file_layout(fpath, num_nodes, &old) == 0 && old.object_id[0]) {
+        memcpy(layout->object_id, old.object_id, sizeof(layout->object_id));
+    } else {
+        new_object_id(layout->object_id);
     }
-    
-    // Check if we need to flush buffer before writing
-    // Calculate position in buffer relative to what's already written
-    size_t buffer_start = wb->total_written;
-    size_t buffer_end = buffer_start + wb->capacity;
-    
-    // Check if this write is beyond our current buffer window
-    if (offset >= buffer_end || offset + size > buffer_end) {
-        // Need to flush current buffer and start new one
-        if (wb->size > 0) {
-            fprintf(stderr, "[MYFS WRITE] Flushing %zu bytes (offset %zu beyond buffer window)...\n", 
-                    wb->size, offset);
-            int flush_ret = myfs_flush_write_buffer(path);
-            if (flush_ret < 0) {
-                fprintf(stderr, "[MYFS WRITE ERROR] Failed to flush buffer: %d\n", flush_ret);
-                return flush_ret;
-            }
-            // After flush, get fresh buffer
-            wb = get_write_buffer(path, 1);
-            if (!wb || !wb->buffer) {
-                return -ENOMEM;
-            }
-        }
+    layout->version = MYFS_LAYOUT_STRIPED;
+    layout->stripe_unit = state->stripe_unit;
+    layout->data_fragments = num_nodes - state->parity_fragments;
+    layout->parity_fragments = state->parity_fragments;
+    
+    int len = snprintf(value, sizeof(value), "version=%d unit=%zu data=%d parity=%d oid=%s",
+                       layout->version, layout->stripe_unit, layout->data_fragments,
+                       layout->parity_fragments, layout->object_id);
+#ifdef HAVE_SYS_XATTR_H
+    if (lsetxattr(fpath, MYFS_LAYOUT_XATTR, value, len, 0) == 0) {
+        return;
     }
-    
-    // Check if single write is larger than buffer capacity
-    if (size > wb->capacity) {
-        fprintf(stderr, "[MYFS WRITE ERROR] Single write (%zu bytes) exceeds buffer capacity (%zu)\n",
-                size, wb->capacity);
-        // For very large single writes, we'd need streaming support
-        return -EFBIG;
+#else
+    (void)len;
+    errno = ENOTSUP;
+#endif
+    fprintf(stderr, "[MYFS LAYOUT WARNING] Cannot store layout of %s (%s), using byte striping with XOR parity\n",
+            fpath, strerror(errno));
+    log_msg("[MYFS LAYOUT WARNING] Cannot store layout of %s: %s\n", fpath, strerror(errno));
+    layout->version = MYFS_LAYOUT_LEGACY;
+    layout->stripe_unit = 1;
+    layout->data_fragments = num_nodes - 1;
+    layout->parity_fragments = 1;
+    layout->object_id[0] = '\0';
+}
+
+///////////////////////////////////////////////////////////
+// Erasure codes
+//
+// Parity fragment j holds sum_i P[j][i] * data_i over GF(2^8)
+// (polynomial 0x11d).  P is a Cauchy matrix with every column scaled
+// so that row 0 is all ones: parity 0 is the plain XOR of the data,
+// which keeps single-parity layouts and legacy files bit-compatible,
+// and every k x k submatrix of [I; P] stays invertible, so any k
+// surviving fragments rebuild the data.
+///////////////////////////////////////////////////////////
+
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+static uint8_t gf_nibble_tables[256][32];  // c * low nibble, c * (high nibble << 4)
+
+static uint8_t gf_mul(uint8_t a, uint8_t b) {
+    if (a == 0 || b == 0) {
+        return 0;
     }
-    
-    // Check if write would overflow current buffer
-    size_t temp_offset = offset - wb->total_written;
-    if (temp_offset + size > wb->capacity) {
-        // Flush current buffer first
-        if (wb->size > 0) {
-            fprintf(stderr, "[MYFS WRITE] Buffer would overflow, flushing %zu bytes...\n", wb->size);
-            int flush_ret = myfs_flush_write_buffer(path);
-            if (flush_ret < 0) {
-                return flush_ret;
-            }
-            wb = get_write_buffer(path, 1);
-            if (!wb || !wb->buffer) {
-                return -ENOMEM;
-            }
+    return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static uint8_t gf_inv(uint8_t a) {
+    return gf_exp[255 - gf_log[a]];
+}
+
+static void init_gf_tables(void) {
+    int x = 1;
+    for (int i = 0; i < 255; i++) {
+        gf_exp[i] = gf_exp[i + 255] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100) {
+            x ^= 0x11d;
         }
     }
-    
-    // Calculate buffer offset relative to total_written
-    size_t buffer_offset = (offset >= wb->total_written) ? (offset - wb->total_written) : offset;
-    
-    // For sequential writes after flush
-    if (buffer_offset == wb->size) {
-        // Append to buffer
-        memcpy(wb->buffer + wb->size, buf, size);
-        wb->size += size;
-        wb->max_offset = wb->total_written + wb->size;
-    } else if (buffer_offset < wb->size) {
-        // Overwrite existing data in buffer
-        memcpy(wb->buffer + buffer_offset, buf, size);
-        if (buffer_offset + size > wb->size) {
-            wb->size = buffer_offset + size;
+    for (int c = 0; c < 256; c++) {
+        for (int n = 0; n < 16; n++) {
+            gf_nibble_tables[c][n] = gf_mul(c, n);
+            gf_nibble_tables[c][16 + n] = gf_mul(c, n << 4);
         }
-        wb->max_offset = wb->total_written + wb->size;
-    } else {
-        // Write beyond current buffer size - fill gap with zeros
-        if (buffer_offset > wb->size) {
-            memset(wb->buffer + wb->size, 0, buffer_offset - wb->size);
+    }
+}
+
+// dest = c * src, or dest ^= c * src when accumulating
+typedef void (*gf_kernel_t)(uint8_t c, const uint8_t* src, uint8_t* dest, size_t len, int accumulate);
+
+static void gf_kernel_scalar(uint8_t c, const uint8_t* src, uint8_t* dest, size_t len, int accumulate) {
+    const uint8_t* t = gf_nibble_tables[c];
+    for (size_t i = 0; i < len; i++) {
+        uint8_t p = t[src[i] & 0x0f] ^ t[16 + (src[i] >> 4)];
+        dest[i] = accumulate ? dest[i] ^ p : p;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// The vector kernels look up both nibbles of 16 bytes at a time with
+// one byte shuffle each
+__attribute__((target("ssse3")))
+static void gf_kernel_ssse3(uint8_t c, const uint8_t* src, uint8_t* dest, size_t len, int accumulate) {
+    __m128i lo = _mm_loadu_si128((const __m128i*)gf_nibble_tables[c]);
+    __m128i hi = _mm_loadu_si128((const __m128i*)(gf_nibble_tables[c] + 16));
+    __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i p = _mm_xor_si128(_mm_shuffle_epi8(lo, _mm_and_si128(s, mask)),
+                                  _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+        if (accumulate) {
+            p = _mm_xor_si128(p, _mm_loadu_si128((const __m128i*)(dest + i)));
         }
-        memcpy(wb->buffer + buffer_offset, buf, size);
-        wb->size = buffer_offset + size;
-        wb->max_offset = wb->total_written + wb->size;
+        _mm_storeu_si128((__m128i*)(dest + i), p);
     }
-    
-    fprintf(stderr, "[MYFS WRITE] Buffered %zu bytes at offset %ld (total buffered: %zu)\n",
-            size, offset, wb->size);
-    
-    // Return success - actual distribution happens on flush/close
-    return size;
+    gf_kernel_scalar(c, src + i, dest + i, len - i, accumulate);
 }
 
-// Function to actually send buffered data to storage nodes
-static int myfs_flush_write_buffer(const char* path) {
-    struct bb_state* state = BB_DATA;
-    int num_nodes = state->num_nodes;
-    int num_data_fragments = num_nodes - 1;
-    
-    write_buffer_t* wb = get_write_buffer(path, 0);
-    if (!wb || !wb->buffer || wb->size == 0) {
-        return 0;  // Nothing to flush
+__attribute__((target("avx2")))
+static void gf_kernel_avx2(uint8_t c, const uint8_t* src, uint8_t* dest, size_t len, int accumulate) {
+    __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)gf_nibble_tables[c]));
+    __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(gf_nibble_tables[c] + 16)));
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(s, mask)),
+                                     _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)));
+        if (accumulate) {
+            p = _mm256_xor_si256(p, _mm256_loadu_si256((const __m256i*)(dest + i)));
+        }
+        _mm256_storeu_si256((__m256i*)(dest + i), p);
     }
-    
-    // Store the buffer size before flushing (we'll need it to update metadata)
-    size_t flushed_size = wb->size;
-    
-    fprintf(stderr, "[MYFS FLUSH] ========== DISTRIBUTING %zu BYTES ==========\n", wb->size);
-    log_msg("[MYFS FLUSH] Distributing %zu bytes to %d nodes\n", wb->size, num_nodes);
-    
-    // Calculate fragment size
-    size_t fragment_size = (wb->size + num_data_fragments - 1) / num_data_fragments;
-    
-    fprintf(stderr, "[MYFS FLUSH] Fragment size: %zu bytes (total: %zu)\n", 
-            fragment_size, wb->size);
-    
-    // Allocate buffers for fragments
-    char** fragments = (char**)malloc(num_nodes * sizeof(char*));
-    if (!fragments) {
-        fprintf(stderr, "[MYFS WRITE ERROR] Failed to allocate fragment pointer array\n");
-        log_msg("[MYFS WRITE ERROR] Failed to allocate fragment pointer array\n");
-        return -ENOMEM;
+    gf_kernel_scalar(c, src + i, dest + i, len - i, accumulate);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void gf_kernel_avx512(uint8_t c, const uint8_t* src, uint8_t* dest, size_t len, int accumulate) {
+    __m512i lo = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*)gf_nibble_tables[c]));
+    __m512i hi = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*)(gf_nibble_tables[c] + 16)));
+    __m512i mask = _mm512_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i s = _mm512_loadu_si512((const void*)(src + i));
+        __m512i p = _mm512_xor_si512(_mm512_shuffle_epi8(lo, _mm512_and_si512(s, mask)),
+                                     _mm512_shuffle_epi8(hi, _mm512_and_si512(_mm512_srli_epi64(s, 4), mask)));
+        if (accumulate) {
+            p = _mm512_xor_si512(p, _mm512_loadu_si512((const void*)(dest + i)));
+        }
+        _mm512_storeu_si512((void*)(dest + i), p);
     }
-    
-    // Initialize all pointers to NULL for safe cleanup
-    for (int i = 0; i < num_nodes; i++) {
-        fragments[i] = NULL;
+    gf_kernel_scalar(c, src + i, dest + i, len - i, accumulate);
+}
+#endif
+
+static gf_kernel_t gf_kernel = gf_kernel_scalar;
+static const char* gf_kernel_name = "scalar";
+
+// Build the GF(2^8) tables and pick the widest multiply kernel this
+// CPU supports (called from bb_init)
+static void select_gf_kernel(void) {
+    init_gf_tables();
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) {
+        gf_kernel = gf_kernel_avx512;
+        gf_kernel_name = "avx512";
+    } else if (__builtin_cpu_supports("avx2")) {
+        gf_kernel = gf_kernel_avx2;
+        gf_kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("ssse3")) {
+        gf_kernel = gf_kernel_ssse3;
+        gf_kernel_name = "ssse3";
     }
-    
-    // Allocate each fragment buffer
-    for (int i = 0; i < num_nodes; i++) {
-        fragments[i] = (char*)calloc(fragment_size, 1);
-        if (!fragments[i]) {
-            fprintf(stderr, "[MYFS WRITE ERROR] Failed to allocate fragment %d buffer (%zu bytes)\n", 
-                    i, fragment_size);
-            log_msg("[MYFS WRITE ERROR] Failed to allocate fragment %d buffer\n", i);
-            // Clean up already allocated buffers
-            for (int j = 0; j < i; j++) {
-                free(fragments[j]);
-            }
-            free(fragments);
-            return -ENOMEM;
+#endif
+    fprintf(stderr, "[MYFS] Using %s GF(2^8) kernel\n", gf_kernel_name);
+    log_msg("[MYFS] Using %s GF(2^8) kernel\n", gf_kernel_name);
+}
+
+// Coefficient of data fragment `col` in parity fragment `row`: the
+// Cauchy entry 1 / (x_row + y_col) with x_row = row, y_col = m + col,
+// divided by the row 0 entry 1 / y_col
+static uint8_t rs_parity_coef(const myfs_layout_t* layout, int row, int col) {
+    uint8_t y = layout->parity_fragments + col;
+    return gf_mul(gf_inv(row ^ y), y);
+}
+
+// An erasure code: encode fills the parity fragments from the data
+// fragments; decode rebuilds the data fragments flagged in `wanted`
+// from those flagged in `present` (at least k of them)
+typedef struct {
+    const char* name;
+    void (*encode)(const myfs_layout_t* layout, char** fragments, size_t len);
+    int (*decode)(const myfs_layout_t* layout, char** fragments, const int* present,
+                  const int* wanted, size_t len);
+} erasure_codec_t;
+
+static void xor_encode(const myfs_layout_t* layout, char** fragments, size_t len) {
+    xor_buffers(fragments[layout->data_fragments], (const char* const*)fragments,
+                layout->data_fragments, len);
+}
+
+static int xor_decode(const myfs_layout_t* layout, char** fragments, const int* present,
+                      const int* wanted, size_t len) {
+    int n = layout->data_fragments + 1;
+    const char* survivors[MAX_NODES];
+    int num_survivors = 0;
+    int missing = -1;
+    
+    for (int i = 0; i < n; i++) {
+        if (present[i]) {
+            survivors[num_survivors++] = fragments[i];
+        } else if (missing < 0) {
+            missing = i;
+        } else {
+            return -EIO;  // A single parity covers one loss
         }
     }
-    
-    // Distribute buffered data across fragments
-    fprintf(stderr, "[MYFS FLUSH] Distributing data across %d data fragments...\n", num_data_fragments);
-    for (size_t i = 0; i < wb->size; i++) {
-        // Distribute data in round-robin fashion across data fragments
-        int frag_idx = i % num_data_fragments;  // Which data fragment (0 or 1 for 3 nodes)
-        size_t frag_pos = i / num_data_fragments;  // Position within that fragment
-        
-        if (frag_pos < fragment_size) {
-            fragments[frag_idx][frag_pos] = wb->buffer[i];
+    if (missing >= 0 && missing < layout->data_fragments && wanted[missing]) {
+        xor_buffers(fragments[missing], survivors, num_survivors, len);
+    }
+    return 0;
+}
+
+static void rs_encode(const myfs_layout_t* layout, char** fragments, size_t len) {
+    int k = layout->data_fragments;
+    
+    xor_encode(layout, fragments, len);
+    for (int j = 1; j < layout->parity_fragments; j++) {
+        for (int i = 0; i < k; i++) {
+            gf_kernel(rs_parity_coef(layout, j, i), (const uint8_t*)fragments[i],
+                      (uint8_t*)fragments[k + j], len, i > 0);
         }
     }
-    
-    // Calculate parity fragment (XOR of all data fragments)
-    fprintf(stderr, "[MYFS FLUSH] Calculating parity (XOR) for fragment %d...\n", num_nodes - 1);
-    memset(fragments[num_nodes - 1], 0, fragment_size);
-    for (int i = 0; i < num_data_fragments; i++) {
-        xor_buffers(fragments[num_nodes - 1], fragments[i], fragment_size);
+}
+
+// Invert the k x k matrix `a` in place into `inv`; 0 on success
+static int gf_invert_matrix(uint8_t* a, uint8_t* inv, int k) {
+    for (int r = 0; r < k; r++) {
+        for (int c = 0; c < k; c++) {
+            inv[r * k + c] = (r == c);
+        }
     }
-    
-    // Send fragments to nodes
-    fprintf(stderr, "[MYFS FLUSH] Sending fragments to %d nodes...\n", num_nodes);
-    int retstat = 0;
-    for (int i = 0; i < num_nodes; i++) {
-        request_header_t req;
-        response_header_t resp;
-        memset(&resp, 0, sizeof(resp));  // Initialize response
-        
-        req.type = REQ_WRITE;
-        strncpy(req.filename, path + 1, sizeof(req.filename) - 1);  // Skip leading '/'
-        req.size = fragment_size;
-        // For appending to existing fragments, calculate offset based on total_written
-        req.offset = (wb->total_written / num_data_fragments);  
-        req.fragment_id = i;
-        
-        fprintf(stderr, "[MYFS FLUSH] Node %d: Sending header (file=%s, frag=%u, size=%zu, offset=%ld)...\n",
-                i, req.filename, req.fragment_id, req.size, req.offset);
-        
-        // Lock mutex for thread-safe socket access
-        pthread_mutex_lock(&state->nodes[i].socket_mutex);
+    for (int c = 0; c < k; c++) {
+        int pivot = c;
+        while (pivot < k && a[pivot * k + c] == 0) {
+            pivot++;
+        }
+        if (pivot == k) {
+            return -1;
+        }
+        if (pivot != c) {
+            for (int x = 0; x < k; x++) {
+                uint8_t t = a[c * k + x]; a[c * k + x] = a[pivot * k + x]; a[pivot * k + x] = t;
+                t = inv[c * k + x]; inv[c * k + x] = inv[pivot * k + x]; inv[pivot * k + x] = t;
+            }
+        }
+        uint8_t scale = gf_inv(a[c * k + c]);
+        for (int x = 0; x < k; x++) {
+            a[c * k + x] = gf_mul(a[c * k + x], scale);
+            inv[c * k + x] = gf_mul(inv[c * k + x], scale);
+        }
+        for (int r = 0; r < k; r++) {
+            uint8_t f = a[r * k + c];
+            if (r == c || f == 0) {
+                continue;
+            }
+            for (int x = 0; x < k; x++) {
+                a[r * k + x] ^= gf_mul(f, a[c * k + x]);
+                inv[r * k + x] ^= gf_mul(f, inv[c * k + x]);
+            }
+        }
+    }
+    return 0;
+}
+
+static int rs_decode(const myfs_layout_t* layout, char** fragments, const int* present,
+                     const int* wanted, size_t len) {
+    int k = layout->data_fragments;
+    int n = k + layout->parity_fragments;
+    int rows[MAX_NODES];
+    int num_rows = 0;
+    
+    // Use the first k surviving fragments, data before parity
+    for (int i = 0; i < n && num_rows < k; i++) {
+        if (present[i]) {
+            rows[num_rows++] = i;
+        }
+    }
+    if (num_rows < k) {
+        return -EIO;
+    }
+    
+    // Rows of [I; P] for the survivors, inverted: data = inv * survivors
+    uint8_t a[MAX_NODES * MAX_NODES];
+    uint8_t inv[MAX_NODES * MAX_NODES];
+    for (int r = 0; r < k; r++) {
+        for (int c = 0; c < k; c++) {
+            a[r * k + c] = (rows[r] < k) ? (rows[r] == c) : rs_parity_coef(layout, rows[r] - k, c);
+        }
+    }
+    if (gf_invert_matrix(a, inv, k) < 0) {
+        return -EIO;
+    }
+    
+    for (int i = 0; i < k; i++) {
+        if (present[i] || !wanted[i]) {
+            continue;
+        }
+        int first = 1;
+        for (int r = 0; r < k; r++) {
+            uint8_t c = inv[i * k + r];
+            if (c == 0) {
+                continue;
+            }
+            gf_kernel(c, (const uint8_t*)fragments[rows[r]], (uint8_t*)fragments[i], len, !first);
+            first = 0;
+        }
+        if (first) {
+            memset(fragments[i], 0, len);
+        }
+    }
+    return 0;
+}
+
+static const erasure_codec_t xor_codec = { "xor", xor_encode, xor_decode };
+static const erasure_codec_t rs_codec = { "reed-solomon", rs_encode, rs_decode };
+
+static const erasure_codec_t* layout_codec(const myfs_layout_t* layout) {
+    return (layout->parity_fragments == 1) ? &xor_codec : &rs_codec;
+}
+
+///////////////////////////////////////////////////////////
+// Parallel node I/O
+//
+// Node I/O engine
+//
+// Each storage node gets a pool of connections (--conns) and requests
+// go to the least loaded one.  Every request carries an id, and a node
+// that supports MYFS_CAP_MULTIPLEX answers in any order, so any number
+// of threads can have requests outstanding on the same connection, up
+// to the credits the node granted in its hello.  Connection k of every
+// node is driven by I/O thread k with epoll: it sends queued requests
+// while credits last and hands every response to the request with its
+// id.  Callers submit a batch of ops with run_node_ops() and sleep
+// until enough of them complete, so a fan-out costs about one round
+// trip to the slowest node needed.  A keeper thread replaces broken
+// connections in the background.
+///////////////////////////////////////////////////////////
+
+#define NODE_IO_TIMEOUT_MS 30000   // Give up on a node that stays silent this long
+#define HEDGE_DELAY_DEFAULT_MS 20  // Ask the parity node after this long (--hedge-ms)
+#define NODE_MAX_CREDITS 32        // Most requests outstanding on a connection
+#define NODE_DISCARD_SIZE (64 * 1024)  // Read size for dropped response data
+#define NODE_CONNS_DEFAULT 2       // Connections to each node (--conns)
+#define NODE_KEEPER_INTERVAL_SECS 1  // Retry broken connections this often
+
+// Progress of one node op
+enum {
+    NODE_OP_IDLE,       // Not submitted yet
+    NODE_OP_QUEUED,     // Waiting for its turn (and a credit) to be sent
+    NODE_OP_SENDING,    // Partly sent
+    NODE_OP_SENT,       // Waiting for the response
+    NODE_OP_RECEIVING,  // Response data arriving
+    NODE_OP_DONE,       // Response received (check resp.status)
+    NODE_OP_FAILED,     // Connection or protocol failure
+    NODE_OP_HELD,       // Hedge op waiting to be issued
+    NODE_OP_CANCELLED   // Not needed once the quorum was reached
+};
+
+// Engine counters, updated atomically
+typedef struct {
+    unsigned long hedges;        // Hedge requests issued
+    unsigned long stragglers;    // In-flight requests discarded after the quorum
+    unsigned long reconnects;    // Connections replaced by the keeper
+} node_io_stats_t;
+
+static node_io_stats_t node_io_stats;
+
+struct node_conn;
+
+// An I/O thread and the epoll set of the connections it drives
+typedef struct node_io_thread {
+    int index;                   // Pool slot it serves on every node
+    int epfd;
+    int wake[2];                 // Pipe that interrupts epoll_wait
+    pthread_t thread;
+    struct node_conn* dead;      // Failed connections to close
+    char discard[NODE_DISCARD_SIZE];  // Sink for data nobody waits for
+} node_io_thread_t;
+
+// One request/response exchange with a storage node
+typedef struct node_op {
+    int node;                    // Node index
+    request_header_t req;        // Request to send
+    char wire_req[MYFS_REQUEST_MAX];  // req encoded for the wire
+    size_t wire_len;
+    const char* send_data;       // Payload following the header (WRITE)
+    size_t send_len;
+    char* recv_buf;              // Destination for response data (READ)
+    size_t recv_cap;
+    response_header_t resp;      // Response header, valid once DONE
+    int state;                   // NODE_OP_*
+    size_t progress;             // Bytes sent, or response data received
+    int reconnected;             // Already retried on a fresh connection
+    int retry;                   // Failed before its response started
+    int hedge;                   // Hold back until the hedge delay expires
+    struct node_conn* conn;      // Connection it was submitted on
+    struct node_op* next;        // Send queue link
+    pthread_cond_t* done;        // Signalled when the op finishes
+} node_op_t;
+
+// A connection to a storage node, shared by the requests sent on it
+typedef struct node_conn {
+    int node;
+    int slot;                    // Position in the node's pool
+    node_io_thread_t* io;        // Thread driving it
+    int sock;
+    int load;                    // Ops queued or in flight on it
+    int credits;                 // Requests the node lets us have outstanding
+    int outstanding;             // Slots in use
+    struct {
+        node_op_t* op;           // NULL once cancelled: the response is dropped
+        int type;
+        int busy;
+    } slots[NODE_MAX_CREDITS];   // Outstanding requests, indexed by request id
+    node_op_t* send_head;        // Requests waiting to be sent, in order
+    node_op_t* send_tail;
+    myfs_response_t wire_resp;   // Response header being received
+    size_t resp_received;
+    node_op_t* data_op;          // Op whose data is arriving (NULL: discard it)
+    size_t data_left;            // Response data still to come
+    uint32_t events;             // epoll interest registered
+    int io_busy;                 // I/O thread is in a socket call on it
+    int io_waiters;              // Threads waiting for it to leave
+    int dead;                    // Failed, the I/O thread closes it
+    struct node_conn* next_dead;
+} node_conn_t;
+
+// Engine state.  `lock` protects the connections and every submitted
+// op.  I/O threads drop it for the socket calls themselves; while one
+// runs the connection is io_busy, and nothing that would release the
+// buffers of its ops may proceed until it is over.
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t io_idle;      // Some connection left a socket call
+    pthread_cond_t keeper_cond;  // Wakes the keeper early
+    int pool_size;               // Connections (and I/O threads) per node
+    node_io_thread_t threads[MAX_CONNS_PER_NODE];
+    pthread_t keeper;
+    int keeper_started;
+    int running;
+    int stopping;
+    node_conn_t* conns[MAX_NODES][MAX_CONNS_PER_NODE];  // Each node's pool
+} node_io = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .io_idle = PTHREAD_COND_INITIALIZER,
+    .keeper_cond = PTHREAD_COND_INITIALIZER
+};
+
+// Prepare an op for run_node_ops() on the fragments named `name`
+static void init_node_op(node_op_t* op, int node, request_type_t type, const char* name,
+                         uint32_t fragment_id, size_t size, off_t offset) {
+    memset(op, 0, sizeof(node_op_t));
+    op->node = node;
+    op->req.type = type;
+    strncpy(op->req.filename, name, sizeof(op->req.filename) - 1);
+    op->req.size = size;
+    op->req.offset = offset;
+    op->req.fragment_id = fragment_id;
+}
+
+static void wake_node_io(node_io_thread_t* io) {
+    char c = 0;
+    if (write(io->wake[1], &c, 1) < 0 && errno != EAGAIN) {
+        perror("write");
+    }
+}
+
+// Wait until no socket call is running on a connection
+static void wait_conn_idle_locked(node_conn_t* conn) {
+    conn->io_waiters++;
+    while (conn->io_busy) {
+        pthread_cond_wait(&node_io.io_idle, &node_io.lock);
+    }
+    conn->io_waiters--;
+}
+
+// Make a socket call (`call` is evaluated with the lock dropped)
+#define NODE_IO_CALL(conn, result, call) do {            \
+        (conn)->io_busy = 1;                              \
+        pthread_mutex_unlock(&node_io.lock);              \
+        result = (call);                                  \
+        int saved_errno = errno;                          \
+        pthread_mutex_lock(&node_io.lock);                \
+        (conn)->io_busy = 0;                              \
+        pthread_cond_broadcast(&node_io.io_idle);         \
+        errno = saved_errno;                              \
+    } while (0)
+
+// Finish an op and wake its caller
+static void finish_node_op_locked(node_op_t* op, int state) {
+    if (op->conn) {
+        op->conn->load--;
+    }
+    op->state = state;
+    op->conn = NULL;
+    pthread_cond_broadcast(op->done);
+}
+
+// Take a connection out of service: fail every op on it and leave the
+// socket for the I/O thread to close.  Ops whose response had not
+// started are marked for a retry on a new connection.
+static void fail_node_conn_locked(node_conn_t* conn) {
+    wait_conn_idle_locked(conn);
+    if (conn->dead) {
+        return;
+    }
+    conn->dead = 1;
+    node_io.conns[conn->node][conn->slot] = NULL;
+    fprintf(stderr, "[MYFS IO] ✗ Node %d: Connection failed\n", conn->node);
+    log_msg("[MYFS IO] Node %d: connection failed during request\n", conn->node);
+    
+    node_op_t* op = conn->send_head;
+    while (op) {
+        node_op_t* next = op->next;
+        op->next = NULL;
+        op->retry = 1;
+        finish_node_op_locked(op, NODE_OP_FAILED);
+        op = next;
+    }
+    conn->send_head = conn->send_tail = NULL;
+    for (int i = 0; i < NODE_MAX_CREDITS; i++) {
+        op = conn->slots[i].op;
+        if (conn->slots[i].busy && op && op->state == NODE_OP_SENT) {
+            op->retry = 1;
+            finish_node_op_locked(op, NODE_OP_FAILED);
+        }
+    }
+    if (conn->data_op) {
+        conn->data_op->retry = 0;
+        finish_node_op_locked(conn->data_op, NODE_OP_FAILED);
+        conn->data_op = NULL;
+    }
+    
+    conn->next_dead = conn->io->dead;
+    conn->io->dead = conn;
+    wake_node_io(conn->io);
+    pthread_cond_signal(&node_io.keeper_cond);
+}
+
+// Send queued requests while the socket and the credits allow.
+// Returns -1 on a connection error.
+static int node_conn_send_locked(node_conn_t* conn) {
+    while (conn->send_head && !conn->io_waiters) {
+        node_op_t* op = conn->send_head;
+        
+        if (op->state == NODE_OP_QUEUED) {
+            if (conn->outstanding >= conn->credits) {
+                return 0;  // Wait for a response to free a credit
+            }
+            int id = 0;
+            while (conn->slots[id].busy) {
+                id++;
+            }
+            conn->slots[id].busy = 1;
+            conn->slots[id].op = op;
+            conn->slots[id].type = op->req.type;
+            conn->outstanding++;
+            op->wire_len = myfs_encode_request(&op->req, id, op->wire_req);
+            op->state = NODE_OP_SENDING;
+            op->progress = 0;
+        }
+        
+        // Header and payload go out together
+        while (op->progress < op->wire_len + op->send_len) {
+            if (conn->io_waiters) {
+                return 0;  // Let them in, epoll brings us back
+            }
+            struct iovec iov[2];
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            if (op->progress < op->wire_len) {
+                iov[msg.msg_iovlen].iov_base = op->wire_req + op->progress;
+                iov[msg.msg_iovlen].iov_len = op->wire_len - op->progress;
+                msg.msg_iovlen++;
+            }
+            if (op->send_len > 0) {
+                size_t sent = (op->progress > op->wire_len) ? op->progress - op->wire_len : 0;
+                iov[msg.msg_iovlen].iov_base = (char*)op->send_data + sent;
+                iov[msg.msg_iovlen].iov_len = op->send_len - sent;
+                msg.msg_iovlen++;
+            }
+            
+            ssize_t n;
+            NODE_IO_CALL(conn, n, sendmsg(conn->sock, &msg, MSG_NOSIGNAL));
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;  // Wait for readiness
+                return -1;
+            }
+            op->progress += n;
+        }
+        
+        conn->send_head = op->next;
+        if (!conn->send_head) {
+            conn->send_tail = NULL;
+        }
+        op->next = NULL;
+        op->state = NODE_OP_SENT;
+    }
+    return 0;
+}
+
+// Receive responses while the socket has data and hand them to their
+// ops.  Returns -1 on a connection or protocol error.
+static int node_conn_recv_locked(node_conn_t* conn) {
+    char* discard = conn->io->discard;
+    
+    while (!conn->io_waiters) {
+        char* in;
+        size_t len;
+        if (conn->data_left > 0) {
+            if (conn->data_op) {
+                in = conn->data_op->recv_buf + conn->data_op->progress;
+                len = conn->data_left;
+            } else {
+                in = discard;
+                len = conn->data_left < NODE_DISCARD_SIZE ? conn->data_left : NODE_DISCARD_SIZE;
+            }
+        } else {
+            in = (char*)&conn->wire_resp + conn->resp_received;
+            len = sizeof(conn->wire_resp) - conn->resp_received;
+        }
+        
+        ssize_t n;
+        NODE_IO_CALL(conn, n, recv(conn->sock, in, len, 0));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;  // Wait for readiness
+            return -1;
+        }
+        if (n == 0) {
+            return -1;  // Connection closed
+        }
+        
+        if (conn->data_left > 0) {
+            conn->data_left -= n;
+            if (conn->data_op) {
+                conn->data_op->progress += n;
+                if (conn->data_left == 0) {
+                    finish_node_op_locked(conn->data_op, NODE_OP_DONE);
+                    conn->data_op = NULL;
+                }
+            }
+            continue;
+        }
+        conn->resp_received += n;
+        if (conn->resp_received < sizeof(conn->wire_resp)) {
+            continue;
+        }
+        conn->resp_received = 0;
+        
+        // Match the response to its request
+        uint32_t id = (uint32_t)MYFS_GET(conn->wire_resp.request_id);
+        if (id >= NODE_MAX_CREDITS || !conn->slots[id].busy ||
+            (conn->slots[id].op && conn->slots[id].op->state != NODE_OP_SENT)) {
+            fprintf(stderr, "[MYFS IO] Node %d: Unexpected response for request %u\n", conn->node, id);
+            return -1;
+        }
+        node_op_t* op = conn->slots[id].op;
+        int type = conn->slots[id].type;
+        conn->slots[id].busy = 0;
+        conn->slots[id].op = NULL;
+        conn->outstanding--;
+        
+        // Reads and batches carry data after the header; for writes
+        // resp.size just reports the bytes stored
+        response_header_t resp;
+        myfs_decode_response(&conn->wire_resp, &resp);
+        size_t data = 0;
+        if (resp.status == 0 && (type == REQ_READ || type == REQ_READV || type == REQ_WRITEV ||
+                                 type == REQ_DELETEV)) {
+            data = resp.size;
+        }
+        if (op) {
+            op->resp = resp;
+            if (data > op->recv_cap) {
+                fprintf(stderr, "[MYFS IO] Node %d: response of %zu bytes exceeds buffer (%zu)\n",
+                        op->node, data, op->recv_cap);
+                finish_node_op_locked(op, NODE_OP_FAILED);
+                return -1;
+            }
+            if (data > 0) {
+                op->state = NODE_OP_RECEIVING;
+                op->progress = 0;
+                conn->data_op = op;
+            } else {
+                finish_node_op_locked(op, NODE_OP_DONE);
+            }
+        }
+        conn->data_left = data;
+    }
+    return 0;  // Let the waiters in, epoll brings us back
+}
+
+// Watch for writability only while a request can be sent
+static void update_node_events_locked(node_conn_t* conn) {
+    uint32_t events = EPOLLIN;
+    node_op_t* op = conn->send_head;
+    if (op && (op->state == NODE_OP_SENDING || conn->outstanding < conn->credits)) {
+        events |= EPOLLOUT;
+    }
+    if (events != conn->events) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.ptr = conn;
+        if (epoll_ctl(conn->io->epfd, EPOLL_CTL_MOD, conn->sock, &ev) < 0) {
+            perror("epoll_ctl");
+            fail_node_conn_locked(conn);
+            return;
+        }
+        conn->events = events;
+    }
+}
+
+// An I/O thread, driving pool slot io->index of every node
+static void* node_io_main(void* arg) {
+    node_io_thread_t* io = (node_io_thread_t*)arg;
+    struct epoll_event events[MAX_NODES + 1];
+    
+    pthread_mutex_lock(&node_io.lock);
+    while (!node_io.stopping) {
+        // Close connections that failed since the last round; none of
+        // their events is pending any more
+        node_conn_t** link = &io->dead;
+        while (*link) {
+            node_conn_t* conn = *link;
+            if (conn->io_waiters) {
+                link = &conn->next_dead;  // Still being looked at
+                continue;
+            }
+            *link = conn->next_dead;
+            close(conn->sock);
+            free(conn);
+        }
+        for (int i = 0; i < MAX_NODES; i++) {
+            if (node_io.conns[i][io->index]) {
+                update_node_events_locked(node_io.conns[i][io->index]);
+            }
+        }
+        pthread_mutex_unlock(&node_io.lock);
+        
+        int n = epoll_wait(io->epfd, events, MAX_NODES + 1, -1);
+        
+        pthread_mutex_lock(&node_io.lock);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int e = 0; e < n; e++) {
+            node_conn_t* conn = (node_conn_t*)events[e].data.ptr;
+            if (!conn) {
+                char buf[64];
+                while (read(io->wake[0], buf, sizeof(buf)) > 0) {
+                }
+                continue;
+            }
+            if (conn->dead) {
+                continue;
+            }
+            int ret = 0;
+            if (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                ret = node_conn_recv_locked(conn);
+            }
+            if (ret == 0 && (events[e].events & EPOLLOUT)) {
+                ret = node_conn_send_locked(conn);
+            }
+            if (ret < 0) {
+                fail_node_conn_locked(conn);
+            }
+        }
+    }
+    pthread_mutex_unlock(&node_io.lock);
+    return NULL;
+}
+
+// Connect to a node and hand the connection to the I/O thread of its
+// pool slot.  Called with the node's socket_mutex held.  Returns the
+// socket, or -1.
+static int open_node_connection(int node_id, int slot) {
+    struct bb_state* state = BB_DATA;
+    node_info_t* node = &state->nodes[node_id];
+    uint16_t credits = 0;
+    
+    int sock = connect_to_node(node->host, node->port, &node->capabilities, &credits);
+    if (sock < 0) {
+        return -1;
+    }
+    
+    node_conn_t* conn = (node_conn_t*)calloc(1, sizeof(node_conn_t));
+    if (!conn) {
+        close(sock);
+        return -1;
+    }
+    conn->node = node_id;
+    conn->slot = slot;
+    conn->io = &node_io.threads[slot];
+    conn->sock = sock;
+    // A node that cannot multiplex answers in order: one request at a time
+    conn->credits = (node->capabilities & MYFS_CAP_MULTIPLEX) ? credits : 1;
+    if (conn->credits > NODE_MAX_CREDITS) {
+        conn->credits = NODE_MAX_CREDITS;
+    } else if (conn->credits < 1) {
+        conn->credits = 1;
+    }
+    conn->events = EPOLLIN;
+    
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = conn->events;
+    ev.data.ptr = conn;
+    
+    pthread_mutex_lock(&node_io.lock);
+    int ret = epoll_ctl(conn->io->epfd, EPOLL_CTL_ADD, sock, &ev);
+    if (ret == 0) {
+        node_io.conns[node_id][slot] = conn;
+    }
+    pthread_mutex_unlock(&node_io.lock);
+    
+    if (ret < 0) {
+        perror("epoll_ctl");
+        close(sock);
+        free(conn);
+        return -1;
+    }
+    return sock;
+}
+
+// Fill the empty slots of a node's pool.  Returns how many connections
+// were opened, or -1 if the node could not be reached.
+static int refill_node_pool(int node_id) {
+    struct bb_state* state = BB_DATA;
+    int opened = 0;
+    
+    pthread_mutex_lock(&state->nodes[node_id].socket_mutex);
+    for (int slot = 0; slot < node_io.pool_size; slot++) {
+        pthread_mutex_lock(&node_io.lock);
+        int empty = (node_io.conns[node_id][slot] == NULL && !node_io.stopping);
+        pthread_mutex_unlock(&node_io.lock);
+        if (!empty) {
+            continue;
+        }
+        if (open_node_connection(node_id, slot) < 0) {
+            opened = -1;
+            break;
+        }
+        opened++;
+    }
+    pthread_mutex_unlock(&state->nodes[node_id].socket_mutex);
+    return opened;
+}
+
+// The keeper: replaces broken connections so a pool stays full without
+// callers waiting on a reconnect
+static void* node_keeper_main(void* arg) {
+    struct bb_state* state = (struct bb_state*)arg;
+    int down[MAX_NODES] = { 0 };  // Unreachable at the last attempt
+    
+    // Not a FUSE thread: give it the filesystem state so BB_DATA works
+    fuse_get_context()->private_data = arg;
+    
+    pthread_mutex_lock(&node_io.lock);
+    while (!node_io.stopping) {
+        pthread_mutex_unlock(&node_io.lock);
+        for (int i = 0; i < state->num_nodes; i++) {
+            int opened = refill_node_pool(i);
+            if (opened > 0) {
+                __atomic_fetch_add(&node_io_stats.reconnects, opened, __ATOMIC_RELAXED);
+                fprintf(stderr, "[MYFS IO] ✓ Node %d: %d connection(s) restored\n", i, opened);
+                log_msg("[MYFS IO] Node %d: %d connection(s) restored\n", i, opened);
+            }
+            if (opened < 0 && !down[i]) {
+                fprintf(stderr, "[MYFS IO] ✗ Node %d unreachable, retrying in the background\n", i);
+                log_msg("[MYFS IO] Node %d unreachable\n", i);
+            }
+            down[i] = (opened < 0);
+        }
+        pthread_mutex_lock(&node_io.lock);
+        if (node_io.stopping) {
+            break;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += NODE_KEEPER_INTERVAL_SECS;
+        pthread_cond_timedwait(&node_io.keeper_cond, &node_io.lock, &deadline);
+    }
+    pthread_mutex_unlock(&node_io.lock);
+    return NULL;
+}
+
+static int start_node_io(int pool_size) {
+    node_io.pool_size = pool_size;
+    node_io.stopping = 0;
+    for (int k = 0; k < pool_size; k++) {
+        node_io_thread_t* io = &node_io.threads[k];
+        io->index = k;
+        io->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (io->epfd < 0) {
+            perror("epoll_create1");
+            return -1;
+        }
+        if (pipe(io->wake) < 0) {
+            perror("pipe");
+            return -1;
+        }
+        set_nonblocking(io->wake[0]);
+        set_nonblocking(io->wake[1]);
+        
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(io->epfd, EPOLL_CTL_ADD, io->wake[0], &ev) < 0) {
+            perror("epoll_ctl");
+            return -1;
+        }
+        if (pthread_create(&io->thread, NULL, node_io_main, io) != 0) {
+            fprintf(stderr, "[MYFS] Failed to start node I/O thread %d\n", k);
+            return -1;
+        }
+        node_io.running = k + 1;
+    }
+    return 0;
+}
+
+static void stop_node_io(void) {
+    if (!node_io.running) {
+        return;
+    }
+    pthread_mutex_lock(&node_io.lock);
+    node_io.stopping = 1;
+    pthread_cond_signal(&node_io.keeper_cond);
+    pthread_mutex_unlock(&node_io.lock);
+    if (node_io.keeper_started) {
+        pthread_join(node_io.keeper, NULL);
+        node_io.keeper_started = 0;
+    }
+    for (int k = 0; k < node_io.running; k++) {
+        wake_node_io(&node_io.threads[k]);
+        pthread_join(node_io.threads[k].thread, NULL);
+    }
+    
+    pthread_mutex_lock(&node_io.lock);
+    for (int i = 0; i < MAX_NODES; i++) {
+        for (int k = 0; k < node_io.pool_size; k++) {
+            if (node_io.conns[i][k]) {
+                fail_node_conn_locked(node_io.conns[i][k]);
+            }
+        }
+    }
+    pthread_mutex_unlock(&node_io.lock);
+    for (int k = 0; k < node_io.running; k++) {
+        node_io_thread_t* io = &node_io.threads[k];
+        while (io->dead) {
+            node_conn_t* conn = io->dead;
+            io->dead = conn->next_dead;
+            close(conn->sock);
+            free(conn);
+        }
+        close(io->epfd);
+        close(io->wake[0]);
+        close(io->wake[1]);
+    }
+    node_io.running = 0;
+}
+
+// The least loaded live connection to a node, or NULL if it has none
+static node_conn_t* pick_node_conn_locked(int node_id) {
+    node_conn_t* best = NULL;
+    for (int slot = 0; slot < node_io.pool_size; slot++) {
+        node_conn_t* conn = node_io.conns[node_id][slot];
+        if (conn && (!best || conn->load < best->load)) {
+            best = conn;
+        }
+    }
+    return best;
+}
+
+// Connect a node that has no connection left, unless another thread
+// already did.  The rest of its pool is left to the keeper.
+static int reconnect_to_node(int node_id) {
+    struct bb_state* state = BB_DATA;
+    
+    if (node_id < 0 || node_id >= state->num_nodes) {
+        return -1;
+    }
+    
+    pthread_mutex_lock(&state->nodes[node_id].socket_mutex);
+    pthread_mutex_lock(&node_io.lock);
+    node_conn_t* conn = pick_node_conn_locked(node_id);
+    int slot = 0;
+    while (slot < node_io.pool_size - 1 && node_io.conns[node_id][slot]) {
+        slot++;
+    }
+    pthread_mutex_unlock(&node_io.lock);
+    if (conn) {
+        pthread_mutex_unlock(&state->nodes[node_id].socket_mutex);
+        return 0;
+    }
+    
+    fprintf(stderr, "[MYFS] Attempting to reconnect to node %d (%s:%d)...\n",
+            node_id, state->nodes[node_id].host, state->nodes[node_id].port);
+    log_msg("[MYFS] Reconnecting to node %d\n", node_id);
+    
+    int sock = open_node_connection(node_id, slot);
+    pthread_mutex_unlock(&state->nodes[node_id].socket_mutex);
+    if (sock < 0) {
+        fprintf(stderr, "[MYFS] ✗ Reconnection to node %d failed\n", node_id);
+        log_msg("[MYFS] Reconnection to node %d failed\n", node_id);
+        return -1;
+    }
+    
+    fprintf(stderr, "[MYFS] ✓ Reconnected to node %d, new socket fd=%d\n", node_id, sock);
+    log_msg("[MYFS] Reconnected to node %d, socket fd=%d\n", node_id, sock);
+    return 0;
+}
+
+// Initialize connections to all nodes.  A node that cannot be reached
+// does not fail the mount: the keeper keeps trying to bring it up, and
+// until then its fragments are rebuilt from parity.  Returns -1 only if
+// the connection engine itself cannot start.
+static int init_node_connections() {
+    struct bb_state* state = BB_DATA;
+    
+    fprintf(stderr, "[MYFS] Initializing connections to %d storage nodes...\n", state->num_nodes);
+    log_msg("[MYFS] Initializing connections to %d storage nodes...\n", state->num_nodes);
+    
+    for (int i = 0; i < state->num_nodes; i++) {
+        // Serializes connecting to this node
+        pthread_mutex_init(&state->nodes[i].socket_mutex, NULL);
+    }
+    int pool_size = state->conns_per_node;
+    if (pool_size < 1) {
+        pool_size = NODE_CONNS_DEFAULT;
+    } else if (pool_size > MAX_CONNS_PER_NODE) {
+        pool_size = MAX_CONNS_PER_NODE;
+    }
+    if (start_node_io(pool_size) < 0) {
+        return -1;
+    }
+    
+    int connected = 0;
+    for (int i = 0; i < state->num_nodes; i++) {
+        fprintf(stderr, "[MYFS] Connecting to node %d: %s:%d (%d connections)\n",
+                i, state->nodes[i].host, state->nodes[i].port, pool_size);
+        log_msg("[MYFS] Connecting to node %d: %s:%d\n", i, state->nodes[i].host, state->nodes[i].port);
+        
+        int opened = refill_node_pool(i);
+        if (opened <= 0) {
+            fprintf(stderr, "[MYFS ERROR] Failed to connect to node %d (%s:%d)\n", 
+                    i, state->nodes[i].host, state->nodes[i].port);
+            log_msg("[MYFS ERROR] Failed to connect to node %d (%s:%d)\n", 
+                    i, state->nodes[i].host, state->nodes[i].port);
+            continue;
+        }
+        
+        fprintf(stderr, "[MYFS] ✓ Connected to node %d\n", i);
+        log_msg("[MYFS] Connected to node %d\n", i);
+        connected++;
+    }
+    
+    // Started whatever the outcome above: it also fills the pools of
+    // nodes that were down
+    if (pthread_create(&node_io.keeper, NULL, node_keeper_main, state) != 0) {
+        fprintf(stderr, "[MYFS] Failed to start the connection keeper\n");
+        return -1;
+    }
+    node_io.keeper_started = 1;
+    
+    if (connected < state->num_nodes) {
+        fprintf(stderr, "[MYFS] %d of %d nodes connected, retrying the rest in the background\n",
+                connected, state->num_nodes);
+        log_msg("[MYFS] %d of %d nodes connected\n", connected, state->num_nodes);
+    } else {
+        fprintf(stderr, "[MYFS] ✓ All nodes connected successfully!\n");
+        log_msg("[MYFS] All nodes connected successfully!\n");
+    }
+    return 0;
+}
+
+// Queue an op on its node's connection, connecting first if the node
+// has none.  Called without node_io.lock; the op ends up QUEUED, or
+// FAILED if no connection could be made.
+static void submit_node_op(node_op_t* op) {
+    pthread_mutex_lock(&node_io.lock);
+    int connected = (pick_node_conn_locked(op->node) != NULL);
+    pthread_mutex_unlock(&node_io.lock);
+    
+    if (!connected) {
+        op->reconnected = 1;
+        reconnect_to_node(op->node);
+    }
+    
+    pthread_mutex_lock(&node_io.lock);
+    node_conn_t* conn = pick_node_conn_locked(op->node);
+    if (!conn) {
+        op->retry = 0;
+        op->state = NODE_OP_FAILED;
+        pthread_mutex_unlock(&node_io.lock);
+        return;
+    }
+    op->conn = conn;
+    conn->load++;
+    op->state = NODE_OP_QUEUED;
+    op->progress = 0;
+    op->retry = 0;
+    op->next = NULL;
+    if (conn->send_tail) {
+        conn->send_tail->next = op;
+    } else {
+        conn->send_head = op;
+    }
+    conn->send_tail = op;
+    pthread_mutex_unlock(&node_io.lock);
+    wake_node_io(conn->io);
+}
+
+// Withdraw an op that is no longer needed; its response, if one still
+// comes, is read and dropped.  An op caught halfway onto the wire
+// cannot be withdrawn, so its connection is given up instead.
+static void cancel_node_op_locked(node_op_t* op) {
+    node_conn_t* conn = op->conn;
+    
+    wait_conn_idle_locked(conn);
+    if (op->conn != conn) {
+        return;  // Finished meanwhile
+    }
+    switch (op->state) {
+    case NODE_OP_QUEUED: {
+        node_op_t** link = &conn->send_head;
+        node_op_t* prev = NULL;
+        while (*link != op) {
+            prev = *link;
+            link = &(*link)->next;
+        }
+        *link = op->next;
+        if (conn->send_tail == op) {
+            conn->send_tail = prev;
+        }
+        break;
+    }
+    case NODE_OP_SENDING:
+        fail_node_conn_locked(conn);
+        break;
+    case NODE_OP_SENT:
+        for (int i = 0; i < NODE_MAX_CREDITS; i++) {
+            if (conn->slots[i].op == op) {
+                conn->slots[i].op = NULL;
+            }
+        }
+        break;
+    case NODE_OP_RECEIVING:
+        conn->data_op = NULL;
+        break;
+    }
+    if (op->conn) {
+        conn->load--;
+    }
+    op->state = NODE_OP_CANCELLED;
+    op->conn = NULL;
+    op->next = NULL;
+}
+
+static long elapsed_ms(const struct timespec* since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+// Run a batch of ops (at most one per node) concurrently and return
+// as soon as `quorum` of them, or all ops not marked `hedge`, have
+// succeeded (received a response with status 0).  Hedge ops are held
+// back and only issued once hedge_delay_ms has passed without
+// finishing, or as soon as another op fails.  Requests are idempotent
+// (reads, or writes of the same bytes at the same offset), so an op
+// that failed before its response started is retried once on a fresh
+// connection.  Ops still in flight when the quorum is reached are
+// stragglers: they are withdrawn and their responses dropped.
+// Returns the number of successful ops.
+static int run_node_ops(node_op_t* ops, int count, int quorum) {
+    struct bb_state* state = BB_DATA;
+    pthread_cond_t done;
+    pthread_cond_init(&done, NULL);
+    
+    int required = 0;      // Ops not marked hedge
+    for (int i = 0; i < count; i++) {
+        ops[i].done = &done;
+        if (ops[i].hedge) {
+            ops[i].state = NODE_OP_HELD;
+        } else {
+            required++;
+            submit_node_op(&ops[i]);
+        }
+    }
+    
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    
+    int succeeded = 0;
+    int satisfied = 0;     // Nothing still in flight is needed
+    pthread_mutex_lock(&node_io.lock);
+    for (;;) {
+        int pending = 0;       // Ops in flight
+        int held = 0;          // Hedge ops not issued yet
+        int failures = 0;
+        int required_ok = 0;   // Non-hedge ops that succeeded
+        int retry = -1;
+        succeeded = 0;
+        for (int i = 0; i < count; i++) {
+            switch (ops[i].state) {
+            case NODE_OP_DONE:
+                if (ops[i].resp.status == 0) {
+                    succeeded++;
+                    required_ok += !ops[i].hedge;
+                } else {
+                    failures++;
+                }
+                break;
+            case NODE_OP_FAILED:
+                if (ops[i].retry && !ops[i].reconnected) {
+                    retry = i;
+                } else {
+                    failures++;
+                }
+                break;
+            case NODE_OP_HELD:
+                held++;
+                break;
+            case NODE_OP_CANCELLED:
+                break;
+            default:
+                pending++;
+            }
+        }
+        
+        if ((required > 0 && required_ok == required) || succeeded >= quorum) {
+            satisfied = 1;
+            break;
+        }
+        if (retry >= 0) {
+            fprintf(stderr, "[MYFS IO] ⚠ Node %d: Connection lost, attempting reconnect...\n",
+                    ops[retry].node);
+            ops[retry].reconnected = 1;
+            pthread_mutex_unlock(&node_io.lock);
+            submit_node_op(&ops[retry]);
+            pthread_mutex_lock(&node_io.lock);
+            continue;
+        }
+        if (pending == 0 && held == 0) {
+            break;
+        }
+        
+        // Issue held hedge ops once they are due
+        long waited = elapsed_ms(&started);
+        if (held > 0 && (failures > 0 || pending == 0 || waited >= state->hedge_delay_ms)) {
+            int issue[MAX_NODES];
+            int nissue = 0;
+            for (int i = 0; i < count; i++) {
+                if (ops[i].state == NODE_OP_HELD) {
+                    issue[nissue++] = i;
+                }
+            }
+            pthread_mutex_unlock(&node_io.lock);
+            for (int i = 0; i < nissue; i++) {
+                fprintf(stderr, "[MYFS IO] Hedging: issuing request to node %d\n", ops[issue[i]].node);
+                __atomic_fetch_add(&node_io_stats.hedges, 1, __ATOMIC_RELAXED);
+                submit_node_op(&ops[issue[i]]);
+            }
+            pthread_mutex_lock(&node_io.lock);
+            continue;
+        }
+        
+        long wait = NODE_IO_TIMEOUT_MS - waited;
+        if (wait <= 0) {
+            fprintf(stderr, "[MYFS IO] Timed out waiting for %d node(s)\n", pending);
+            log_msg("[MYFS IO] Timed out after %d ms with %d node(s) pending\n",
+                    NODE_IO_TIMEOUT_MS, pending);
+            break;
+        }
+        if (held > 0 && state->hedge_delay_ms - waited < wait) {
+            wait = state->hedge_delay_ms - waited;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += wait / 1000;
+        deadline.tv_nsec += (wait % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&done, &node_io.lock, &deadline);
+    }
+    
+    // Cancel whatever is left: hedges never issued, stragglers beyond
+    // the quorum, and ops that timed out (their node is given up on)
+    for (int i = 0; i < count; i++) {
+        switch (ops[i].state) {
+        case NODE_OP_HELD:
+            ops[i].state = NODE_OP_CANCELLED;
+            break;
+        case NODE_OP_QUEUED:
+        case NODE_OP_SENDING:
+        case NODE_OP_SENT:
+        case NODE_OP_RECEIVING:
+            if (satisfied) {
+                fprintf(stderr, "[MYFS IO] Discarding straggler on node %d\n", ops[i].node);
+                __atomic_fetch_add(&node_io_stats.stragglers, 1, __ATOMIC_RELAXED);
+                cancel_node_op_locked(&ops[i]);
+            } else {
+                fail_node_conn_locked(ops[i].conn);
+            }
+            break;
+        }
+        ops[i].done = NULL;
+    }
+    pthread_mutex_unlock(&node_io.lock);
+    pthread_cond_destroy(&done);
+    
+    return succeeded;
+}
+
+// Forward declarations
+static int myfs_flush_write_buffer(const char* path);
+static int myfs_read(const char* path, char* buf, size_t size, off_t offset);
+
+// Dirty bytes of a file written outside its buffer window
+typedef struct dirty_extent {
+    size_t start;                // File offset of data[0]
+    size_t len;                  // Bytes in data
+    size_t cap;                  // Bytes allocated for data
+    char* data;
+    struct dirty_extent* next;   // Next extent by offset
+} dirty_extent_t;
+
+// Buffer for accumulating writes before sending to storage nodes.
+// Sequential writes fill one window of whole stripes, writes elsewhere
+// in the file are kept as dirty extents.  One buffer exists per file;
+// buffers live in write_buffer_table and each carries its own lock so
+// writers on different files never contend with each other.
+typedef struct write_buffer {
+    char* buffer;
+    size_t size;
+    size_t capacity;
+    off_t max_offset;
+    size_t total_written;  // File offset of buffer[0], always stripe aligned
+    size_t unloaded;             // Bytes at buffer[0] not read back from the file yet
+    size_t dirty_start;          // File offset of the first byte written in the window
+    int delta_failed;            // A parity-delta update of the window failed
+    dirty_extent_t* extents;     // Sorted, disjoint, none inside the window
+    size_t extent_bytes;         // Bytes in extents (counted as dirty)
+    size_t stored_size;          // File bytes on the nodes
+    myfs_layout_t layout;        // Stripe layout of the file
+    char path[PATH_MAX];         // File this buffer belongs to
+    unsigned int bucket;         // Its write_buffer_table index; path and
+                                 // bucket change (on rename) under every
+                                 // bucket lock and wb->lock
+    time_t dirty_since;          // When the buffer became dirty (0 = clean);
+                                 // written under lock, scanned atomically
+    char* sealed;                // Complete stripes handed to the flusher
+    size_t sealed_start;         // File offset of sealed[0]
+    size_t sealed_size;          // Bytes in sealed (counted as dirty)
+    int sealed_busy;             // Flusher is sending the sealed stripes
+    pthread_cond_t sealed_done;  // Signalled when sealed_busy drops
+    char* spare;                 // Recycled buffer memory for the next seal
+    int refcount;                // Table reference + callers holding it (atomic)
+    int unlinked;                // Removed from the table, free on last put
+    pthread_mutex_t lock;        // Serializes writes and flushes of this file
+    struct write_buffer* next;   // Hash chain
+} write_buffer_t;
+
+// Hash table of per-file write buffers
+typedef struct {
+    write_buffer_t* head;
+    pthread_mutex_t lock;
+} write_buffer_bucket_t;
+
+// Read cache to avoid repeatedly reading same file from network.
+// Each entry caches one contiguous byte range of one file: small
+// files are cached whole, large files keep their readahead window
+// here.  Entries are keyed by the inode of the local metadata file
+// and validated against its size and mtime.
+typedef struct read_cache_entry {
+    dev_t dev;                   // File identity
+    ino_t ino;
+    off_t file_size;             // File size when the entry was filled
+    time_t mtime;                // Metadata mtime when the entry was filled
+    off_t start;                 // First file offset held in buffer
+    size_t size;                 // Valid bytes in buffer
+    char* buffer;                // Cached file content
+    int refcount;                // Shard reference + readers copying out
+    struct read_cache_entry* hash_next;
+    struct read_cache_entry* lru_prev;   // Towards most recently used
+    struct read_cache_entry* lru_next;   // Towards least recently used
+} read_cache_entry_t;
+
+// One shard of the read cache: its own lock, hash chains and LRU list
+typedef struct {
+    pthread_mutex_t lock;
+    read_cache_entry_t* buckets[READ_CACHE_BUCKETS];
+    unsigned long generation[READ_CACHE_BUCKETS];  // Bumped by invalidation, per bucket of files
+    read_cache_entry_t* lru_head;
+    read_cache_entry_t* lru_tail;
+} read_cache_shard_t;
+
+// Read cache counters, updated atomically
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long insertions;
+    unsigned long evictions;
+    unsigned long invalidations;
+    unsigned long batched;       // Files filled by a batched read
+    size_t bytes;                // Bytes currently cached
+} read_cache_stats_t;
+
+static write_buffer_bucket_t write_buffer_table[WRITE_BUFFER_BUCKETS];
+static pthread_once_t write_buffer_table_once = PTHREAD_ONCE_INIT;
+
+// Total bytes currently buffered (dirty) across all files
+static size_t dirty_bytes = 0;
+static pthread_mutex_t dirty_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Background flusher, woken through flusher_cond.  Writers throttled at
+// MAX_DIRTY_BYTES wait on dirty_cond.  Both use dirty_lock.
+static pthread_cond_t flusher_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t dirty_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t flusher_thread;
+static int flusher_running = 0;
+static int flusher_stop = 0;
+static int flusher_kicked = 0;
+
+// Writeback counters, updated atomically
+typedef struct {
+    unsigned long passes;        // Flusher passes
+    unsigned long sealed;        // Batches handed to the flusher
+    unsigned long expired;       // Partial stripes flushed after DIRTY_EXPIRE_SECS
+    unsigned long throttled;     // Writers that waited at MAX_DIRTY_BYTES
+    unsigned long deltas;        // Windows and extent runs written as parity deltas
+    unsigned long extents;       // Writes kept as dirty extents
+} writeback_stats_t;
+
+static writeback_stats_t writeback_stats;
+
+// Reclaimer counters, updated atomically
+typedef struct {
+    unsigned long queued;        // Objects released by unlink or rename
+    unsigned long reclaimed;     // Objects deleted from every node
+    unsigned long batches;       // REQ_DELETEV requests that succeeded
+    size_t pending;              // Objects in the queue
+} gc_stats_t;
+
+static gc_stats_t gc_stats;
+
+static void init_write_buffer_table(void) {
+    for (int i = 0; i < WRITE_BUFFER_BUCKETS; i++) {
+        write_buffer_table[i].head = NULL;
+        pthread_mutex_init(&write_buffer_table[i].lock, NULL);
+    }
+}
+
+// FNV-1a hash of a path, used to pick a bucket
+static unsigned int hash_path(const char* path) {
+    unsigned int h = 2166136261u;
+    for (const unsigned char* p = (const unsigned char*)path; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Adjust the global dirty byte counter when a buffer grows or is flushed
+static void account_dirty_bytes(ssize_t delta) {
+    pthread_mutex_lock(&dirty_lock);
+    size_t before = dirty_bytes;
+    if (delta < 0 && (size_t)(-delta) > dirty_bytes) {
+        dirty_bytes = 0;
+    } else {
+        dirty_bytes += delta;
+    }
+    if (delta < 0) {
+        pthread_cond_broadcast(&dirty_cond);
+    } else if (before <= DIRTY_BACKGROUND_BYTES && dirty_bytes > DIRTY_BACKGROUND_BYTES) {
+        flusher_kicked = 1;
+        pthread_cond_signal(&flusher_cond);
+    }
+    pthread_mutex_unlock(&dirty_lock);
+}
+
+// Wake the flusher for an immediate pass
+static void kick_flusher(void) {
+    pthread_mutex_lock(&dirty_lock);
+    flusher_kicked = 1;
+    pthread_cond_signal(&flusher_cond);
+    pthread_mutex_unlock(&dirty_lock);
+}
+
+static size_t get_dirty_bytes(void) {
+    pthread_mutex_lock(&dirty_lock);
+    size_t bytes = dirty_bytes;
+    pthread_mutex_unlock(&dirty_lock);
+    return bytes;
+}
+
+// Look up the write buffer of a file, optionally creating it.  The
+// returned buffer carries a reference that must be dropped with
+// put_write_buffer(); the caller locks wb->lock before touching it.
+static write_buffer_t* get_write_buffer(const char* path, int create) {
+    pthread_once(&write_buffer_table_once, init_write_buffer_table);
+    
+    unsigned int index = hash_path(path) % WRITE_BUFFER_BUCKETS;
+    write_buffer_bucket_t* bucket = &write_buffer_table[index];
+    pthread_mutex_lock(&bucket->lock);
+    
+    write_buffer_t* wb = bucket->head;
+    while (wb && strcmp(wb->path, path) != 0) {
+        wb = wb->next;
+    }
+    
+    if (!wb && create) {
+        wb = (write_buffer_t*)calloc(1, sizeof(write_buffer_t));
+        if (wb) {
+            strncpy(wb->path, path, PATH_MAX - 1);
+            wb->bucket = index;
+            wb->capacity = WRITE_BUFFER_CAPACITY;
+            wb->refcount = 1;  // Reference held by the table
+            pthread_mutex_init(&wb->lock, NULL);
+            pthread_cond_init(&wb->sealed_done, NULL);
+            wb->next = bucket->head;
+            bucket->head = wb;
+        }
+    }
+    
+    if (wb) {
+        __atomic_add_fetch(&wb->refcount, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&bucket->lock);
+    
+    return wb;
+}
+
+// Data memory is allocated lazily and released when the file is
+// closed.  Called with wb->lock held.
+static int ensure_write_buffer_memory(write_buffer_t* wb) {
+    if (!wb->buffer) {
+        wb->buffer = (char*)malloc(wb->capacity);
+        if (!wb->buffer) {
+            return -ENOMEM;
+        }
+        wb->size = 0;
+        wb->max_offset = 0;
+    }
+    return 0;
+}
+
+// Drop a reference obtained from get_write_buffer().  References are
+// only taken under a bucket lock while the table still holds its own,
+// so the count can be dropped without one.
+static void put_write_buffer(write_buffer_t* wb) {
+    if (__atomic_sub_fetch(&wb->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (wb->size + wb->sealed_size + wb->extent_bytes > 0) {
+            account_dirty_bytes(-(ssize_t)(wb->size + wb->sealed_size + wb->extent_bytes));
+        }
+        while (wb->extents) {
+            dirty_extent_t* e = wb->extents;
+            wb->extents = e->next;
+            free(e->data);
+            free(e);
+        }
+        pthread_cond_destroy(&wb->sealed_done);
+        pthread_mutex_destroy(&wb->lock);
+        free(wb->buffer);
+        free(wb->sealed);
+        free(wb->spare);
+        free(wb);
+    }
+}
+
+// Remove this buffer from the table if it is still there, dropping the
+// table's reference.  The caller may hold wb->lock; a writer that then
+// gets it sees wb->unlinked and looks the path up again.
+static void unhash_write_buffer(write_buffer_t* wb) {
+    // A rename may move the buffer to another bucket until we hold one
+    write_buffer_bucket_t* bucket;
+    while (1) {
+        unsigned int index = __atomic_load_n(&wb->bucket, __ATOMIC_RELAXED);
+        bucket = &write_buffer_table[index];
+        pthread_mutex_lock(&bucket->lock);
+        if (wb->bucket == index) {
+            break;
+        }
+        pthread_mutex_unlock(&bucket->lock);
+    }
+    
+    write_buffer_t** link = &bucket->head;
+    while (*link && *link != wb) {
+        link = &(*link)->next;
+    }
+    int found = (*link != NULL);
+    if (found) {
+        *link = wb->next;
+        wb->unlinked = 1;
+    }
+    pthread_mutex_unlock(&bucket->lock);
+    
+    if (found) {
+        fprintf(stderr, "[MYFS WRITE BUFFER] Dropping buffer for %s (%zu dirty bytes)\n",
+                wb->path, wb->size + wb->extent_bytes);
+        put_write_buffer(wb);  // Drop the table's reference
+    }
+}
+
+// Remove a file's write buffer from the table, discarding unflushed
+// data (called when the file itself goes away).  Returns once nothing
+// of the file is being written back any more, so that its object can
+// be reclaimed: a buffer out of the table is never flushed again.
+static void forget_write_buffer(const char* path) {
+    write_buffer_t* wb = get_write_buffer(path, 0);
+    if (wb) {
+        unhash_write_buffer(wb);
+        pthread_mutex_lock(&wb->lock);
+        while (wb->sealed_busy) {
+            pthread_cond_wait(&wb->sealed_done, &wb->lock);
+        }
+        pthread_mutex_unlock(&wb->lock);
+        put_write_buffer(wb);
+    }
+}
+
+// Serializes renames, the only code that holds several buffer locks
+static pthread_mutex_t rename_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Does `path` name `dir` (dir_len bytes) or something below it?
+static int path_is_under(const char* path, const char* dir, size_t dir_len) {
+    return strncmp(path, dir, dir_len) == 0 && (path[dir_len] == '\0' || path[dir_len] == '/');
+}
+
+// Take a reference to the buffer of `path` and to those of every file
+// below it (a directory being renamed).  Returns how many were found,
+// in a malloc'ed array stored at *out, or -ENOMEM.
+static int collect_write_buffers(const char* path, write_buffer_t*** out) {
+    pthread_once(&write_buffer_table_once, init_write_buffer_table);
+    
+    size_t len = strlen(path);
+    write_buffer_t** found = NULL;
+    int n = 0;
+    int capacity = 0;
+    
+    for (int i = 0; i < WRITE_BUFFER_BUCKETS; i++) {
+        write_buffer_bucket_t* bucket = &write_buffer_table[i];
+        pthread_mutex_lock(&bucket->lock);
+        for (write_buffer_t* wb = bucket->head; wb; wb = wb->next) {
+            if (!path_is_under(wb->path, path, len)) {
+                continue;
+            }
+            if (n == capacity) {
+                int grown = capacity ? capacity * 2 : 8;
+                write_buffer_t** bigger = (write_buffer_t**)realloc(found, grown * sizeof(*found));
+                if (!bigger) {
+                    pthread_mutex_unlock(&bucket->lock);
+                    while (n > 0) {
+                        put_write_buffer(found[--n]);
+                    }
+                    free(found);
+                    return -ENOMEM;
+                }
+                found = bigger;
+                capacity = grown;
+            }
+            __atomic_add_fetch(&wb->refcount, 1, __ATOMIC_RELAXED);
+            found[n++] = wb;
+        }
+        pthread_mutex_unlock(&bucket->lock);
+    }
+    *out = found;
+    return n;
+}
+
+static void lock_write_buffer_table(void) {
+    for (int i = 0; i < WRITE_BUFFER_BUCKETS; i++) {
+        pthread_mutex_lock(&write_buffer_table[i].lock);
+    }
+}
+
+static void unlock_write_buffer_table(void) {
+    for (int i = WRITE_BUFFER_BUCKETS - 1; i >= 0; i--) {
+        pthread_mutex_unlock(&write_buffer_table[i].lock);
+    }
+}
+
+// Take a buffer out of its hash chain.  Called with every bucket lock
+// held.
+static void unchain_write_buffer_locked(write_buffer_t* wb) {
+    write_buffer_t** link = &write_buffer_table[wb->bucket].head;
+    while (*link != wb) {
+        link = &(*link)->next;
+    }
+    *link = wb->next;
+}
+
+// Move the buffers found by collect_write_buffers(path) under newpath,
+// the rename of path having just succeeded.  Called with every bucket
+// lock and each buffer's lock held, so that no lookup sees the table
+// half renamed.  A buffer whose new path would not fit is dropped: it
+// was flushed before the rename.
+static void rekey_write_buffers_locked(write_buffer_t** bufs, int n, const char* path,
+                                       const char* newpath) {
+    size_t len = strlen(path);
+    
+    for (int i = 0; i < n; i++) {
+        write_buffer_t* wb = bufs[i];
+        if (wb->unlinked) {
+            continue;
+        }
+        unchain_write_buffer_locked(wb);
+        
+        char renamed[PATH_MAX];
+        if (snprintf(renamed, PATH_MAX, "%s%s", newpath, wb->path + len) >= PATH_MAX) {
+            wb->unlinked = 1;
+            __atomic_sub_fetch(&wb->refcount, 1, __ATOMIC_ACQ_REL);  // Ours remains
+            continue;
+        }
+        strcpy(wb->path, renamed);
+        unsigned int index = hash_path(renamed) % WRITE_BUFFER_BUCKETS;
+        __atomic_store_n(&wb->bucket, index, __ATOMIC_RELAXED);
+        wb->next = write_buffer_table[index].head;
+        write_buffer_table[index].head = wb;
+    }
+}
+
+// Find the buffer that has been dirty the longest.  Returns it with a
+// reference held, or NULL if nothing is dirty.
+static write_buffer_t* find_oldest_dirty_buffer(void) {
+    char oldest_path[PATH_MAX] = "";
+    time_t oldest_since = 0;
+    
+    for (int i = 0; i < WRITE_BUFFER_BUCKETS; i++) {
+        write_buffer_bucket_t* bucket = &write_buffer_table[i];
+        pthread_mutex_lock(&bucket->lock);
+        for (write_buffer_t* wb = bucket->head; wb; wb = wb->next) {
+            time_t since = __atomic_load_n(&wb->dirty_since, __ATOMIC_RELAXED);
+            if (since != 0 && (oldest_since == 0 || since < oldest_since)) {
+                oldest_since = since;
+                strcpy(oldest_path, wb->path);
+            }
+        }
+        pthread_mutex_unlock(&bucket->lock);
+    }
+    
+    return oldest_since ? get_write_buffer(oldest_path, 0) : NULL;
+}
+
+// Forward declarations, defined with the write and flush paths below
+static int buffer_write_locked(write_buffer_t* wb, const char* buf, size_t size, off_t offset);
+static int flush_write_buffer_locked(write_buffer_t* wb, int keep_partial_stripe);
+static int flush_extents_locked(write_buffer_t* wb);
+static int seal_write_buffer_locked(write_buffer_t* wb);
+static int drain_sealed_locked(write_buffer_t* wb);
+
+// Wait up to ~1s for the flusher to bring dirty memory back under the
+// limit.  Returns nonzero if it did.
+static int wait_for_writeback(size_t incoming) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += FLUSHER_INTERVAL_SECS;
+    
+    __atomic_fetch_add(&writeback_stats.throttled, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&dirty_lock);
+    flusher_kicked = 1;
+    pthread_cond_signal(&flusher_cond);
+    while (dirty_bytes + incoming > MAX_DIRTY_BYTES) {
+        if (pthread_cond_timedwait(&dirty_cond, &dirty_lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    int ok = dirty_bytes + incoming <= MAX_DIRTY_BYTES;
+    pthread_mutex_unlock(&dirty_lock);
+    return ok;
+}
+
+// Keep total dirty memory under MAX_DIRTY_BYTES.  With the flusher
+// running the writer waits for it; if it makes no progress (or is not
+// running) the oldest dirty buffers are flushed here, never discarded.
+// Must be called without any write buffer lock held.
+static void reserve_dirty_bytes(size_t incoming) {
+    pthread_once(&write_buffer_table_once, init_write_buffer_table);
+    
+    if (get_dirty_bytes() + incoming <= MAX_DIRTY_BYTES) {
+        return;
+    }
+    if (flusher_running && wait_for_writeback(incoming)) {
+        return;
+    }
+    
+    while (get_dirty_bytes() + incoming > MAX_DIRTY_BYTES) {
+        write_buffer_t* victim = find_oldest_dirty_buffer();
+        if (!victim) {
+            break;
+        }
+        
+        fprintf(stderr, "[MYFS WRITE BUFFER] Dirty limit reached (%zu bytes), flushing oldest buffer %s\n",
+                get_dirty_bytes(), victim->path);
+        log_msg("[MYFS WRITE BUFFER] Evicting %s by flushing it\n", victim->path);
+        
+        pthread_mutex_lock(&victim->lock);
+        int ret = flush_write_buffer_locked(victim, 0);
+        pthread_mutex_unlock(&victim->lock);
+        put_write_buffer(victim);
+        
+        if (ret < 0) {
+            // Leave the data in memory rather than lose it
+            fprintf(stderr, "[MYFS WRITE BUFFER] Flush of oldest buffer failed: %d\n", ret);
+            break;
+        }
+    }
+}
+
+// Release the data memory of a clean buffer (called on close)
+static void release_write_buffer_memory(const char* path) {
+    write_buffer_t* wb = get_write_buffer(path, 0);
+    if (!wb) {
+        return;
+    }
+    
+    pthread_mutex_lock(&wb->lock);
+    if (wb->buffer && wb->size == 0) {
+        free(wb->buffer);
+        wb->buffer = NULL;
+    }
+    free(wb->spare);
+    wb->spare = NULL;
+    pthread_mutex_unlock(&wb->lock);
+    put_write_buffer(wb);
+}
+
+static read_cache_shard_t read_cache_shards[READ_CACHE_SHARDS];
+static pthread_once_t read_cache_once = PTHREAD_ONCE_INIT;
+static read_cache_stats_t read_cache_stats;
+
+static void init_read_cache(void) {
+    for (int i = 0; i < READ_CACHE_SHARDS; i++) {
+        memset(&read_cache_shards[i], 0, sizeof(read_cache_shard_t));
+        pthread_mutex_init(&read_cache_shards[i].lock, NULL);
+    }
+}
+
+static unsigned int hash_inode(dev_t dev, ino_t ino) {
+    uint64_t h = ((uint64_t)dev * 0x9E3779B97F4A7C15ULL) ^ ((uint64_t)ino * 0xC2B2AE3D27D4EB4FULL);
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+static read_cache_shard_t* read_cache_shard(dev_t dev, ino_t ino) {
+    return &read_cache_shards[hash_inode(dev, ino) % READ_CACHE_SHARDS];
+}
+
+// Total read cache budget in bytes (set at mount time)
+static size_t read_cache_budget(void) {
+    return BB_DATA->read_cache_bytes;
+}
+
+// Files up to this size are fetched and cached whole
+static size_t read_cache_whole_file_limit(void) {
+    return read_cache_budget() / READ_CACHE_WHOLE_FILE_DIVISOR;
+}
+
+// Readahead window used for files too large to cache whole
+static size_t read_cache_window_size(void) {
+    size_t window = read_cache_budget() / READ_CACHE_WINDOW_DIVISOR;
+    return window < READAHEAD_WINDOW_SIZE ? window : READAHEAD_WINDOW_SIZE;
+}
+
+static void free_read_cache_entry(read_cache_entry_t* e) {
+    free(e->buffer);
+    free(e);
+}
+
+// Unlink an entry from its shard.  Called with the shard lock held;
+// the entry is freed once the last reader drops its reference.
+static void read_cache_unlink_locked(read_cache_shard_t* shard, read_cache_entry_t* e) {
+    read_cache_entry_t** link = &shard->buckets[hash_inode(e->dev, e->ino) % READ_CACHE_BUCKETS];
+    while (*link && *link != e) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = e->hash_next;
+    }
+    
+    if (e->lru_prev) {
+        e->lru_prev->lru_next = e->lru_next;
+    } else {
+        shard->lru_head = e->lru_next;
+    }
+    if (e->lru_next) {
+        e->lru_next->lru_prev = e->lru_prev;
+    } else {
+        shard->lru_tail = e->lru_prev;
+    }
+    e->hash_next = e->lru_prev = e->lru_next = NULL;
+    
+    __atomic_fetch_sub(&read_cache_stats.bytes, e->size, __ATOMIC_RELAXED);
+    if (--e->refcount == 0) {
+        free_read_cache_entry(e);
+    }
+}
+
+static read_cache_entry_t* read_cache_find_locked(read_cache_shard_t* shard, dev_t dev, ino_t ino) {
+    read_cache_entry_t* e = shard->buckets[hash_inode(dev, ino) % READ_CACHE_BUCKETS];
+    while (e && !(e->dev == dev && e->ino == ino)) {
+        e = e->hash_next;
+    }
+    return e;
+}
+
+// Move an entry to the most recently used end of its shard's LRU list
+static void read_cache_touch_locked(read_cache_shard_t* shard, read_cache_entry_t* e) {
+    if (shard->lru_head == e) {
+        return;
+    }
+    
+    // Unlink from current position
+    e->lru_prev->lru_next = e->lru_next;
+    if (e->lru_next) {
+        e->lru_next->lru_prev = e->lru_prev;
+    } else {
+        shard->lru_tail = e->lru_prev;
+    }
+    
+    // Push at head
+    e->lru_prev = NULL;
+    e->lru_next = shard->lru_head;
+    shard->lru_head->lru_prev = e;
+    shard->lru_head = e;
+}
+
+// Look up cached data covering [offset, offset + size) of the file
+// described by st.  On a hit the entry is returned with a reference
+// held; release it with read_cache_put().
+static read_cache_entry_t* read_cache_lookup(const struct stat* st, off_t offset, size_t size) {
+    pthread_once(&read_cache_once, init_read_cache);
+    
+    read_cache_shard_t* shard = read_cache_shard(st->st_dev, st->st_ino);
+    pthread_mutex_lock(&shard->lock);
+    
+    read_cache_entry_t* e = read_cache_find_locked(shard, st->st_dev, st->st_ino);
+    if (e && (e->file_size != st->st_size || e->mtime != st->st_mtime)) {
+        // File changed since the entry was filled
+        read_cache_unlink_locked(shard, e);
+        __atomic_fetch_add(&read_cache_stats.invalidations, 1, __ATOMIC_RELAXED);
+        e = NULL;
+    }
+    
+    if (e && offset >= e->start && offset + size <= e->start + e->size) {
+        read_cache_touch_locked(shard, e);
+        e->refcount++;
+        pthread_mutex_unlock(&shard->lock);
+        __atomic_fetch_add(&read_cache_stats.hits, 1, __ATOMIC_RELAXED);
+        return e;
+    }
+    
+    pthread_mutex_unlock(&shard->lock);
+    __atomic_fetch_add(&read_cache_stats.misses, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+// Whether the whole file described by st is cached (counts nothing)
+static int read_cache_holds_file(const struct stat* st) {
+    pthread_once(&read_cache_once, init_read_cache);
+    
+    read_cache_shard_t* shard = read_cache_shard(st->st_dev, st->st_ino);
+    pthread_mutex_lock(&shard->lock);
+    read_cache_entry_t* e = read_cache_find_locked(shard, st->st_dev, st->st_ino);
+    int held = (e && e->file_size == st->st_size && e->mtime == st->st_mtime &&
+                e->start == 0 && e->size == (size_t)st->st_size);
+    pthread_mutex_unlock(&shard->lock);
+    return held;
+}
+
+// Drop a reference obtained from read_cache_lookup()
+static void read_cache_put(read_cache_entry_t* e) {
+    read_cache_shard_t* shard = read_cache_shard(e->dev, e->ino);
+    pthread_mutex_lock(&shard->lock);
+    int last = (--e->refcount == 0);
+    pthread_mutex_unlock(&shard->lock);
+    
+    if (last) {
+        free_read_cache_entry(e);
+    }
+}
+
+// Evict least recently used entries until the cache fits its budget.
+// Starts with the given shard and moves on to the others.
+static void read_cache_evict(read_cache_shard_t* first) {
+    size_t budget = read_cache_budget();
+    int start = first - read_cache_shards;
+    
+    for (int n = 0; n < READ_CACHE_SHARDS; n++) {
+        read_cache_shard_t* shard = &read_cache_shards[(start + n) % READ_CACHE_SHARDS];
+        
+        pthread_mutex_lock(&shard->lock);
+        while (shard->lru_tail &&
+               __atomic_load_n(&read_cache_stats.bytes, __ATOMIC_RELAXED) > budget) {
+            read_cache_entry_t* victim = shard->lru_tail;
+            fprintf(stderr, "[MYFS READ CACHE] Evicting inode %lu [%ld, %ld)\n",
+                    (unsigned long)victim->ino, (long)victim->start,
+                    (long)(victim->start + victim->size));
+            read_cache_unlink_locked(shard, victim);
+            __atomic_fetch_add(&read_cache_stats.evictions, 1, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&shard->lock);
+        
+        if (__atomic_load_n(&read_cache_stats.bytes, __ATOMIC_RELAXED) <= budget) {
+            break;
+        }
+    }
+}
+
+// Generation of a file's cached data, taken before its fragments are
+// fetched and passed to read_cache_insert().  Files sharing a hash
+// bucket share the counter, which only costs a skipped insert.
+static unsigned long read_cache_generation(const struct stat* st) {
+    pthread_once(&read_cache_once, init_read_cache);
+    
+    read_cache_shard_t* shard = read_cache_shard(st->st_dev, st->st_ino);
+    pthread_mutex_lock(&shard->lock);
+    unsigned long generation = shard->generation[hash_inode(st->st_dev, st->st_ino) % READ_CACHE_BUCKETS];
+    pthread_mutex_unlock(&shard->lock);
+    return generation;
+}
+
+// Insert file data [start, start + size) into the cache, replacing any
+// entry already held for the file.  The cache takes ownership of
+// buffer (it is freed here if it cannot be cached).  Overwrites in
+// place change neither size nor mtime, so data fetched across an
+// invalidation (the generation moved on) may be stale and is dropped.
+static void read_cache_insert(const struct stat* st, unsigned long generation, off_t start,
+                              char* buffer, size_t size) {
+    pthread_once(&read_cache_once, init_read_cache);
+    
+    if (size > read_cache_budget()) {
+        free(buffer);
+        return;
+    }
+    
+    read_cache_entry_t* e = (read_cache_entry_t*)calloc(1, sizeof(read_cache_entry_t));
+    if (!e) {
+        free(buffer);
+        return;
+    }
+    e->dev = st->st_dev;
+    e->ino = st->st_ino;
+    e->file_size = st->st_size;
+    e->mtime = st->st_mtime;
+    e->start = start;
+    e->size = size;
+    e->buffer = buffer;
+    e->refcount = 1;  // Reference held by the shard
+    
+    read_cache_shard_t* shard = read_cache_shard(e->dev, e->ino);
+    unsigned int bucket = hash_inode(e->dev, e->ino) % READ_CACHE_BUCKETS;
+    pthread_mutex_lock(&shard->lock);
+    
+    if (shard->generation[bucket] != generation) {
+        pthread_mutex_unlock(&shard->lock);
+        fprintf(stderr, "[MYFS READ CACHE] File changed during the fetch, not caching it\n");
+        free(e->buffer);
+        free(e);
+        return;
+    }
+    read_cache_entry_t* old = read_cache_find_locked(shard, e->dev, e->ino);
+    if (old) {
+        read_cache_unlink_locked(shard, old);
+    }
+    
+    e->hash_next = shard->buckets[bucket];
+    shard->buckets[bucket] = e;
+    e->lru_next = shard->lru_head;
+    if (shard->lru_head) {
+        shard->lru_head->lru_prev = e;
+    } else {
+        shard->lru_tail = e;
+    }
+    shard->lru_head = e;
+    
+    __atomic_fetch_add(&read_cache_stats.bytes, size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&read_cache_stats.insertions, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&shard->lock);
+    
+    if (__atomic_load_n(&read_cache_stats.bytes, __ATOMIC_RELAXED) > read_cache_budget()) {
+        read_cache_evict(shard);
+    }
+}
+
+// Invalidate cached data of a file (called after write/truncate)
+static void invalidate_read_cache(const char* path) {
+    char fpath[PATH_MAX];
+    struct stat st;
+    
+    pthread_once(&read_cache_once, init_read_cache);
+    
+    snprintf(fpath, PATH_MAX, "%s%s", BB_DATA->rootdir, path);
+    if (lstat(fpath, &st) < 0) {
+        return;
+    }
+    
+    read_cache_shard_t* shard = read_cache_shard(st.st_dev, st.st_ino);
+    pthread_mutex_lock(&shard->lock);
+    shard->generation[hash_inode(st.st_dev, st.st_ino) % READ_CACHE_BUCKETS]++;
+    read_cache_entry_t* e = read_cache_find_locked(shard, st.st_dev, st.st_ino);
+    if (e) {
+        fprintf(stderr, "[MYFS READ CACHE] Invalidating cache for %s\n", path);
+        read_cache_unlink_locked(shard, e);
+        __atomic_fetch_add(&read_cache_stats.invalidations, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+// Format the read cache counters
+static int format_read_cache_stats(char* out, size_t len) {
+    return snprintf(out, len,
+                    "read_cache.budget=%zu\n"
+                    "read_cache.bytes=%zu\n"
+                    "read_cache.hits=%lu\n"
+                    "read_cache.misses=%lu\n"
+                    "read_cache.insertions=%lu\n"
+                    "read_cache.evictions=%lu\n"
+                    "read_cache.invalidations=%lu\n"
+                    "read_cache.batched=%lu\n",
+                    read_cache_budget(),
+                    __atomic_load_n(&read_cache_stats.bytes, __ATOMIC_RELAXED),
+                    __atomic_load_n(&read_cache_stats.hits, __ATOMIC_RELAXED),
+                    __atomic_load_n(&read_cache_stats.misses, __ATOMIC_RELAXED),
+                    __atomic_load_n(&read_cache_stats.insertions, __ATOMIC_RELAXED),
+                    __atomic_load_n(&read_cache_stats.evictions, __ATOMIC_RELAXED),
+                    __atomic_load_n(&read_cache_stats.invalidations, __ATOMIC_RELAXED),
+                    __atomic_load_n(&read_cache_stats.batched, __ATOMIC_RELAXED));
+}
+
+// Format all client counters (exposed through MYFS_STATS_XATTR)
+static int format_myfs_stats(char* out, size_t len) {
+    int n = format_read_cache_stats(out, len);
+    if (n < 0 || (size_t)n >= len) {
+        return n;
+    }
+    return n + snprintf(out + n, len - n,
+                        "io.hedges=%lu\n"
+                        "io.stragglers=%lu\n"
+                        "io.reconnects=%lu\n"
+                        "writeback.dirty_bytes=%zu\n"
+                        "writeback.passes=%lu\n"
+                        "writeback.sealed=%lu\n"
+                        "writeback.expired=%lu\n"
+                        "writeback.throttled=%lu\n"
+                        "writeback.deltas=%lu\n"
+                        "writeback.extents=%lu\n"
+                        "gc.queued=%lu\n"
+                        "gc.reclaimed=%lu\n"
+                        "gc.batches=%lu\n"
+                        "gc.pending=%zu\n",
+                        __atomic_load_n(&node_io_stats.hedges, __ATOMIC_RELAXED),
+                        __atomic_load_n(&node_io_stats.stragglers, __ATOMIC_RELAXED),
+                        __atomic_load_n(&node_io_stats.reconnects, __ATOMIC_RELAXED),
+                        get_dirty_bytes(),
+                        __atomic_load_n(&writeback_stats.passes, __ATOMIC_RELAXED),
+                        __atomic_load_n(&writeback_stats.sealed, __ATOMIC_RELAXED),
+                        __atomic_load_n(&writeback_stats.expired, __ATOMIC_RELAXED),
+                        __atomic_load_n(&writeback_stats.throttled, __ATOMIC_RELAXED),
+                        __atomic_load_n(&writeback_stats.deltas, __ATOMIC_RELAXED),
+                        __atomic_load_n(&writeback_stats.extents, __ATOMIC_RELAXED),
+                        __atomic_load_n(&gc_stats.queued, __ATOMIC_RELAXED),
+                        __atomic_load_n(&gc_stats.reclaimed, __ATOMIC_RELAXED),
+                        __atomic_load_n(&gc_stats.batches, __ATOMIC_RELAXED),
+                        __atomic_load_n(&gc_stats.pending, __ATOMIC_RELAXED));
+}
+
+// Distributed write function
+static int myfs_write(const char* path, const char* buf, size_t size, off_t offset) {
+    struct bb_state* state = BB_DATA;
+    int num_nodes = state->num_nodes;
+    
+    // Invalidate cached data (whole file or readahead window) since file is being modified
+    invalidate_read_cache(path);
+    
+    fprintf(stderr, "[MYFS WRITE] path=%s, size=%zu, offset=%ld\n", 
+            path, size, offset);
+    log_msg("\n[MYFS WRITE] path=%s, size=%zu, offset=%ld, num_nodes=%d\n", 
+            path, size, offset, num_nodes);
+    
+    // Get or create write buffer for this file
+    write_buffer_t* wb = get_write_buffer(path, 1);
+    if (!wb) {
+        fprintf(stderr, "[MYFS WRITE ERROR] Failed to allocate write buffer\n");
+        return -ENOMEM;
+    }
+    
+    // Writes larger than the buffer stream through it a piece at a
+    // time, the flusher sending each batch of stripes while the next
+    // one is copied in
+    size_t done = 0;
+    int retstat = 0;
+    while (done < size) {
+        size_t piece = size - done;
+        if (piece > WRITE_STREAM_PIECE) {
+            piece = WRITE_STREAM_PIECE;
+        }
+        
+        // Make room under the global dirty limit before buffering more data
+        reserve_dirty_bytes(piece);
+        
+        pthread_mutex_lock(&wb->lock);
+        if (wb->unlinked) {
+            // Renamed or truncated away while we waited: start over
+            // with whatever buffer the path has now
+            pthread_mutex_unlock(&wb->lock);
+            put_write_buffer(wb);
+            wb = get_write_buffer(path, 1);
+            if (!wb) {
+                fprintf(stderr, "[MYFS WRITE ERROR] Failed to allocate write buffer\n");
+                return done > 0 ? (int)done : -ENOMEM;
+            }
+            continue;
+        }
+        retstat = ensure_write_buffer_memory(wb);
+        if (retstat < 0) {
+            fprintf(stderr, "[MYFS WRITE ERROR] Failed to allocate write buffer\n");
+        } else {
+            retstat = buffer_write_locked(wb, buf + done, piece, offset + done);
+        }
+        pthread_mutex_unlock(&wb->lock);
+        
+        if (retstat < 0) {
+            break;
+        }
+        done += piece;
+    }
+    put_write_buffer(wb);
+    
+    // A partial write reports the bytes taken before the error
+    return done > 0 ? (int)done : retstat;
+}
+
+// Start a new buffered window at the stripe holding `offset`.  File
+// bytes between the stripe start and `offset` are only read back (see
+// load_write_window_locked) if the flush rewrites the whole stripe; a
+// small overwrite goes out as a parity delta without them.  Called
+// with wb->lock held and an empty buffer.
+static int begin_write_window(write_buffer_t* wb, off_t offset) {
+    struct bb_state* state = BB_DATA;
+    
+    // The read-back must see the stripes still held by the flusher
+    int drained = drain_sealed_locked(wb);
+    if (drained < 0) {
+        return drained;
+    }
+    
+    char fpath[PATH_MAX];
+    snprintf(fpath, PATH_MAX, "%s%s", state->rootdir, wb->path);
+    
+    struct stat st;
+    if (stat(fpath, &st) < 0) {
+        return -errno;
+    }
+    
+    // Empty files get the configured layout, others keep the one they have
+    if (st.st_size == 0) {
+        create_file_layout(fpath, state->num_nodes, &wb->layout);
+    } else {
+        int ret = load_file_layout(fpath, state->num_nodes, &wb->layout);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    
+    // With no dirty data left the metadata size is what the nodes hold;
+    // writes grow the metadata file before their data is stored
+    if (!wb->extents) {
+        wb->stored_size = st.st_size;
+    }
+    
+    size_t width = layout_stripe_width(&wb->layout);
+    size_t preload_end = (wb->stored_size < (size_t)offset) ? wb->stored_size : (size_t)offset;
+    wb->total_written = offset / width * width;
+    wb->size = (preload_end > wb->total_written) ? preload_end - wb->total_written : 0;
+    wb->unloaded = wb->size;
+    wb->dirty_start = wb->total_written + wb->size;
+    wb->delta_failed = 0;
+    if (wb->size > 0) {
+        account_dirty_bytes(wb->size);
+    }
+    return 0;
+}
+
+// Read back the file bytes of the window that precede its first write.
+// Called with wb->lock held before whole stripes are encoded from the
+// buffer.
+static int load_write_window_locked(write_buffer_t* wb) {
+    size_t got = 0;
+    
+    while (got < wb->unloaded) {
+        int n = myfs_read(wb->path, wb->buffer + got, wb->unloaded - got, wb->total_written + got);
+        if (n < 0) {
+            return n;
+        }
+        if (n == 0) {
+            break;  // File shrank meanwhile, the rest reads as zeros
+        }
+        got += n;
+    }
+    memset(wb->buffer + got, 0, wb->unloaded - got);
+    
+    if (wb->unloaded > 0) {
+        fprintf(stderr, "[MYFS WRITE] Read back %zu bytes of the stripe at %zu\n",
+                got, wb->total_written);
+    }
+    wb->unloaded = 0;
+    return 0;
+}
+
+// Keep a write outside the window as a dirty extent, merged with the
+// extents it overlaps or touches; the new bytes win.  Called with
+// wb->lock held.
+static int add_dirty_extent_locked(write_buffer_t* wb, const char* buf, size_t size, size_t offset) {
+    size_t end = offset + size;
+    dirty_extent_t** link = &wb->extents;
+    while (*link && (*link)->start + (*link)->len < offset) {
+        link = &(*link)->next;
+    }
+    
+    // Extents from first up to stop are absorbed
+    dirty_extent_t* first = *link;
+    dirty_extent_t* stop = first;
+    size_t merged_start = offset;
+    size_t merged_end = end;
+    size_t old_bytes = 0;
+    int count = 0;
+    while (stop && stop->start <= end) {
+        if (stop->start < merged_start) {
+            merged_start = stop->start;
+        }
+        if (stop->start + stop->len > merged_end) {
+            merged_end = stop->start + stop->len;
+        }
+        old_bytes += stop->len;
+        count++;
+        stop = stop->next;
+    }
+    size_t merged_len = merged_end - merged_start;
+    
+    dirty_extent_t* e;
+    if (count == 1 && first->start == merged_start) {
+        // Grows or overwrites one extent in place
+        e = first;
+        if (merged_len > e->cap) {
+            size_t cap = (e->cap * 2 > merged_len) ? e->cap * 2 : merged_len;
+            char* data = (char*)realloc(e->data, cap);
+            if (!data) {
+                return -ENOMEM;
+            }
+            e->data = data;
+            e->cap = cap;
+        }
+    } else {
+        e = (dirty_extent_t*)calloc(1, sizeof(dirty_extent_t));
+        char* data = (char*)malloc(merged_len);
+        if (!e || !data) {
+            free(e);
+            free(data);
+            return -ENOMEM;
+        }
+        e->start = merged_start;
+        e->cap = merged_len;
+        e->data = data;
+        for (dirty_extent_t* d = first; d != stop; ) {
+            dirty_extent_t* next = d->next;
+            memcpy(data + (d->start - merged_start), d->data, d->len);
+            free(d->data);
+            free(d);
+            d = next;
+        }
+        e->next = stop;
+        *link = e;
+    }
+    e->len = merged_len;
+    memcpy(e->data + (offset - merged_start), buf, size);
+    
+    wb->extent_bytes += merged_len - old_bytes;
+    account_dirty_bytes((ssize_t)(merged_len - old_bytes));
+    return 0;
+}
+
+// Drop the extent bytes in [start, end), overwritten in the window.
+// Called with wb->lock held.
+static int trim_dirty_extents_locked(write_buffer_t* wb, size_t start, size_t end) {
+    dirty_extent_t** link = &wb->extents;
+    size_t dropped = 0;
+    int ret = 0;
+    
+    while (*link && (*link)->start < end) {
+        dirty_extent_t* e = *link;
+        size_t e_end = e->start + e->len;
+        
+        if (e_end <= start) {
+            link = &e->next;
+        } else if (e->start >= start && e_end <= end) {
+            // Covered entirely
+            dropped += e->len;
+            *link = e->next;
+            free(e->data);
+            free(e);
+        } else if (e->start < start && e_end > end) {
+            // Split around the overwritten bytes
+            dirty_extent_t* tail = (dirty_extent_t*)calloc(1, sizeof(dirty_extent_t));
+            char* data = (char*)malloc(e_end - end);
+            if (!tail || !data) {
+                free(tail);
+                free(data);
+                ret = -ENOMEM;
+                break;
+            }
+            memcpy(data, e->data + (end - e->start), e_end - end);
+            tail->start = end;
+            tail->len = tail->cap = e_end - end;
+            tail->data = data;
+            tail->next = e->next;
+            e->next = tail;
+            e->len = start - e->start;
+            dropped += end - start;
+            break;
+        } else if (e->start < start) {
+            dropped += e_end - start;
+            e->len = start - e->start;
+            link = &e->next;
+        } else {
+            dropped += end - e->start;
+            memmove(e->data, e->data + (end - e->start), e_end - end);
+            e->len = e_end - end;
+            e->start = end;
+            break;
+        }
+    }
+    
+    wb->extent_bytes -= dropped;
+    account_dirty_bytes(-(ssize_t)dropped);
+    return ret;
+}
+
+// Whether a write belongs in the extent list rather than the window:
+// it lands outside a non-empty window, or would start a window whose
+// stripe already holds extents.  Called with wb->lock held.
+static int write_takes_extent_locked(write_buffer_t* wb, size_t offset, size_t size) {
+    if (wb->size > 0) {
+        return offset < wb->total_written || offset > wb->total_written + wb->size;
+    }
+    if ((wb->sealed && offset == wb->total_written) || !wb->extents) {
+        return 0;
+    }
+    size_t width = layout_stripe_width(&wb->layout);
+    size_t from = offset / width * width;
+    for (dirty_extent_t* e = wb->extents; e && e->start < offset + size; e = e->next) {
+        if (e->start + e->len > from) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Copy one write into the file's buffer.  A write that neither
+// continues nor overlaps the buffered window is kept as a dirty extent;
+// a window about to outgrow the buffer sends its complete stripes.
+// Called with wb->lock held.
+static int buffer_write_locked(write_buffer_t* wb, const char* buf, size_t size, off_t offset) {
+    // A write running into the window from below is split where the
+    // window starts: no extent may overlap the window
+    if (wb->size > 0 && (size_t)offset < wb->total_written &&
+        (size_t)offset + size > wb->total_written) {
+        size_t head = wb->total_written - offset;
+        int ret = buffer_write_locked(wb, buf + head, size - head, wb->total_written);
+        if (ret >= 0) {
+            ret = buffer_write_locked(wb, buf, head, offset);
+        }
+        return (ret < 0) ? ret : (int)size;
+    }
+    
+    if (write_takes_extent_locked(wb, offset, size)) {
+        if (wb->extent_bytes + size > wb->capacity) {
+            fprintf(stderr, "[MYFS WRITE] Flushing %zu bytes of dirty extents...\n", wb->extent_bytes);
+            int flush_ret = flush_extents_locked(wb);
+            if (flush_ret < 0) {
+                fprintf(stderr, "[MYFS WRITE ERROR] Failed to flush dirty extents: %d\n", flush_ret);
+                return flush_ret;
+            }
+        }
+        int ret = add_dirty_extent_locked(wb, buf, size, offset);
+        if (ret < 0) {
+            return ret;
+        }
+        __atomic_fetch_add(&writeback_stats.extents, 1, __ATOMIC_RELAXED);
+        if (wb->dirty_since == 0) {
+            __atomic_store_n(&wb->dirty_since, time(NULL), __ATOMIC_RELAXED);
+        }
+        fprintf(stderr, "[MYFS WRITE] Kept %zu bytes at offset %ld as a dirty extent (%zu extent bytes)\n",
+                size, offset, wb->extent_bytes);
+        return size;
+    }
+    
+    // A write continuing right after stripes handed to the flusher keeps
+    // the window; anything else starts a new one
+    if (wb->size == 0 && !(wb->sealed && (size_t)offset == wb->total_written)) {
+        int ret = begin_write_window(wb, offset);
+        if (ret < 0) {
+            fprintf(stderr, "[MYFS WRITE ERROR] Cannot start write window at %ld: %d\n", offset, ret);
+            log_msg("[MYFS WRITE ERROR] Cannot start write window of %s at %ld: %d\n",
+                    wb->path, offset, ret);
+            return ret;
+        }
+    }
+    
+    // Bytes not read back yet must be before the write lands among them
+    if (wb->unloaded > 0 && (size_t)offset < wb->total_written + wb->unloaded) {
+        int ret = load_write_window_locked(wb);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    
+    if (offset + size > wb->total_written + wb->capacity) {
+        fprintf(stderr, "[MYFS WRITE] Buffer would overflow, sealing complete stripes of %zu bytes...\n",
+                wb->size);
+        int flush_ret = seal_write_buffer_locked(wb);
+        if (flush_ret < 0) {
+            return flush_ret;
+        }
+    }
+    
+    // Check if single write is larger than the room left in the buffer
+    if (offset + size > wb->total_written + wb->capacity) {
+        fprintf(stderr, "[MYFS WRITE ERROR] Single write (%zu bytes) exceeds buffer capacity (%zu)\n",
+                size, wb->capacity);
+        return -EFBIG;
+    }
+    
+    // The window's bytes are newer than any extent they cover
+    if (wb->extents) {
+        int ret = trim_dirty_extents_locked(wb, offset, offset + size);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    
+    size_t size_before = wb->size;
+    size_t buffer_offset = offset - wb->total_written;
+    
+    // Write beyond current buffer size - fill gap with zeros
+    if (buffer_offset > wb->size) {
+        memset(wb->buffer + wb->size, 0, buffer_offset - wb->size);
+    }
+    memcpy(wb->buffer + buffer_offset, buf, size);
+    if (buffer_offset + size > wb->size) {
+        wb->size = buffer_offset + size;
+    }
+    wb->max_offset = wb->total_written + wb->size;
+    if ((size_t)offset < wb->dirty_start) {
+        wb->dirty_start = offset;
+    }
+    
+    // Track dirty memory for the global limit
+    if (wb->size != size_before) {
+        account_dirty_bytes((ssize_t)wb->size - (ssize_t)size_before);
+    }
+    if (wb->dirty_since == 0) {
+        __atomic_store_n(&wb->dirty_since, time(NULL), __ATOMIC_RELAXED);
+    }
+    
+    fprintf(stderr, "[MYFS WRITE] Buffered %zu bytes at offset %ld (total buffered: %zu)\n",
+            size, offset, wb->size);
+    
+    // Return success - actual distribution happens on flush/close
+    return size;
+}
+
+// Function to actually send buffered data to storage nodes
+static int myfs_flush_write_buffer(const char* path) {
+    write_buffer_t* wb = get_write_buffer(path, 0);
+    if (!wb) {
+        return 0;  // Nothing to flush
+    }
+    
+    pthread_mutex_lock(&wb->lock);
+    int retstat = flush_write_buffer_locked(wb, 0);
+    pthread_mutex_unlock(&wb->lock);
+    put_write_buffer(wb);
+    
+    return retstat;
+}
+
+// One segment of a streamed stripe write: the encoded fragments of a
+// run of whole stripes, sent to every node
+typedef struct {
+    struct bb_state* state;
+    const char* name;            // Fragment name on the nodes
+    char* fragments[MAX_NODES];
+    size_t frag_base;            // Fragment offset of the segment
+    size_t fragment_size;        // Bytes per fragment in the segment
+    int retstat;                 // 0 or a negative errno once sent
+} stripe_segment_t;
+
+// Send the fragments of one segment to all nodes; every one must be stored
+static void* send_stripe_segment(void* arg) {
+    stripe_segment_t* seg = (stripe_segment_t*)arg;
+    struct bb_state* state = seg->state;
+    int num_nodes = state->num_nodes;
+    
+    // Also runs on its own thread, outside any FUSE request
+    fuse_get_context()->private_data = state;
+    
+    node_op_t ops[MAX_NODES];
+    for (int i = 0; i < num_nodes; i++) {
+        init_node_op(&ops[i], i, REQ_WRITE, seg->name, i, seg->fragment_size, seg->frag_base);
+        ops[i].send_data = seg->fragments[i];
+        ops[i].send_len = seg->fragment_size;
+        
+        fprintf(stderr, "[MYFS FLUSH] Node %d: Sending header (file=%s, frag=%u, size=%zu, offset=%ld)...\n",
+                i, ops[i].req.filename, ops[i].req.fragment_id, ops[i].req.size, ops[i].req.offset);
+    }
+    
+    run_node_ops(ops, num_nodes, num_nodes);
+    
+    seg->retstat = 0;
+    for (int i = 0; i < num_nodes; i++) {
+        if (ops[i].state != NODE_OP_DONE) {
+            fprintf(stderr, "[MYFS FLUSH ERROR] Failed to write fragment to node %d\n", i);
+            log_msg("Failed to write fragment to node %d\n", i);
+            seg->retstat = -EIO;
+            break;
+        }
+        
+        if (ops[i].resp.status != 0) {
+            fprintf(stderr, "[MYFS FLUSH ERROR] Node %d returned error: status=%d, errno=%d\n", 
+                    i, ops[i].resp.status, ops[i].resp.error_code);
+            log_msg("[MYFS FLUSH ERROR] Node %d returned error: %d\n", i, ops[i].resp.error_code);
+            seg->retstat = ops[i].resp.error_code ? -ops[i].resp.error_code : -EIO;
+            break;
+        }
+        
+        fprintf(stderr, "[MYFS FLUSH] ✓ Node %d: Fragment %d written successfully (%zu bytes at %zu)\n", 
+                i, i, seg->fragment_size, seg->frag_base);
+        log_msg("[MYFS FLUSH] Successfully wrote fragment %d to node %d\n", i, i);
+    }
+    return NULL;
+}
+
+// Encode file bytes [start, start + len) taken from `data`, followed
+// by tail_size bytes from `tail`, and store the fragments on every
+// node.  `start` is stripe aligned.  The range is streamed in segments
+// of whole stripes, at most MAX_CHUNK_SIZE per fragment, and segment
+// N+1 is encoded while segment N is on the wire, so memory stays
+// bounded whatever the length.  Returns 0 or a negative errno.
+static int write_stripes(const char* path, const myfs_layout_t* layout, const char* data,
+                         size_t start, size_t len, const char* tail, size_t tail_size) {
+    struct bb_state* state = BB_DATA;
+    int num_nodes = state->num_nodes;
+    size_t width = layout_stripe_width(layout);
+    size_t end = start + len;
+    size_t total_end = end + tail_size;
+    const erasure_codec_t* codec = layout_codec(layout);
+    
+    // Stripes per segment: fill MAX_CHUNK_SIZE of each fragment
+    size_t segment_stripes = MAX_CHUNK_SIZE / layout->stripe_unit;
+    if (segment_stripes == 0) {
+        segment_stripes = 1;
+    }
+    size_t segment_len = segment_stripes * width;
+    size_t segment_frag_cap = segment_stripes * layout->stripe_unit;
+    size_t total_frag = layout_frag_offset(layout, 0, total_end) - layout_frag_offset(layout, 0, start);
+    if (segment_frag_cap > total_frag) {
+        segment_frag_cap = total_frag;
+    }
+    
+    fprintf(stderr, "[MYFS FLUSH] Streaming %zu bytes at %zu (stripe unit %zu, %d+%d, %s) in segments of %zu\n",
+            total_end - start, start, layout->stripe_unit, layout->data_fragments,
+            layout->parity_fragments, codec->name, segment_len);
+    
+    // Two segments: one being encoded, one on the wire
+    stripe_segment_t segs[2];
+    memset(segs, 0, sizeof(segs));
+    for (int s = 0; s < 2; s++) {
+        segs[s].state = state;
+        segs[s].name = layout_object_name(layout, path);
+        for (int i = 0; i < num_nodes; i++) {
+            segs[s].fragments[i] = (char*)malloc(segment_frag_cap ? segment_frag_cap : 1);
+            if (!segs[s].fragments[i]) {
+                fprintf(stderr, "[MYFS WRITE ERROR] Failed to allocate fragment %d buffer (%zu bytes)\n", 
+                        i, segment_frag_cap);
+                log_msg("[MYFS WRITE ERROR] Failed to allocate fragment %d buffer\n", i);
+                for (int t = 0; t <= s; t++) {
+                    for (int j = 0; j < num_nodes; j++) {
+                        free(segs[t].fragments[j]);
+                    }
+                }
+                return -ENOMEM;
+            }
+        }
+    }
+    
+    int retstat = 0;
+    int cur = 0;
+    pthread_t sender;
+    int in_flight = 0;  // segs[!cur] is being sent by `sender`
+    size_t pos = start;
+    
+    while (pos < total_end && retstat == 0) {
+        size_t seg_end = (total_end - pos > segment_len) ? pos + segment_len : total_end;
+        stripe_segment_t* seg = &segs[cur];
+        seg->frag_base = layout_frag_offset(layout, 0, pos);
+        seg->fragment_size = layout_frag_offset(layout, 0, seg_end) - seg->frag_base;
+        
+        // Distribute this segment across the data fragments, one stripe
+        // unit at a time, then compute the parity fragments
+        for (int i = 0; i < num_nodes; i++) {
+            memset(seg->fragments[i], 0, seg->fragment_size);
+        }
+        if (pos < end) {
+            size_t n = (seg_end < end ? seg_end : end) - pos;
+            layout_scatter(layout, seg->fragments, seg->frag_base, data + (pos - start), pos, n);
+        }
+        if (tail && seg_end > end) {
+            size_t from = pos > end ? pos : end;
+            layout_scatter(layout, seg->fragments, seg->frag_base, tail + (from - end), from, seg_end - from);
+        }
+        codec->encode(layout, seg->fragments, seg->fragment_size);
+        
+        // The previous segment must be stored before this one is sent:
+        // a write at fragment offset 0 replaces the fragment file
+        if (in_flight) {
+            pthread_join(sender, NULL);
+            in_flight = 0;
+            retstat = segs[!cur].retstat;
+            if (retstat < 0) {
+                break;
+            }
+        }
+        
+        pos = seg_end;
+        if (pos < total_end && pthread_create(&sender, NULL, send_stripe_segment, seg) == 0) {
+            in_flight = 1;
+            cur = !cur;
+        } else {
+            // Last segment (or no thread available): send it from here
+            send_stripe_segment(seg);
+            retstat = seg->retstat;
+        }
+    }
+    
+    if (in_flight) {
+        pthread_join(sender, NULL);
+        if (retstat == 0) {
+            retstat = segs[!cur].retstat;
+        }
+    }
+    
+    for (int s = 0; s < 2; s++) {
+        for (int i = 0; i < num_nodes; i++) {
+            free(segs[s].fragments[i]);
+        }
+    }
+    
+    return retstat;
+}
+
+// Hard links share one object, and so its parity, under different
+// write buffers: parity-delta updates of an object are serialized here
+static pthread_mutex_t parity_delta_locks[PARITY_DELTA_LOCKS];
+static pthread_once_t parity_delta_locks_once = PTHREAD_ONCE_INIT;
+
+static void init_parity_delta_locks(void) {
+    for (int i = 0; i < PARITY_DELTA_LOCKS; i++) {
+        pthread_mutex_init(&parity_delta_locks[i], NULL);
+    }
+}
+
+// Overwrite file bytes [start, start + len), all inside the stored
+// file, leaving the rest of their stripes alone.  The old bytes of the
+// data fragments covered and the matching parity range are read, and
+// the new bytes go back with parity + coef * (old ^ new): 1 + m
+// fragment updates instead of rewriting every fragment of the
+// stripes.  Returns 0, 1 if the old bytes could not be read (nothing
+// was written), or a negative errno.
+static int write_parity_delta(const char* path, const myfs_layout_t* layout, const char* data,
+                              size_t start, size_t len) {
+    int k = layout->data_fragments;
+    int m = layout->parity_fragments;
+    const char* name = layout_object_name(layout, path);
+    size_t lo[MAX_NODES];
+    size_t hi[MAX_NODES];
+    size_t base, end;
+    
+    if (len == 0) {
+        return 0;
+    }
+    for (int i = 0; i < k; i++) {
+        lo[i] = layout_frag_offset(layout, i, start);
+        hi[i] = layout_frag_offset(layout, i, start + len);
+    }
+    layout_parity_range(layout, start, start + len, &base, &end);
+    size_t plen = end - base;
+    
+    // Every buffer covers fragment positions [base, end); outside a
+    // data fragment's own range old and new bytes are both zero
+    char* old[MAX_NODES] = { NULL };    // Stored data and parity
+    char* fresh[MAX_NODES] = { NULL };  // New data, then new parity
+    char* delta[MAX_NODES] = { NULL };  // old ^ new per data fragment
+    node_op_t ops[MAX_NODES];
+    int nops = 0;
+    int ret = -ENOMEM;
+    
+    // No other update of the object may come between the read of the
+    // old parity and the write of the new one
+    pthread_once(&parity_delta_locks_once, init_parity_delta_locks);
+    pthread_mutex_t* lock = &parity_delta_locks[hash_path(name) % PARITY_DELTA_LOCKS];
+    pthread_mutex_lock(lock);
+    
+    for (int i = 0; i < k + m; i++) {
+        if (i < k && lo[i] == hi[i]) {
+            continue;
+        }
+        size_t from = (i < k) ? lo[i] : base;
+        size_t n = (i < k) ? hi[i] - lo[i] : plen;
+        old[i] = (char*)calloc(plen, 1);
+        fresh[i] = (char*)calloc(plen, 1);
+        if (!old[i] || !fresh[i] || (i < k && !(delta[i] = (char*)malloc(plen)))) {
+            goto out;
+        }
+        init_node_op(&ops[nops], i, REQ_READ, name, i, n, from);
+        ops[nops].recv_buf = old[i] + (from - base);
+        ops[nops].recv_cap = n;
+        nops++;
+    }
+    
+    // A fragment that is short reads as zeros, one that cannot be read
+    // at all leaves the update to the full stripe rewrite
+    run_node_ops(ops, nops, nops);
+    for (int o = 0; o < nops; o++) {
+        if (ops[o].state != NODE_OP_DONE || ops[o].resp.status != 0) {
+            fprintf(stderr, "[MYFS FLUSH] Node %d: cannot read old fragment bytes, rewriting stripes\n",
+                    ops[o].node);
+            ret = 1;
+            goto out;
+        }
+    }
+    
+    layout_scatter(layout, fresh, base, data, start, len);
+    for (int i = 0; i < k; i++) {
+        if (delta[i]) {
+            const char* srcs[2] = { old[i], fresh[i] };
+            xor_buffers(delta[i], srcs, 2, plen);
+        }
+    }
+    for (int j = 0; j < m; j++) {
+        char* parity = fresh[k + j];
+        if (j == 0) {
+            // The first parity fragment is the XOR of the data fragments
+            const char* srcs[MAX_NODES + 1];
+            int nsrcs = 0;
+            srcs[nsrcs++] = old[k];
+            for (int i = 0; i < k; i++) {
+                if (delta[i]) {
+                    srcs[nsrcs++] = delta[i];
+                }
+            }
+            xor_buffers(parity, srcs, nsrcs, plen);
+            continue;
+        }
+        memcpy(parity, old[k + j], plen);
+        for (int i = 0; i < k; i++) {
+            if (delta[i]) {
+                gf_kernel(rs_parity_coef(layout, j, i), (const uint8_t*)delta[i],
+                          (uint8_t*)parity, plen, 1);
+            }
+        }
+    }
+    
+    fprintf(stderr, "[MYFS FLUSH] Parity-delta update of %zu bytes at %zu (%zu parity bytes at %zu)\n",
+            len, start, plen, base);
+    nops = 0;
+    for (int i = 0; i < k + m; i++) {
+        if (!fresh[i]) {
+            continue;
+        }
+        size_t from = (i < k) ? lo[i] : base;
+        size_t n = (i < k) ? hi[i] - lo[i] : plen;
+        init_node_op(&ops[nops], i, REQ_WRITE, name, i, n, from);
+        ops[nops].send_data = fresh[i] + (from - base);
+        ops[nops].send_len = n;
+        nops++;
+    }
+    run_node_ops(ops, nops, nops);
+    ret = 0;
+    for (int o = 0; o < nops && ret == 0; o++) {
+        if (ops[o].state != NODE_OP_DONE) {
+            ret = -EIO;
+        } else if (ops[o].resp.status != 0) {
+            ret = ops[o].resp.error_code ? -ops[o].resp.error_code : -EIO;
+        }
+        if (ret < 0) {
+            fprintf(stderr, "[MYFS FLUSH ERROR] Node %d: parity-delta write failed: %d\n",
+                    ops[o].node, ret);
+            log_msg("[MYFS FLUSH ERROR] Parity-delta write to node %d failed: %d\n", ops[o].node, ret);
+        }
+    }
+    
+out:
+    pthread_mutex_unlock(lock);
+    for (int i = 0; i < k + m; i++) {
+        free(old[i]);
+        free(fresh[i]);
+        free(delta[i]);
+    }
+    return ret;
+}
+
+// Can `dirty` bytes written within [start, end) go out as parity
+// deltas?  Only overwrites inside the stored file that are small next
+// to the stripes they touch do.  Called with wb->lock held.
+static int takes_delta_locked(write_buffer_t* wb, size_t start, size_t end, size_t dirty,
+                              size_t stored_size) {
+    struct bb_state* state = BB_DATA;
+    const myfs_layout_t* layout = &wb->layout;
+    size_t width = layout_stripe_width(layout);
+    
+    if (layout->version != MYFS_LAYOUT_STRIPED || wb->delta_failed || end > stored_size) {
+        return 0;
+    }
+    // Without REQ_TRUNCATE a write at fragment offset 0 empties the fragment
+    for (int i = 0; i < state->num_nodes; i++) {
+        if (!(state->nodes[i].capabilities & MYFS_CAP_TRUNCATE)) {
+            return 0;
+        }
+    }
+    size_t stripes_len = ((end + width - 1) / width - start / width) * width;
+    size_t parity_start, parity_end;
+    layout_parity_range(layout, start, end, &parity_start, &parity_end);
+    return 2 * dirty < stripes_len && parity_end - parity_start <= MAX_CHUNK_SIZE;
+}
+
+// Grow the local metadata file to cover data stored up to `end`
+static void update_metadata_size(const char* path, size_t end) {
+    char fpath[PATH_MAX];
+    snprintf(fpath, PATH_MAX, "%s%s", BB_DATA->rootdir, path);
+    
+    // Open the metadata file to update its size.  It is not created
+    // here: a file unlinked while its stripes were in flight stays gone.
+    int fd = open(fpath, O_WRONLY);
+    if (fd < 0) {
+        fprintf(stderr, "[MYFS FLUSH WARNING] Could not open metadata file to update size: %s\n",
+                strerror(errno));
+        return;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size < (off_t)end) {
+        if (ftruncate(fd, end) == 0) {
+            fprintf(stderr, "[MYFS FLUSH] ✓ Updated metadata file size: %ld -> %ld bytes\n", 
+                    (long)st.st_size, (long)end);
+            log_msg("[MYFS FLUSH] Updated metadata file size from %ld to %ld\n",
+                    (long)st.st_size, (long)end);
+        } else {
+            fprintf(stderr, "[MYFS FLUSH WARNING] Failed to update metadata file size: %s\n",
+                    strerror(errno));
+        }
+    }
+    close(fd);
+}
+
+// Record that the file's data up to `end` is on the nodes.  Called
+// with wb->lock held.
+static void mark_stored_locked(write_buffer_t* wb, size_t end) {
+    update_metadata_size(wb->path, end);
+    if (end > wb->stored_size) {
+        wb->stored_size = end;
+    }
+}
+
+// Account for sealed stripes that reached the nodes.  Called with
+// wb->lock held.
+static void finish_sealed_locked(write_buffer_t* wb) {
+    mark_stored_locked(wb, wb->sealed_start + wb->sealed_size);
+    account_dirty_bytes(-(ssize_t)wb->sealed_size);
+    
+    // Keep the memory around for the next seal
+    if (!wb->spare) {
+        wb->spare = wb->sealed;
+    } else {
+        free(wb->sealed);
+    }
+    wb->sealed = NULL;
+    wb->sealed_size = 0;
+    if (wb->size == 0 && !wb->extents) {
+        __atomic_store_n(&wb->dirty_since, 0, __ATOMIC_RELAXED);
+    }
+    invalidate_read_cache(wb->path);
+}
+
+// Wait until the flusher is done with this file's sealed stripes, and
+// write them here if it has not picked them up or failed on them.
+// Called with wb->lock held.
+static int drain_sealed_locked(write_buffer_t* wb) {
+    while (wb->sealed_busy) {
+        pthread_cond_wait(&wb->sealed_done, &wb->lock);
+    }
+    if (!wb->sealed) {
+        return 0;
+    }
+    
+    int ret = write_stripes(wb->path, &wb->layout, wb->sealed, wb->sealed_start,
+                            wb->sealed_size, NULL, 0);
+    if (ret < 0) {
+        return ret;
+    }
+    finish_sealed_locked(wb);
+    return 0;
+}
+
+// Write one run of extents, from `first` up to `stop`, covering the
+// stripes [run_start, run_end).  Called with wb->lock held.
+static int write_extent_run_locked(write_buffer_t* wb, dirty_extent_t* first, dirty_extent_t* stop,
+                                   size_t run_start, size_t run_end, size_t dirty) {
+    const char* path = wb->path;
+    size_t stored_size = wb->stored_size;
+    const myfs_layout_t* layout = &wb->layout;
+    size_t data_end = 0;
+    int ret;
+    
+    for (dirty_extent_t* e = first; e != stop; e = e->next) {
+        data_end = e->start + e->len;
+    }
+    
+    if (takes_delta_locked(wb, first->start, data_end, dirty, stored_size)) {
+        ret = 0;
+        for (dirty_extent_t* e = first; e != stop && ret == 0; e = e->next) {
+            ret = write_parity_delta(path, layout, e->data, e->start, e->len);
+        }
+        if (ret < 0) {
+            // Some fragments may hold the new bytes: rewrite whole stripes next time
+            wb->delta_failed = 1;
+            return ret;
+        }
+        if (ret == 0) {
+            __atomic_fetch_add(&writeback_stats.deltas, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+    
+    // Rewrite the stripes: their stored bytes patched with the extents,
+    // up to the end of the file
+    size_t file_end = (stored_size > data_end) ? stored_size : data_end;
+    size_t end = (run_end < file_end) ? run_end : file_end;
+    size_t have = (stored_size > run_start) ? ((stored_size < end) ? stored_size : end) - run_start : 0;
+    char* buf = (char*)calloc(end - run_start, 1);
+    if (!buf) {
+        return -ENOMEM;
+    }
+    size_t got = 0;
+    while (got < have) {
+        int n = myfs_read(path, buf + got, have - got, run_start + got);
+        if (n < 0) {
+            free(buf);
+            return n;
+        }
+        if (n == 0) {
+            break;
+        }
+        got += n;
+    }
+    for (dirty_extent_t* e = first; e != stop; e = e->next) {
+        memcpy(buf + (e->start - run_start), e->data, e->len);
+    }
+    
+    fprintf(stderr, "[MYFS FLUSH] Rewriting %zu bytes of stripes at %zu for %zu dirty bytes\n",
+            end - run_start, run_start, dirty);
+    ret = write_stripes(path, layout, buf, run_start, end - run_start, NULL, 0);
+    free(buf);
+    return ret;
+}
+
+// Write back the dirty extents a run of neighbouring stripes at a time.
+// A run whose dirty bytes are few next to its stripes goes out as
+// parity deltas, others are read back, patched and rewritten whole.
+// Called with wb->lock held.
+static int flush_extents_locked(write_buffer_t* wb) {
+    size_t width = layout_stripe_width(&wb->layout);
+    
+    if (!wb->extents) {
+        return 0;
+    }
+    // Extents may patch stripes still held by the flusher
+    int ret = drain_sealed_locked(wb);
+    if (ret < 0) {
+        return ret;
+    }
+    
+    fprintf(stderr, "[MYFS FLUSH] Writing back %zu bytes of dirty extents of %s\n",
+            wb->extent_bytes, wb->path);
+    while (wb->extents) {
+        // Extents sharing or bordering stripes form a run, up to a
+        // bounded number of stripes
+        dirty_extent_t* first = wb->extents;
+        dirty_extent_t* stop = first;
+        size_t run_start = first->start / width * width;
+        size_t run_end = run_start;
+        size_t dirty = 0;
+        while (stop && stop->start / width * width <= run_end) {
+            if (stop->start / width * width == run_end && run_end - run_start >= WRITE_STREAM_PIECE) {
+                break;
+            }
+            dirty += stop->len;
+            run_end = (stop->start + stop->len + width - 1) / width * width;
+            stop = stop->next;
+        }
+        
+        ret = write_extent_run_locked(wb, first, stop, run_start, run_end, dirty);
+        if (ret < 0) {
+            fprintf(stderr, "[MYFS FLUSH] Dirty extents at %zu failed: %d\n", run_start, ret);
+            log_msg("[MYFS FLUSH] Dirty extents of %s at %zu failed: %d\n", wb->path, run_start, ret);
+            return ret;
+        }
+        
+        size_t data_end = 0;
+        while (wb->extents != stop) {
+            dirty_extent_t* e = wb->extents;
+            wb->extents = e->next;
+            data_end = e->start + e->len;
+            free(e->data);
+            free(e);
+        }
+        wb->extent_bytes -= dirty;
+        account_dirty_bytes(-(ssize_t)dirty);
+        mark_stored_locked(wb, data_end);
+    }
+    
+    if (wb->size == 0 && !wb->sealed) {
+        __atomic_store_n(&wb->dirty_since, 0, __ATOMIC_RELAXED);
+    }
+    invalidate_read_cache(wb->path);
+    return 0;
+}
+
+// Encode and send the buffered data of one file.  With
+// keep_partial_stripe set only complete stripes are sent and the rest
+// stays buffered.  The data of a buffer dropped from the table (its
+// file is gone) is discarded.  Called with wb->lock held.
+static int flush_write_buffer_locked(write_buffer_t* wb, int keep_partial_stripe) {
+    struct bb_state* state = BB_DATA;
+    const char* path = wb->path;
+    const myfs_layout_t* layout = &wb->layout;
+    size_t width = layout_stripe_width(layout);
+    
+    if (wb->unlinked) {
+        return 0;
+    }
+    
+    // Stripes handed to the flusher go first, then the extents, so the
+    // window's last stripe is completed from their stored bytes
+    int retstat = drain_sealed_locked(wb);
+    if (retstat < 0) {
+        return retstat;
+    }
+    if (!keep_partial_stripe) {
+        retstat = flush_extents_locked(wb);
+        if (retstat < 0) {
+            return retstat;
+        }
+    }
+    
+    if (!wb->buffer || wb->size == 0) {
+        return 0;  // Nothing to flush
+    }
+    
+    size_t flushed_size = wb->size;
+    if (keep_partial_stripe) {
+        flushed_size = wb->size / width * width;
+        if (flushed_size == 0) {
+            return 0;
+        }
+    }
+    size_t flush_end = wb->total_written + flushed_size;
+    
+    fprintf(stderr, "[MYFS FLUSH] ========== DISTRIBUTING %zu BYTES ==========\n", flushed_size);
+    log_msg("[MYFS FLUSH] Distributing %zu bytes to %d nodes\n", flushed_size, state->num_nodes);
+    
+    // A small overwrite only updates the fragments it covers and the parity
+    size_t dirty_start = (wb->dirty_start > wb->total_written) ? wb->dirty_start : wb->total_written;
+    retstat = 1;
+    if (!keep_partial_stripe &&
+        takes_delta_locked(wb, dirty_start, flush_end, flush_end - dirty_start, wb->stored_size)) {
+        retstat = write_parity_delta(path, layout, wb->buffer + (dirty_start - wb->total_written),
+                                     dirty_start, flush_end - dirty_start);
+        if (retstat < 0) {
+            // Some fragments may hold the new bytes: rewrite whole stripes next time
+            wb->delta_failed = 1;
+            fprintf(stderr, "[MYFS FLUSH] ========== FAILED: error=%d ==========\n", retstat);
+            return retstat;
+        }
+        if (retstat == 0) {
+            __atomic_fetch_add(&writeback_stats.deltas, 1, __ATOMIC_RELAXED);
+        }
+    }
+    
+    if (retstat > 0) {
+        retstat = load_write_window_locked(wb);
+        if (retstat < 0) {
+            return retstat;
+        }
         
-        // Send request header (with retry on connection failure)
-        int send_success = 0;
-        for (int retry = 0; retry < 2; retry++) {
-            if (send_all(state->nodes[i].socket_fd, &req, sizeof(req)) == sizeof(req)) {
-                send_success = 1;
-                break;
+        // The last stripe is rewritten whole, so read back the file bytes
+        // that follow the buffered data in it
+        char* tail = NULL;
+        size_t tail_size = 0;
+        if (flush_end % width != 0 && wb->stored_size > flush_end) {
+            tail_size = (flush_end / width + 1) * width - flush_end;
+            if (flush_end + tail_size > wb->stored_size) {
+                tail_size = wb->stored_size - flush_end;
             }
-            
-            // Send failed, try to reconnect
-            if (retry == 0) {
-                fprintf(stderr, "[MYFS FLUSH] ⚠ Node %d: Send header failed, attempting reconnect...\n", i);
-                if (reconnect_to_node(i) < 0) {
-                    fprintf(stderr, "[MYFS FLUSH ERROR] Node %d: Reconnect failed\n", i);
+            tail = (char*)calloc(tail_size, 1);
+            if (!tail) {
+                return -ENOMEM;
+            }
+            size_t got = 0;
+            while (got < tail_size) {
+                int n = myfs_read(path, tail + got, tail_size - got, flush_end + got);
+                if (n < 0) {
+                    free(tail);
+                    return n;
+                }
+                if (n == 0) {
                     break;
                 }
-                // Retry with new connection
+                got += n;
+            }
+            fprintf(stderr, "[MYFS FLUSH] Read back %zu bytes completing the last stripe\n", got);
+        }
+        
+        retstat = write_stripes(path, layout, wb->buffer, wb->total_written, flushed_size,
+                                tail, tail_size);
+        free(tail);
+        if (retstat < 0) {
+            fprintf(stderr, "[MYFS FLUSH] ========== FAILED: error=%d ==========\n", retstat);
+            return retstat;
+        }
+    }
+    fprintf(stderr, "[MYFS FLUSH] ========== COMPLETE: %zu bytes written ==========\n", flushed_size);
+    
+    wb->total_written += flushed_size;
+    mark_stored_locked(wb, wb->total_written);
+    fprintf(stderr, "[MYFS FLUSH] Total written to remote nodes: %zu bytes\n", wb->total_written);
+    
+    // Drop the flushed data, keeping a partial last stripe if asked to
+    account_dirty_bytes(-(ssize_t)flushed_size);
+    if (flushed_size < wb->size) {
+        memmove(wb->buffer, wb->buffer + flushed_size, wb->size - flushed_size);
+        wb->size -= flushed_size;
+    } else {
+        wb->size = 0;
+        wb->unloaded = 0;
+        if (!wb->sealed && !wb->extents) {
+            __atomic_store_n(&wb->dirty_since, 0, __ATOMIC_RELAXED);
+        }
+    }
+    wb->max_offset = wb->total_written + wb->size;
+    if (wb->dirty_start < wb->total_written) {
+        wb->dirty_start = wb->total_written;
+    }
+    
+    // Read-back during the flush may have cached the old stripe
+    invalidate_read_cache(path);
+    
+    return flushed_size;  // Return number of bytes written
+}
+
+// Hand the complete stripes of the buffer to the flusher and keep
+// filling a fresh buffer meanwhile.  Only one sealed batch per file is
+// in flight, so a writer outrunning the network waits here for the
+// previous one.  Without a flusher the stripes are written directly.
+// Called with wb->lock held.
+static int seal_write_buffer_locked(write_buffer_t* wb) {
+    size_t width = layout_stripe_width(&wb->layout);
+    size_t len = wb->size / width * width;
+    
+    if (len == 0) {
+        return 0;
+    }
+    if (!flusher_running) {
+        return flush_write_buffer_locked(wb, 1);
+    }
+    
+    int ret = drain_sealed_locked(wb);
+    if (ret == 0) {
+        ret = load_write_window_locked(wb);
+    }
+    if (ret < 0) {
+        return ret;
+    }
+    
+    char* fresh = wb->spare ? wb->spare : (char*)malloc(wb->capacity);
+    if (!fresh) {
+        return flush_write_buffer_locked(wb, 1);
+    }
+    wb->spare = NULL;
+    memcpy(fresh, wb->buffer + len, wb->size - len);
+    
+    wb->sealed = wb->buffer;
+    wb->sealed_start = wb->total_written;
+    wb->sealed_size = len;
+    wb->buffer = fresh;
+    wb->total_written += len;
+    wb->size -= len;
+    wb->max_offset = wb->total_written + wb->size;
+    if (wb->dirty_start < wb->total_written) {
+        wb->dirty_start = wb->total_written;
+    }
+    __atomic_fetch_add(&writeback_stats.sealed, 1, __ATOMIC_RELAXED);
+    
+    fprintf(stderr, "[MYFS WRITE] Sealed %zu bytes at %zu for background flush\n",
+            len, wb->sealed_start);
+    kick_flusher();
+    return len;
+}
+
+///////////////////////////////////////////////////////////
+// Background writeback
+//
+// A flusher thread sends sealed stripes while writers keep filling
+// their buffers.  It also writes back buffers once total dirty memory
+// passes DIRTY_BACKGROUND_BYTES or a buffer stays dirty longer than
+// DIRTY_EXPIRE_SECS.  Writers only wait when MAX_DIRTY_BYTES is
+// reached (reserve_dirty_bytes) or their previous batch is still in
+// flight (seal_write_buffer_locked).
+///////////////////////////////////////////////////////////
+
+// Send the sealed stripes of one file without holding its lock
+static void writeback_sealed(write_buffer_t* wb) {
+    pthread_mutex_lock(&wb->lock);
+    if (!wb->sealed || wb->sealed_busy || wb->unlinked) {
+        pthread_mutex_unlock(&wb->lock);
+        return;
+    }
+    wb->sealed_busy = 1;
+    char* data = wb->sealed;
+    size_t start = wb->sealed_start;
+    size_t len = wb->sealed_size;
+    myfs_layout_t layout = wb->layout;
+    char path[PATH_MAX];
+    strcpy(path, wb->path);  // A rename may change it meanwhile
+    pthread_mutex_unlock(&wb->lock);
+    
+    int ret = write_stripes(path, &layout, data, start, len, NULL, 0);
+    
+    pthread_mutex_lock(&wb->lock);
+    wb->sealed_busy = 0;
+    if (ret == 0) {
+        finish_sealed_locked(wb);
+    } else {
+        // Stays sealed: retried on the next pass or by the next flush
+        fprintf(stderr, "[MYFS WRITEBACK] Background flush of %s failed: %d\n", wb->path, ret);
+        log_msg("[MYFS WRITEBACK] Background flush of %s failed: %d\n", wb->path, ret);
+    }
+    pthread_cond_broadcast(&wb->sealed_done);
+    pthread_mutex_unlock(&wb->lock);
+}
+
+// Write back one dirty buffer: its extents and complete stripes, or
+// everything when only a partial stripe is left and it has expired
+static void writeback_buffer(write_buffer_t* wb, time_t now, int over_watermark) {
+    writeback_sealed(wb);
+    
+    pthread_mutex_lock(&wb->lock);
+    if (wb->unlinked) {
+        pthread_mutex_unlock(&wb->lock);
+        return;  // The file is gone
+    }
+    int expired = wb->dirty_since != 0 && now - wb->dirty_since >= DIRTY_EXPIRE_SECS;
+    if (wb->extents && (expired || over_watermark)) {
+        flush_extents_locked(wb);
+    }
+    if (wb->size > 0 && (expired || over_watermark)) {
+        size_t width = layout_stripe_width(&wb->layout);
+        if (wb->size >= width) {
+            seal_write_buffer_locked(wb);
+            __atomic_store_n(&wb->dirty_since, now, __ATOMIC_RELAXED);  // The partial stripe left is new
+        } else if (expired) {
+            __atomic_fetch_add(&writeback_stats.expired, 1, __ATOMIC_RELAXED);
+            flush_write_buffer_locked(wb, 0);
+        }
+    }
+    pthread_mutex_unlock(&wb->lock);
+    
+    writeback_sealed(wb);
+}
+
+// One pass over every dirty buffer
+static void writeback_pass(void) {
+    time_t now = time(NULL);
+    
+    for (int i = 0; i < WRITE_BUFFER_BUCKETS; i++) {
+        write_buffer_bucket_t* bucket = &write_buffer_table[i];
+        write_buffer_t* batch[WRITEBACK_BATCH];
+        int n = 0;
+        
+        pthread_mutex_lock(&bucket->lock);
+        for (write_buffer_t* wb = bucket->head; wb && n < WRITEBACK_BATCH; wb = wb->next) {
+            if (__atomic_load_n(&wb->dirty_since, __ATOMIC_RELAXED) != 0) {
+                __atomic_add_fetch(&wb->refcount, 1, __ATOMIC_RELAXED);
+                batch[n++] = wb;
             }
         }
+        pthread_mutex_unlock(&bucket->lock);
         
-        if (!send_success) {
-            pthread_mutex_unlock(&state->nodes[i].socket_mutex);
-            fprintf(stderr, "[MYFS FLUSH ERROR] Failed to send request header to node %d after retry\n", i);
-            log_msg("Failed to send request to node %d\n", i);
-            retstat = -EIO;
-            goto cleanup;
+        for (int j = 0; j < n; j++) {
+            writeback_buffer(batch[j], now, get_dirty_bytes() > DIRTY_BACKGROUND_BYTES);
+            put_write_buffer(batch[j]);
+        }
+    }
+    
+    // Partial stripes alone can keep us above the watermark: write back
+    // whole buffers, oldest first
+    while (get_dirty_bytes() > DIRTY_BACKGROUND_BYTES) {
+        write_buffer_t* victim = find_oldest_dirty_buffer();
+        if (!victim) {
+            break;
         }
+        pthread_mutex_lock(&victim->lock);
+        int ret = flush_write_buffer_locked(victim, 0);
+        pthread_mutex_unlock(&victim->lock);
+        put_write_buffer(victim);
+        if (ret < 0) {
+            break;  // Nodes unavailable, retry on the next pass
+        }
+    }
+}
+
+static void* flusher_main(void* arg) {
+    // FUSE only sets up the context of its own threads; give this one
+    // the filesystem state so BB_DATA works here too
+    fuse_get_context()->private_data = arg;
+    
+    pthread_mutex_lock(&dirty_lock);
+    while (!flusher_stop) {
+        if (!flusher_kicked) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += FLUSHER_INTERVAL_SECS;
+            pthread_cond_timedwait(&flusher_cond, &dirty_lock, &deadline);
+        }
+        flusher_kicked = 0;
+        if (flusher_stop) {
+            break;
+        }
+        pthread_mutex_unlock(&dirty_lock);
+        
+        writeback_pass();
+        __atomic_fetch_add(&writeback_stats.passes, 1, __ATOMIC_RELAXED);
         
-        fprintf(stderr, "[MYFS FLUSH] Node %d: Sending data (%zu bytes)...\n", i, fragment_size);
+        pthread_mutex_lock(&dirty_lock);
+        pthread_cond_broadcast(&dirty_cond);  // Let throttled writers recheck
+    }
+    pthread_mutex_unlock(&dirty_lock);
+    return NULL;
+}
+
+// Start the flusher (called from bb_init)
+static void start_flusher(struct bb_state* state) {
+    pthread_once(&write_buffer_table_once, init_write_buffer_table);
+    if (pthread_create(&flusher_thread, NULL, flusher_main, state) != 0) {
+        fprintf(stderr, "[MYFS WRITEBACK] Cannot start flusher thread, flushing synchronously\n");
+        log_msg("[MYFS WRITEBACK] Cannot start flusher thread\n");
+        return;
+    }
+    flusher_running = 1;
+}
+
+// Stop the flusher and wait for its current pass (called from bb_destroy)
+static void stop_flusher(void) {
+    if (!flusher_running) {
+        return;
+    }
+    pthread_mutex_lock(&dirty_lock);
+    flusher_stop = 1;
+    pthread_cond_signal(&flusher_cond);
+    pthread_mutex_unlock(&dirty_lock);
+    pthread_join(flusher_thread, NULL);
+    flusher_running = 0;
+}
+
+
+// Fragment reclaimer
+// Unlinking a file only removes its metadata file; its fragments are
+// deleted in the background.  About once a second the reclaimer makes
+// the unlinks of the objects released since its last pass durable (an
+// fsync of their directories), appends the objects to GC_QUEUE_FILE and
+// sends every node one REQ_DELETEV per MYFS_MAX_EXTENTS queued objects.
+// An object leaves the queue once every node has confirmed its delete.
+// Nodes without a connection keep theirs pending and are retried on
+// later passes, and after a remount the whole queue is sent again.  A
+// crash before an unlink reaches the queue leaks its fragments, but the
+// queue never names an object whose file may still exist.
+#define GC_INTERVAL_SECS 1                      // Reclaimer wakes up at least this often
+#define GC_KICK_OBJECTS MYFS_MAX_EXTENTS        // Wake it early once this many are released
+#define MYFS_INTERNAL_DIR "/.myfs"              // Client state in rootdir, hidden from the mount
+#define GC_QUEUE_FILE MYFS_INTERNAL_DIR "/gc-queue"  // Object IDs awaiting deletion, one per line
+
+typedef struct {
+    char name[MYFS_OBJECT_ID_LEN + 1];
+    uint32_t pending;            // Nodes that may still hold a fragment
+    char* dir;                   // Metadata directory of the unlink, until queued
+} gc_object_t;
+
+typedef struct {
+    gc_object_t* objects;
+    size_t count;
+    size_t cap;
+} gc_list_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    gc_list_t released;          // Released since the last pass (under lock)
+    gc_list_t queue;             // Durably queued; owned by the reclaimer
+    pthread_t thread;
+    int running;
+    int stop;
+} gc = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+
+static int gc_list_push(gc_list_t* list, const gc_object_t* obj) {
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 64;
+        gc_object_t* objects = (gc_object_t*)realloc(list->objects, cap * sizeof(gc_object_t));
+        if (!objects) {
+            return -1;
+        }
+        list->objects = objects;
+        list->cap = cap;
+    }
+    list->objects[list->count++] = *obj;
+    return 0;
+}
+
+static uint32_t gc_all_nodes(void) {
+    return (1u << BB_DATA->num_nodes) - 1;
+}
+
+// Is `path` (fs-relative) the reclaimer's own state?
+static int is_internal_path(const char* path) {
+    size_t len = strlen(MYFS_INTERNAL_DIR);
+    return strncmp(path, MYFS_INTERNAL_DIR, len) == 0 && (path[len] == '\0' || path[len] == '/');
+}
+
+// Object ID of the metadata file at fpath if removing it drops the
+// last link to a striped file, else ""
+static void last_link_object(const char* fpath, char object[MYFS_OBJECT_ID_LEN + 1]) {
+    struct stat st;
+    myfs_layout_t layout;
+    
+    object[0] = '\0';
+    if (lstat(fpath, &st) < 0 || !S_ISREG(st.st_mode) || st.st_nlink != 1) {
+        return;
+    }
+    // Files named by path leave their fragments behind: a new file of
+    // the same name may already be writing to them by the time a
+    // delete would arrive
+    if (load_file_layout(fpath, BB_DATA->num_nodes, &layout) == 0) {
+        strcpy(object, layout.object_id);
+    }
+}
+
+// Hand the fragments of an object whose last link at fpath is gone
+// to the reclaimer
+static void release_object(const char* fpath, const char* object) {
+    char dir[PATH_MAX];
+    gc_object_t obj;
+    
+    strncpy(dir, fpath, PATH_MAX - 1);
+    dir[PATH_MAX - 1] = '\0';
+    memset(&obj, 0, sizeof(obj));
+    strcpy(obj.name, object);
+    obj.pending = gc_all_nodes();
+    obj.dir = strdup(dirname(dir));
+    
+    pthread_mutex_lock(&gc.lock);
+    if (!obj.dir || gc_list_push(&gc.released, &obj) < 0) {
+        free(obj.dir);
+        log_msg("[MYFS GC] Out of memory, leaving fragments of %s\n", object);
+    } else {
+        __atomic_fetch_add(&gc_stats.queued, 1, __ATOMIC_RELAXED);
+        if (gc.released.count >= GC_KICK_OBJECTS) {
+            pthread_cond_signal(&gc.cond);
+        }
+    }
+    pthread_mutex_unlock(&gc.lock);
+}
+
+// Load the queue left by earlier mounts (called before the reclaimer starts)
+static void load_gc_queue(void) {
+    char qpath[PATH_MAX];
+    char line[128];
+    
+    bb_fullpath(qpath, GC_QUEUE_FILE);
+    FILE* f = fopen(qpath, "r");
+    if (!f) {
+        return;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        gc_object_t obj;
+        memset(&obj, 0, sizeof(obj));
+        if (sscanf(line, "%32[0-9a-f]", obj.name) != 1 ||
+            strlen(obj.name) != MYFS_OBJECT_ID_LEN) {
+            continue;
+        }
+        obj.pending = gc_all_nodes();
+        if (gc_list_push(&gc.queue, &obj) < 0) {
+            break;
+        }
+    }
+    fclose(f);
+    __atomic_store_n(&gc_stats.pending, gc.queue.count, __ATOMIC_RELAXED);
+    if (gc.queue.count > 0) {
+        fprintf(stderr, "[MYFS GC] %zu objects left to reclaim\n", gc.queue.count);
+        log_msg("[MYFS GC] Loaded %zu queued objects\n", gc.queue.count);
+    }
+}
+
+// Write `count` objects to the queue file, after its current contents
+// or (truncate) in place of them, and wait for them to reach the disk
+static int write_gc_queue(const gc_object_t* objects, size_t count, int truncate) {
+    char qpath[PATH_MAX];
+    char tmp[PATH_MAX];
+    
+    // A truncated path would put the queue somewhere else
+    if (snprintf(qpath, PATH_MAX, "%s%s", BB_DATA->rootdir, GC_QUEUE_FILE) >= PATH_MAX ||
+        snprintf(tmp, PATH_MAX, "%s.tmp", qpath) >= PATH_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    FILE* f = fopen(truncate ? tmp : qpath, truncate ? "w" : "a");
+    if (!f) {
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        fprintf(f, "%s\n", objects[i].name);
+    }
+    int ret = (fflush(f) == 0 && fdatasync(fileno(f)) == 0) ? 0 : -1;
+    if (fclose(f) != 0) {
+        ret = -1;
+    }
+    // Replace the queue atomically: a crash leaves the old or the new one
+    if (ret == 0 && truncate && rename(tmp, qpath) < 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+// Make the unlinks of the objects released since the last pass durable
+// and move them to the queue
+static void queue_released_objects(void) {
+    pthread_mutex_lock(&gc.lock);
+    gc_list_t released = gc.released;
+    memset(&gc.released, 0, sizeof(gc.released));
+    pthread_mutex_unlock(&gc.lock);
+    if (released.count == 0) {
+        return;
+    }
+    
+    // An unlink that a crash could still undo must not reach the queue
+    const char* synced = NULL;
+    int sync_ok = 0;
+    for (size_t i = 0; i < released.count; i++) {
+        gc_object_t* obj = &released.objects[i];
+        if (!synced || strcmp(synced, obj->dir) != 0) {
+            int fd = open(obj->dir, O_RDONLY);
+            sync_ok = (fd >= 0 && fsync(fd) == 0);
+            if (fd >= 0) {
+                close(fd);
+            }
+            synced = obj->dir;
+        }
+        if (!sync_ok) {
+            log_msg("[MYFS GC] Cannot sync %s, leaving fragments of %s\n", obj->dir, obj->name);
+            obj->pending = 0;
+        }
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < released.count; i++) {
+        free(released.objects[i].dir);
+        released.objects[i].dir = NULL;
+        if (released.objects[i].pending) {
+            released.objects[kept++] = released.objects[i];
+        }
+    }
+    
+    if (kept > 0 && write_gc_queue(released.objects, kept, 0) < 0) {
+        // Still reclaimed by this mount, just not after a crash
+        fprintf(stderr, "[MYFS GC] Cannot write the deletion queue: %s\n", strerror(errno));
+        log_msg("[MYFS GC] Cannot append %zu objects to the queue\n", kept);
+    }
+    for (size_t i = 0; i < kept; i++) {
+        if (gc_list_push(&gc.queue, &released.objects[i]) < 0) {
+            log_msg("[MYFS GC] Out of memory, %s waits for the next mount\n",
+                    released.objects[i].name);
+        }
+    }
+    free(released.objects);
+    __atomic_store_n(&gc_stats.pending, gc.queue.count, __ATOMIC_RELAXED);
+}
+
+// Delete the fragments `node` holds of `objects` with one REQ_DELETE
+// each, all in flight together, for a node that predates REQ_DELETEV.
+// Clears the node on the objects it confirmed, and adds it to `skip`
+// if any failed.
+static void delete_objects_singly(gc_object_t* objects, size_t count, int node, uint32_t* skip) {
+    node_op_t* ops = (node_op_t*)malloc(count * sizeof(node_op_t));
+    size_t* members = (size_t*)malloc(count * sizeof(size_t));
+    if (!ops || !members) {
+        free(ops);
+        free(members);
+        *skip |= 1u << node;
+        return;
+    }
+    
+    int n = 0;
+    for (size_t j = 0; j < count; j++) {
+        if (objects[j].pending & (1u << node)) {
+            init_node_op(&ops[n], node, REQ_DELETE, objects[j].name, node, 0, 0);
+            members[n++] = j;
+        }
+    }
+    if (n > 0) {
+        run_node_ops(ops, n, n);
+    }
+    
+    int failed = 0;
+    for (int k = 0; k < n; k++) {
+        // A fragment that is already gone counts as deleted
+        if (ops[k].state == NODE_OP_DONE &&
+            (ops[k].resp.status == 0 || ops[k].resp.error_code == ENOENT)) {
+            objects[members[k]].pending &= ~(1u << node);
+        } else {
+            failed++;
+        }
+    }
+    if (failed > 0) {
+        fprintf(stderr, "[MYFS GC] Node %d: %d deletes failed, retrying later\n", node, failed);
+        log_msg("[MYFS GC] %d of %d deletes failed on node %d\n", failed, n, node);
+        *skip |= 1u << node;
+    }
+    free(ops);
+    free(members);
+}
+
+// Send one REQ_DELETEV to each node that holds fragments of `objects`
+// and is connected, and clear the nodes that confirmed.  Nodes without
+// REQ_DELETEV get a REQ_DELETE per object instead.  Nodes that fail are
+// added to `skip` so the rest of the pass leaves them alone.
+static void delete_object_batch(gc_object_t* objects, size_t count, uint32_t* skip) {
+    struct bb_state* state = BB_DATA;
+    node_op_t ops[MAX_NODES];
+    size_t members[MAX_NODES][MYFS_MAX_EXTENTS];  // Objects in each node's batch
+    size_t sizes[MAX_NODES];
+    char replies[MAX_NODES][MYFS_MAX_EXTENTS * sizeof(myfs_extent_result_t)];
+    char* tables[MAX_NODES] = { NULL };
+    int nops = 0;
+    
+    for (int i = 0; i < state->num_nodes; i++) {
+        if (*skip & (1u << i)) {
+            continue;
+        }
+        pthread_mutex_lock(&node_io.lock);
+        int connected = (pick_node_conn_locked(i) != NULL);
+        pthread_mutex_unlock(&node_io.lock);
+        if (!connected) {
+            *skip |= 1u << i;  // The keeper reconnects it meanwhile
+            continue;
+        }
+        if (!(state->nodes[i].capabilities & MYFS_CAP_DELETEV)) {
+            delete_objects_singly(objects, count, i, skip);
+            continue;
+        }
         
-        // Send data
-        if (send_all(state->nodes[i].socket_fd, fragments[i], fragment_size) != (ssize_t)fragment_size) {
-            pthread_mutex_unlock(&state->nodes[i].socket_mutex);
-            fprintf(stderr, "[MYFS FLUSH ERROR] Failed to send data to node %d\n", i);
-            log_msg("Failed to send data to node %d\n", i);
-            retstat = -EIO;
-            goto cleanup;
+        size_t n = 0;
+        size_t table_len = 0;
+        for (size_t j = 0; j < count; j++) {
+            if (objects[j].pending & (1u << i)) {
+                if (!tables[nops] && !(tables[nops] = (char*)malloc(MYFS_MAX_EXTENT_TABLE))) {
+                    break;
+                }
+                table_len += myfs_encode_extent(objects[j].name, i, 0, 0, tables[nops] + table_len);
+                members[nops][n++] = j;
+            }
+        }
+        if (n == 0) {
+            continue;
+        }
+        init_node_op(&ops[nops], i, REQ_DELETEV, "", n, 0, table_len);
+        ops[nops].send_data = tables[nops];
+        ops[nops].send_len = table_len;
+        ops[nops].recv_buf = replies[nops];
+        ops[nops].recv_cap = n * sizeof(myfs_extent_result_t);
+        sizes[nops] = n;
+        nops++;
+    }
+    if (nops == 0) {
+        free(tables[0]);
+        return;
+    }
+    
+    run_node_ops(ops, nops, nops);
+    
+    for (int o = 0; o < nops; o++) {
+        int node = ops[o].node;
+        if (ops[o].state != NODE_OP_DONE || ops[o].resp.status != 0 ||
+            ops[o].resp.size < sizes[o] * sizeof(myfs_extent_result_t)) {
+            fprintf(stderr, "[MYFS GC] Node %d: delete batch failed, retrying later\n", node);
+            log_msg("[MYFS GC] Delete batch of %zu objects failed on node %d\n", sizes[o], node);
+            *skip |= 1u << node;
+            continue;
+        }
+        __atomic_fetch_add(&gc_stats.batches, 1, __ATOMIC_RELAXED);
+        for (size_t m = 0; m < sizes[o]; m++) {
+            response_header_t result;
+            myfs_decode_extent_result(
+                (const myfs_extent_result_t*)(replies[o] + m * sizeof(myfs_extent_result_t)),
+                &result);
+            if (result.status == 0) {
+                objects[members[o][m]].pending &= ~(1u << node);
+            }
+        }
+    }
+    for (int o = 0; o < MAX_NODES; o++) {
+        free(tables[o]);
+    }
+}
+
+static void reclaim_pass(void) {
+    queue_released_objects();
+    
+    uint32_t skip = 0;
+    for (size_t at = 0; at < gc.queue.count && skip != gc_all_nodes(); at += MYFS_MAX_EXTENTS) {
+        size_t n = gc.queue.count - at;
+        delete_object_batch(gc.queue.objects + at, n < MYFS_MAX_EXTENTS ? n : MYFS_MAX_EXTENTS,
+                            &skip);
+    }
+    
+    // Drop the objects every node has confirmed
+    size_t kept = 0;
+    for (size_t i = 0; i < gc.queue.count; i++) {
+        if (gc.queue.objects[i].pending) {
+            gc.queue.objects[kept++] = gc.queue.objects[i];
+        }
+    }
+    size_t reclaimed = gc.queue.count - kept;
+    if (reclaimed == 0) {
+        return;
+    }
+    gc.queue.count = kept;
+    if (write_gc_queue(gc.queue.objects, kept, 1) < 0) {
+        // The old queue stays; its objects are only deleted again
+        log_msg("[MYFS GC] Cannot rewrite the deletion queue: %s\n", strerror(errno));
+    }
+    __atomic_fetch_add(&gc_stats.reclaimed, reclaimed, __ATOMIC_RELAXED);
+    __atomic_store_n(&gc_stats.pending, kept, __ATOMIC_RELAXED);
+    log_msg("[MYFS GC] Reclaimed %zu objects, %zu pending\n", reclaimed, kept);
+}
+
+static void* reclaimer_main(void* arg) {
+    fuse_get_context()->private_data = arg;
+    
+    pthread_mutex_lock(&gc.lock);
+    while (!gc.stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += GC_INTERVAL_SECS;
+        pthread_cond_timedwait(&gc.cond, &gc.lock, &deadline);
+        if (gc.stop) {
+            break;
         }
+        pthread_mutex_unlock(&gc.lock);
         
-        fprintf(stderr, "[MYFS FLUSH] Node %d: Waiting for response...\n", i);
+        reclaim_pass();
         
-        // Receive response
-        if (recv(state->nodes[i].socket_fd, &resp, sizeof(resp), MSG_WAITALL) != sizeof(resp)) {
-            pthread_mutex_unlock(&state->nodes[i].socket_mutex);
-            fprintf(stderr, "[MYFS FLUSH ERROR] Failed to receive response from node %d\n", i);
-            log_msg("Failed to receive response from node %d\n", i);
-            retstat = -EIO;
-            goto cleanup;
+        pthread_mutex_lock(&gc.lock);
+    }
+    pthread_mutex_unlock(&gc.lock);
+    return NULL;
+}
+
+// Load the queue and start the reclaimer (called from bb_init)
+static void start_reclaimer(struct bb_state* state) {
+    char dir[PATH_MAX];
+    
+    bb_fullpath(dir, MYFS_INTERNAL_DIR);
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+        fprintf(stderr, "[MYFS GC] Cannot create %s: %s\n", dir, strerror(errno));
+    }
+    load_gc_queue();
+    if (pthread_create(&gc.thread, NULL, reclaimer_main, state) != 0) {
+        fprintf(stderr, "[MYFS GC] Cannot start reclaimer thread, fragments are kept\n");
+        log_msg("[MYFS GC] Cannot start reclaimer thread\n");
+        return;
+    }
+    gc.running = 1;
+}
+
+// Stop the reclaimer and queue what it has not seen yet, so the next
+// mount deletes it (called from bb_destroy)
+static void stop_reclaimer(void) {
+    if (gc.running) {
+        pthread_mutex_lock(&gc.lock);
+        gc.stop = 1;
+        pthread_cond_signal(&gc.cond);
+        pthread_mutex_unlock(&gc.lock);
+        pthread_join(gc.thread, NULL);
+        gc.running = 0;
+    }
+    queue_released_objects();
+    free(gc.queue.objects);
+    memset(&gc.queue, 0, sizeof(gc.queue));
+}
+
+
+// Distributed read function with fault tolerance
+// Small files are read in batches: on a whole-file miss, up to
+// MYFS_MAX_EXTENTS small files of the same directory that are not
+// cached yet are fetched together, one REQ_READV per node, and all go
+// into the read cache.  Reading every file of a directory then costs
+// one round trip per node for each batch instead of one per file.
+#define SMALL_FILE_BATCH_SCAN 1024  // Directory entries looked at per batch
+
+typedef struct {
+    char path[PATH_MAX];
+    struct stat st;
+    unsigned long generation;    // Read cache generation before the fetch
+    myfs_layout_t layout;
+    size_t frag_len;             // Fragment bytes holding the whole file
+} batch_file_t;
+
+// Where one fragment of a batched file sits in a node's reply
+typedef struct {
+    const char* data;            // NULL if the node did not return it
+    size_t len;
+} batch_piece_t;
+
+// Whether a file has writes not yet on the nodes.  The caller may hold
+// another file's buffer lock, so a busy buffer counts as dirty rather
+// than being waited for.
+static int has_unflushed_writes(const char* path) {
+    write_buffer_t* wb = get_write_buffer(path, 0);
+    if (!wb) {
+        return 0;
+    }
+    if (pthread_mutex_trylock(&wb->lock) != 0) {
+        put_write_buffer(wb);
+        return 1;
+    }
+    int dirty = (wb->size > 0 || wb->sealed_size > 0 || wb->sealed_busy || wb->extents);
+    pthread_mutex_unlock(&wb->lock);
+    put_write_buffer(wb);
+    return dirty;
+}
+
+// Add a sibling of the file being read to the batch if it can be read
+// the same way: a small, clean, uncached regular file with the same
+// fragment counts.  Returns 0 if added.
+static int add_batch_sibling(batch_file_t* f, const char* path, const batch_file_t* first,
+                             size_t room) {
+    struct bb_state* state = BB_DATA;
+    char fpath[PATH_MAX];
+    size_t path_len = strlen(path);
+    
+    if (path_len >= sizeof(f->path) ||
+        snprintf(fpath, PATH_MAX, "%s%s", state->rootdir, path) >= PATH_MAX) {
+        return -1;
+    }
+    if (lstat(fpath, &f->st) < 0 || !S_ISREG(f->st.st_mode) || f->st.st_size == 0 ||
+        (size_t)f->st.st_size > read_cache_whole_file_limit() || read_cache_holds_file(&f->st)) {
+        return -1;
+    }
+    if (load_file_layout(fpath, state->num_nodes, &f->layout) < 0 ||
+        f->layout.data_fragments != first->layout.data_fragments ||
+        strlen(layout_object_name(&f->layout, path)) > MYFS_MAX_NAME_LEN) {
+        return -1;
+    }
+    f->frag_len = layout_frag_offset(&f->layout, 0, f->st.st_size);
+    if (f->frag_len > room || has_unflushed_writes(path)) {
+        return -1;
+    }
+    f->generation = read_cache_generation(&f->st);
+    memcpy(f->path, path, path_len + 1);
+    return 0;
+}
+
+// Collect small files next to files[0] into the batch.  Returns the
+// number of files in it.
+static int collect_batch_siblings(batch_file_t* files) {
+    struct bb_state* state = BB_DATA;
+    char dir[PATH_MAX];
+    char fdir[PATH_MAX];
+    
+    strncpy(dir, files[0].path, PATH_MAX - 1);
+    dir[PATH_MAX - 1] = '\0';
+    char* slash = strrchr(dir, '/');
+    slash[0] = '\0';  // "" for the root directory
+    snprintf(fdir, PATH_MAX, "%s%s", state->rootdir, dir);
+    
+    DIR* dp = opendir(fdir);
+    if (!dp) {
+        return 1;
+    }
+    int count = 1;
+    size_t room = MYFS_MAX_BATCH_DATA - files[0].frag_len;
+    struct dirent* de;
+    for (int scanned = 0; count < MYFS_MAX_EXTENTS && scanned < SMALL_FILE_BATCH_SCAN &&
+                          (de = readdir(dp)) != NULL; scanned++) {
+        char path[PATH_MAX];
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0 ||
+            snprintf(path, PATH_MAX, "%s/%s", dir, de->d_name) >= PATH_MAX ||
+            strcmp(path, files[0].path) == 0) {
+            continue;
+        }
+        if (add_batch_sibling(&files[count], path, &files[0], room) == 0) {
+            room -= files[count].frag_len;
+            count++;
+        }
+    }
+    closedir(dp);
+    return count;
+}
+
+// Read a small file together with its uncached siblings and put them
+// all in the read cache.  Returns 0 if the file was cached, -1 if it
+// has to be read on its own.
+static int read_small_files_batch(const char* path, const struct stat* st,
+                                  const myfs_layout_t* layout) {
+    struct bb_state* state = BB_DATA;
+    int num_nodes = state->num_nodes;
+    int k = layout->data_fragments;
+    
+    for (int i = 0; i < num_nodes; i++) {
+        if (!(state->nodes[i].capabilities & MYFS_CAP_VECTOR)) {
+            return -1;
+        }
+    }
+    size_t first_len = layout_frag_offset(layout, 0, st->st_size);
+    if (first_len > MYFS_MAX_BATCH_DATA ||
+        strlen(layout_object_name(layout, path)) > MYFS_MAX_NAME_LEN) {
+        return -1;
+    }
+    
+    batch_file_t* files = (batch_file_t*)calloc(MYFS_MAX_EXTENTS, sizeof(batch_file_t));
+    if (!files) {
+        return -1;
+    }
+    strncpy(files[0].path, path, PATH_MAX - 1);
+    files[0].st = *st;
+    files[0].generation = read_cache_generation(st);
+    files[0].layout = *layout;
+    files[0].frag_len = first_len;
+    int count = collect_batch_siblings(files);
+    if (count == 1) {
+        free(files);
+        return -1;  // Nothing to share the round trip with
+    }
+    
+    // One READV per node, listing that node's fragment of every file
+    size_t results_len = count * sizeof(myfs_extent_result_t);
+    size_t data_len = 0;
+    for (int j = 0; j < count; j++) {
+        data_len += files[j].frag_len;
+    }
+    node_op_t ops[MAX_NODES];
+    char* tables[MAX_NODES] = { NULL };
+    char* replies[MAX_NODES] = { NULL };
+    int ret = -1;
+    for (int i = 0; i < num_nodes; i++) {
+        tables[i] = (char*)malloc(MYFS_MAX_EXTENT_TABLE);
+        replies[i] = (char*)malloc(results_len + data_len);
+        if (!tables[i] || !replies[i]) {
+            goto out;
         }
-        
-        if (resp.status != 0) {
-            pthread_mutex_unlock(&state->nodes[i].socket_mutex);
-            fprintf(stderr, "[MYFS FLUSH ERROR] Node %d returned error: status=%d, errno=%d\n", 
-                    i, resp.status, resp.error_code);
-            log_msg("[MYFS FLUSH ERROR] Node %d returned error: %d\n", i, resp.error_code);
-            retstat = -resp.error_code;
-            goto cleanup;
+        size_t table_len = 0;
+        for (int j = 0; j < count; j++) {
+            table_len += myfs_encode_extent(layout_object_name(&files[j].layout, files[j].path),
+                                            i, 0, files[j].frag_len, tables[i] + table_len);
         }
-        
-        // Unlock mutex after successful communication
-        pthread_mutex_unlock(&state->nodes[i].socket_mutex);
-        
-        fprintf(stderr, "[MYFS FLUSH] ✓ Node %d: Fragment %d written successfully (%zu bytes)\n", 
-                i, i, fragment_size);
-        log_msg("[MYFS FLUSH] Successfully wrote fragment %d to node %d\n", i, i);
+        init_node_op(&ops[i], i, REQ_READV, "", count, 0, table_len);
+        ops[i].send_data = tables[i];
+        ops[i].send_len = table_len;
+        ops[i].recv_buf = replies[i];
+        ops[i].recv_cap = results_len + data_len;
+        ops[i].hedge = (i >= k);
     }
+    fprintf(stderr, "[MYFS READ] Batch reading %d small files (%zu fragment bytes per node)\n",
+            count, data_len);
+    log_msg("[MYFS READ] Batch of %d files for %s\n", count, path);
     
-    fprintf(stderr, "[MYFS FLUSH] ========== COMPLETE: %zu bytes written ==========\n", wb->size);
-    retstat = wb->size;  // Return number of bytes written
+    run_node_ops(ops, num_nodes, k);
     
-cleanup:
-    fprintf(stderr, "[MYFS FLUSH] Cleanup: Freeing %d fragment buffers\n", num_nodes);
+    // Locate every file's fragment in the replies: each node's data
+    // holds what its extents returned, back to back
+    batch_piece_t (*pieces)[MAX_NODES] = calloc(count, sizeof(*pieces));
+    if (!pieces) {
+        goto out;
+    }
     for (int i = 0; i < num_nodes; i++) {
-        if (fragments[i]) {
-            free(fragments[i]);
+        int usable = (ops[i].state == NODE_OP_DONE && ops[i].resp.status == 0 &&
+                      ops[i].resp.size >= results_len);
+        size_t at = results_len;
+        for (int j = 0; j < count && usable; j++) {
+            response_header_t result;
+            myfs_decode_extent_result(
+                (const myfs_extent_result_t*)(replies[i] + j * sizeof(myfs_extent_result_t)),
+                &result);
+            if (result.status != 0) {
+                continue;  // This fragment is missing on the node
+            }
+            if (result.size > files[j].frag_len || at + result.size > ops[i].resp.size) {
+                usable = 0;  // Malformed reply, ignore the rest of it
+                break;
+            }
+            pieces[j][i].data = replies[i] + at;
+            pieces[j][i].len = result.size;
+            at += result.size;
+        }
+        if (!usable) {
+            for (int j = 0; j < count; j++) {
+                pieces[j][i].data = NULL;
+            }
         }
     }
-    free(fragments);
     
-    if (retstat < 0) {
-        fprintf(stderr, "[MYFS FLUSH] ========== FAILED: error=%d ==========\n", retstat);
-    } else {
-        // Update total written counter
-        wb->total_written += flushed_size;
-        
-        // Update local metadata file size after successful flush
-        char fpath[PATH_MAX];
-        snprintf(fpath, PATH_MAX, "%s%s", state->rootdir, path);
+    // Rebuild and cache each file, the one asked for last so that it is
+    // the most recently used.  Fragments shorter than frag_len read as
+    // zeros past their end.
+    for (int j = count - 1; j >= 0; j--) {
+        batch_file_t* f = &files[j];
+        char* fragments[MAX_NODES] = { NULL };
+        int present[MAX_NODES];
+        int wanted[MAX_NODES];
+        int num_present = 0;
+        int missing = 0;
+        int ok = 1;
         
-        // Open the metadata file to update its size
-        int fd = open(fpath, O_WRONLY | O_CREAT, 0644);
-        if (fd >= 0) {
-            struct stat st;
-            if (fstat(fd, &st) == 0) {
-                // Update file size to match total written
-                off_t new_size = wb->total_written;
-                if (st.st_size < new_size) {
-                    if (ftruncate(fd, new_size) == 0) {
-                        fprintf(stderr, "[MYFS FLUSH] ✓ Updated metadata file size: %ld -> %ld bytes\n", 
-                                (long)st.st_size, (long)new_size);
-                        log_msg("[MYFS FLUSH] Updated metadata file size from %ld to %ld\n",
-                                (long)st.st_size, (long)new_size);
-                    } else {
-                        fprintf(stderr, "[MYFS FLUSH WARNING] Failed to update metadata file size: %s\n",
-                                strerror(errno));
-                    }
-                }
+        for (int i = 0; i < num_nodes; i++) {
+            fragments[i] = (char*)calloc(f->frag_len, 1);
+            if (!fragments[i]) {
+                ok = 0;
+                continue;
             }
-            close(fd);
-        } else {
-            fprintf(stderr, "[MYFS FLUSH WARNING] Could not open metadata file to update size: %s\n",
-                    strerror(errno));
+            present[i] = (pieces[j][i].data != NULL);
+            if (present[i]) {
+                memcpy(fragments[i], pieces[j][i].data, pieces[j][i].len);
+                num_present++;
+            }
+            wanted[i] = (i < k && !present[i]);
+            missing += wanted[i];
+        }
+        if (ok && missing > 0) {
+            ok = (num_present >= k &&
+                  layout_codec(&f->layout)->decode(&f->layout, fragments, present, wanted,
+                                                   f->frag_len) == 0);
+        }
+        char* buffer = ok ? (char*)malloc(f->st.st_size) : NULL;
+        if (buffer) {
+            layout_gather(&f->layout, buffer, fragments, 0, f->frag_len, 0, f->st.st_size);
+            read_cache_insert(&f->st, f->generation, 0, buffer, f->st.st_size);  // Takes buffer
+            __atomic_fetch_add(&read_cache_stats.batched, 1, __ATOMIC_RELAXED);
+            if (j == 0) {
+                ret = 0;
+            }
+        }
+        for (int i = 0; i < num_nodes; i++) {
+            free(fragments[i]);
         }
-        
-        fprintf(stderr, "[MYFS FLUSH] Total written to remote nodes: %zu bytes\n", wb->total_written);
-        
-        // Clear buffer after successful flush
-        wb->size = 0;
-        wb->max_offset = 0;
     }
+    free(pieces);
     
-    return retstat;
+out:
+    for (int i = 0; i < num_nodes; i++) {
+        free(tables[i]);
+        free(replies[i]);
+    }
+    free(files);
+    return ret;
 }
 
-// Distributed read function with fault tolerance
 static int myfs_read(const char* path, char* buf, size_t size, off_t offset) {
     struct bb_state* state = BB_DATA;
     int num_nodes = state->num_nodes;
-    int num_data_fragments = num_nodes - 1;
     
     fprintf(stderr, "[MYFS READ] path=%s, size=%zu, offset=%ld\n", 
             path, size, offset);
@@ -718,89 +4741,94 @@ static int myfs_read(const char* path, char* buf, size_t size, off_t offset) {
         bytes_to_read = file_size - offset;
     }
     
-    // Determine if we should cache this file based on size threshold
-    int should_cache = (file_size <= CACHE_THRESHOLD);
+    // Small files are cached whole, large files through a readahead window
+    int should_cache = (file_size <= read_cache_whole_file_limit());
     fprintf(stderr, "[MYFS READ] File size: %zu bytes, cache strategy: %s\n", 
-            file_size, should_cache ? "CACHE" : "NO_CACHE (>3MB)");
+            file_size, should_cache ? "CACHE" : "READAHEAD_WINDOW");
     log_msg("[MYFS READ] File %s: size=%zu, will_cache=%d\n", path, file_size, should_cache);
     
-    // Declare cache variable here so it's available throughout the function
-    read_cache_t* cache = NULL;
-    
-    // Only check cache for small files
-    if (should_cache) {
-        cache = get_read_cache(path, 0);
-        if (cache && cache->buffer && cache->size == file_size) {
-            // Verify that the read is within cache bounds
-            if (offset + bytes_to_read <= cache->size) {
-                // Cache hit! Just copy from cache
-                fprintf(stderr, "[MYFS READ CACHE HIT] Serving %zu bytes from cache (offset=%ld)\n", 
-                        bytes_to_read, offset);
-                log_msg("[MYFS READ CACHE HIT] path=%s, offset=%ld, size=%zu\n", path, offset, bytes_to_read);
-                memcpy(buf, cache->buffer + offset, bytes_to_read);
-                return bytes_to_read;
-            } else {
-                // Read request exceeds cache bounds - this shouldn't happen
-                fprintf(stderr, "[MYFS READ WARNING] Cache bounds exceeded: offset=%ld, bytes_to_read=%zu, cache_size=%zu\n",
-                        offset, bytes_to_read, cache->size);
-                log_msg("[MYFS READ WARNING] Cache bounds check failed, invalidating cache\n");
-                // Invalidate cache and fall through to network read
-                invalidate_read_cache(path);
-            }
-        }
-    } else {
-        // Large file: check readahead window first
-        readahead_window_t* window = get_readahead_window(path, 0);
-        if (window && window->buffer && strcmp(window->path, path) == 0 &&
-            window->start_offset >= 0 &&  // Ensure window has been initialized
-            offset >= window->start_offset && 
-            offset + bytes_to_read <= window->start_offset + window->valid_size) {
-            
-            // Window hit! Serve from readahead buffer
-            size_t window_offset = offset - window->start_offset;
-            fprintf(stderr, "[MYFS READAHEAD HIT] Serving %zu bytes from window (offset=%ld, window_start=%ld)\n", 
-                    bytes_to_read, offset, window->start_offset);
-            log_msg("[MYFS READAHEAD HIT] path=%s, offset=%ld, size=%zu, window=[%ld,%ld]\n", 
-                    path, offset, bytes_to_read, window->start_offset, 
-                    window->start_offset + window->valid_size);
-            
-            memcpy(buf, window->buffer + window_offset, bytes_to_read);
-            return bytes_to_read;
-        }
-        
-        // Window miss - will need to load new window from network
-        if (window && window->buffer && strcmp(window->path, path) == 0) {
-            fprintf(stderr, "[MYFS READAHEAD MISS] Window exists but miss: offset=%ld not in [%ld,%ld]\n", 
-                    offset, window->start_offset, window->start_offset + window->valid_size);
-        } else {
-            fprintf(stderr, "[MYFS READAHEAD MISS] Need to load new window for offset=%ld\n", offset);
-        }
+    read_cache_entry_t* cached = read_cache_lookup(&st, offset, bytes_to_read);
+    if (cached) {
+        // Cache hit! Just copy from cache
+        fprintf(stderr, "[MYFS READ CACHE HIT] Serving %zu bytes from cache (offset=%ld, cached=[%ld,%ld])\n", 
+                bytes_to_read, offset, (long)cached->start, (long)(cached->start + cached->size));
+        log_msg("[MYFS READ CACHE HIT] path=%s, offset=%ld, size=%zu\n", path, offset, bytes_to_read);
+        memcpy(buf, cached->buffer + (offset - cached->start), bytes_to_read);
+        read_cache_put(cached);
+        return bytes_to_read;
     }
     
     // Cache/Window miss - need to read from network
+    unsigned long generation = read_cache_generation(&st);
     fprintf(stderr, "[MYFS READ] ========== CACHE MISS - Reading from nodes ==========\n");
     fprintf(stderr, "[MYFS READ] File size: %zu bytes, reading %zu bytes at offset %ld\n", 
             file_size, bytes_to_read, offset);
     log_msg("[MYFS READ] File actual size: %zu bytes (requested: %zu bytes)\n", 
             file_size, size);
     
-    // Calculate fragment size based on ACTUAL FILE SIZE, not requested size
-    size_t fragment_size = (file_size + num_data_fragments - 1) / num_data_fragments;
-    fprintf(stderr, "[MYFS READ] Fragment size: %zu bytes (file_size=%zu, fragments=%d)\n", 
-            fragment_size, file_size, num_data_fragments);
+    myfs_layout_t layout;
+    int layout_ret = load_file_layout(fpath, num_nodes, &layout);
+    if (layout_ret < 0) {
+        return layout_ret;
+    }
+    int num_data_fragments = layout.data_fragments;
+    
+    // A small file is fetched along with its uncached neighbours when
+    // the nodes take batches
+    if (should_cache && read_small_files_batch(path, &st, &layout) == 0) {
+        cached = read_cache_lookup(&st, offset, bytes_to_read);
+        if (cached) {
+            memcpy(buf, cached->buffer + (offset - cached->start), bytes_to_read);
+            read_cache_put(cached);
+            return bytes_to_read;
+        }
+    }
+    
+    // Decide which range to reconstruct: the whole file for small files,
+    // a readahead window starting at the request for large ones
+    off_t range_start = 0;
+    size_t range_size = file_size;
+    if (!should_cache) {
+        range_start = offset;
+        range_size = read_cache_window_size();
+        if (range_size < bytes_to_read) {
+            range_size = bytes_to_read;
+        }
+        if (range_start + range_size > file_size) {
+            range_size = file_size - range_start;
+        }
+        fprintf(stderr, "[MYFS READ] Loading window [%ld - %ld] (%zu bytes)\n", 
+                (long)range_start, (long)(range_start + range_size), range_size);
+        log_msg("[MYFS READ] Window range: [%ld, %ld], size=%zu\n", 
+                (long)range_start, (long)(range_start + range_size), range_size);
+    }
     
-    // For large files, optimize read granularity
-    if (file_size > LARGE_FILE_THRESHOLD) {
-        // For large files, we read entire fragments even for partial requests
-        // This reduces network round-trips at the cost of reading more data
-        fprintf(stderr, "[MYFS READ] Large file detected (%zu bytes > %d bytes), using optimized read strategy\n",
-                file_size, LARGE_FILE_THRESHOLD);
-        log_msg("[MYFS READ] Large file optimization enabled for %s\n", path);
+    // Fetch only the fragment positions holding that range.  Data
+    // fragments without bytes in the range are only needed to rebuild a
+    // missing one, so all fragments fetch the same positions.
+    int needed[MAX_NODES];
+    size_t frag_start = SIZE_MAX;
+    size_t frag_end = 0;
+    for (int i = 0; i < num_nodes; i++) {
+        needed[i] = 0;
+        if (i >= num_data_fragments) {
+            continue;
+        }
+        size_t lo = layout_frag_offset(&layout, i, range_start);
+        size_t hi = layout_frag_offset(&layout, i, range_start + range_size);
+        if (hi > lo) {
+            needed[i] = 1;
+            if (lo < frag_start) frag_start = lo;
+            if (hi > frag_end) frag_end = hi;
+        }
     }
+    size_t frag_len = frag_end - frag_start;
+    fprintf(stderr, "[MYFS READ] Fragment range: [%zu, %zu), stripe unit %zu\n",
+            frag_start, frag_end, layout.stripe_unit);
     
     // Allocate buffers for fragments
     fprintf(stderr, "[MYFS READ] Allocating memory: %d fragments × %zu bytes = %zu bytes total\n",
-            num_nodes, fragment_size, num_nodes * fragment_size);
+            num_nodes, frag_len, num_nodes * frag_len);
     
     char** fragments = (char**)malloc(num_nodes * sizeof(char*));
     if (!fragments) {
@@ -822,10 +4850,10 @@ static int myfs_read(const char* path, char* buf, size_t size, off_t offset) {
     
     // Allocate each fragment buffer
     for (int i = 0; i < num_nodes; i++) {
-        fragments[i] = (char*)calloc(fragment_size, 1);
+        fragments[i] = (char*)calloc(frag_len, 1);
         if (!fragments[i]) {
             fprintf(stderr, "[MYFS READ ERROR] Failed to allocate fragment %d buffer (%zu bytes)\n", 
-                    i, fragment_size);
+                    i, frag_len);
             // Clean up
             for (int j = 0; j < i; j++) {
                 free(fragments[j]);
@@ -837,117 +4865,61 @@ static int myfs_read(const char* path, char* buf, size_t size, off_t offset) {
     }
     fprintf(stderr, "[MYFS READ] ✓ Memory allocated successfully\n");
     
-    // Try to read from all nodes
+    // Read the needed data fragments concurrently.  Any k fragments are
+    // enough to rebuild the data, so the other fragments are held back as
+    // hedges and only requested if a needed one is slow or fails.
     fprintf(stderr, "[MYFS READ] Reading fragments from %d nodes...\n", num_nodes);
+    node_op_t ops[MAX_NODES];
     for (int i = 0; i < num_nodes; i++) {
-        request_header_t req;
-        response_header_t resp;
-        
-        // CRITICAL: Initialize response header to avoid garbage values
-        memset(&resp, 0, sizeof(resp));
-        req.type = REQ_READ;
-        strncpy(req.filename, path + 1, sizeof(req.filename) - 1);  // Skip leading '/'
-        req.size = fragment_size;
-        req.offset = 0;  // Always read from start of fragment file
-        req.fragment_id = i;
-        
-        fprintf(stderr, "[MYFS READ] Node %d: Sending read request (file=%s, frag=%u, size=%zu, offset=%ld)...\n",
-                i, req.filename, req.fragment_id, req.size, req.offset);
-        
-        // Lock mutex for thread-safe socket access
-        pthread_mutex_lock(&state->nodes[i].socket_mutex);
-        
-        // Send request (with retry on connection failure)
-        int send_success = 0;
-        for (int retry = 0; retry < 2; retry++) {
-            if (send_all(state->nodes[i].socket_fd, &req, sizeof(req)) == sizeof(req)) {
-                send_success = 1;
-                break;
-            }
-            
-            // Send failed, try to reconnect
-            if (retry == 0) {
-                fprintf(stderr, "[MYFS READ] ⚠ Node %d: Send request failed, attempting reconnect...\n", i);
-                if (reconnect_to_node(i) < 0) {
-                    fprintf(stderr, "[MYFS READ] ✗ Node %d: Reconnect failed\n", i);
-                    break;
-                }
-                // Retry with new connection
-            }
-        }
+        init_node_op(&ops[i], i, REQ_READ, layout_object_name(&layout, path), i, frag_len,
+                     frag_start);
+        ops[i].recv_buf = fragments[i];
+        ops[i].recv_cap = frag_len;
+        ops[i].hedge = !needed[i];
         
-        if (!send_success) {
-            pthread_mutex_unlock(&state->nodes[i].socket_mutex);
-            fprintf(stderr, "[MYFS READ] ✗ Node %d: Failed to send request after retry\n", i);
-            log_msg("Failed to send read request to node %d\n", i);
+        fprintf(stderr, "[MYFS READ] Node %d: %s read request (file=%s, frag=%u, size=%zu, offset=%ld)...\n",
+                i, ops[i].hedge ? "Holding back hedge" : "Sending",
+                ops[i].req.filename, ops[i].req.fragment_id, ops[i].req.size, ops[i].req.offset);
+    }
+    
+    run_node_ops(ops, num_nodes, num_data_fragments);
+    
+    for (int i = 0; i < num_nodes; i++) {
+        if (ops[i].state == NODE_OP_CANCELLED) {
+            fprintf(stderr, "[MYFS READ] Node %d: Not needed (quorum reached)\n", i);
             node_status[i] = 0;
-            continue;
-        }
-        
-        // Receive response
-        if (recv(state->nodes[i].socket_fd, &resp, sizeof(resp), MSG_WAITALL) != sizeof(resp)) {
-            pthread_mutex_unlock(&state->nodes[i].socket_mutex);
-            fprintf(stderr, "[MYFS READ] ✗ Node %d: Failed to receive response (connection lost)\n", i);
-            log_msg("Failed to receive response from node %d\n", i);
+        } else if (ops[i].state != NODE_OP_DONE) {
+            fprintf(stderr, "[MYFS READ] ✗ Node %d: Failed to read fragment (connection lost)\n", i);
+            log_msg("Failed to read fragment from node %d\n", i);
             node_status[i] = 0;
-            continue;
-        }
-        
-        if (resp.status != 0) {
-            pthread_mutex_unlock(&state->nodes[i].socket_mutex);
+        } else if (ops[i].resp.status != 0) {
             fprintf(stderr, "[MYFS READ] ✗ Node %d: Server returned error: status=%d, errno=%d\n", 
-                    i, resp.status, resp.error_code);
-            log_msg("Node %d returned error: status=%d, errno=%d\n", i, resp.status, resp.error_code);
+                    i, ops[i].resp.status, ops[i].resp.error_code);
+            log_msg("Node %d returned error: status=%d, errno=%d\n", i, ops[i].resp.status, ops[i].resp.error_code);
             node_status[i] = 0;
-            continue;
-        }
-        
-        // Receive data
-        fprintf(stderr, "[MYFS READ] Node %d: Receiving data (%zu bytes)...\n", i, resp.size);
-        if (resp.size > 0) {
-            ssize_t received = recv(state->nodes[i].socket_fd, fragments[i], resp.size, MSG_WAITALL);
-            if (received < 0) {
-                // recv error
-                pthread_mutex_unlock(&state->nodes[i].socket_mutex);
-                fprintf(stderr, "[MYFS READ] ✗ Node %d: recv error: %s\n", i, strerror(errno));
-                log_msg("Failed to receive data from node %d: %s\n", i, strerror(errno));
-                node_status[i] = 0;
-                continue;
-            } else if (received != (ssize_t)resp.size) {
-                // Partial recv - connection might be broken
-                pthread_mutex_unlock(&state->nodes[i].socket_mutex);
-                fprintf(stderr, "[MYFS READ] ✗ Node %d: Partial data received (expected %zu, got %zd)\n", 
-                        i, resp.size, received);
-                log_msg("Failed to receive data from node %d (partial)\n", i);
-                node_status[i] = 0;
-                continue;
-            }
+        } else {
+            node_status[i] = 1;
+            fprintf(stderr, "[MYFS READ] ✓ Node %d: Fragment read successfully (%zu bytes)\n", i, ops[i].resp.size);
+            log_msg("Successfully read fragment %d from node %d\n", i, i);
         }
-        
-        // Unlock mutex after successful communication
-        pthread_mutex_unlock(&state->nodes[i].socket_mutex);
-        
-        node_status[i] = 1;
-        fprintf(stderr, "[MYFS READ] ✓ Node %d: Fragment read successfully (%zu bytes)\n", i, resp.size);
-        log_msg("Successfully read fragment %d from node %d\n", i, i);
     }
     
-    // Count successful reads
+    // Count successful reads; only missing needed fragments are rebuilt
     int success_count = 0;
-    int failed_node = -1;
+    int missing_needed = 0;
     for (int i = 0; i < num_nodes; i++) {
         if (node_status[i]) {
             success_count++;
-        } else {
-            failed_node = i;
+        } else if (needed[i]) {
+            missing_needed++;
         }
     }
     
     fprintf(stderr, "[MYFS READ] Successfully read from %d/%d nodes\n", success_count, num_nodes);
     log_msg("[MYFS READ] Successfully read from %d/%d nodes\n", success_count, num_nodes);
     
-    // Need at least n-1 fragments to reconstruct data
-    if (success_count < num_data_fragments) {
+    // Need at least k fragments to reconstruct data
+    if (missing_needed > 0 && success_count < num_data_fragments) {
         fprintf(stderr, "[MYFS READ ERROR] Not enough fragments to reconstruct data\n");
         log_msg("[MYFS READ ERROR] Not enough fragments to reconstruct data\n");
         free(node_status);
@@ -958,163 +4930,44 @@ static int myfs_read(const char* path, char* buf, size_t size, off_t offset) {
         return -EIO;
     }
     
-    // If one node failed, reconstruct its fragment using XOR
-    if (success_count == num_data_fragments && failed_node >= 0) {
-        fprintf(stderr, "[MYFS READ] ⚠ Node %d failed, reconstructing using XOR...\n", failed_node);
-        log_msg("[MYFS READ] Reconstructing fragment %d using XOR\n", failed_node);
-        
-        // Start with all zeros
-        memset(fragments[failed_node], 0, fragment_size);
+    // Rebuild the needed data fragments that could not be read
+    if (missing_needed > 0) {
+        const erasure_codec_t* codec = layout_codec(&layout);
+        fprintf(stderr, "[MYFS READ] ⚠ %d fragment(s) missing, reconstructing using %s...\n",
+                missing_needed, codec->name);
+        log_msg("[MYFS READ] Reconstructing %d fragment(s) using %s\n", missing_needed, codec->name);
         
-        // XOR all other fragments
-        for (int i = 0; i < num_nodes; i++) {
-            if (i != failed_node) {
-                xor_buffers(fragments[failed_node], fragments[i], fragment_size);
+        if (codec->decode(&layout, fragments, node_status, needed, frag_len) < 0) {
+            fprintf(stderr, "[MYFS READ ERROR] Reconstruction failed\n");
+            log_msg("[MYFS READ ERROR] Reconstruction of %s failed\n", path);
+            free(node_status);
+            for (int i = 0; i < num_nodes; i++) {
+                free(fragments[i]);
             }
+            free(fragments);
+            return -EIO;
         }
         
-        fprintf(stderr, "[MYFS READ] ✓ Fragment %d reconstructed successfully\n", failed_node);
-        log_msg("[MYFS READ] Successfully reconstructed fragment %d\n", failed_node);
-    }
-    
-    // Reconstruct data based on caching strategy
-    if (should_cache) {
-        // Small file: cache entire file for subsequent reads
-        cache = get_read_cache(path, 1);
-        if (!cache) {
-            fprintf(stderr, "[MYFS READ ERROR] Failed to get read cache\n");
-            // Continue anyway and just reconstruct for this request
-            memset(buf, 0, bytes_to_read);
-            for (size_t i = 0; i < bytes_to_read; i++) {
-                size_t file_pos = offset + i;
-                int frag_idx = file_pos % num_data_fragments;
-                size_t pos = file_pos / num_data_fragments;
-                buf[i] = fragments[frag_idx][pos];
-            }
-        } else {
-            // Allocate cache buffer for entire file
-            cache->buffer = (char*)malloc(file_size);
-            if (!cache->buffer) {
-                fprintf(stderr, "[MYFS READ ERROR] Failed to allocate cache buffer (%zu bytes)\n", file_size);
-                // Continue without caching
-                memset(buf, 0, bytes_to_read);
-                for (size_t i = 0; i < bytes_to_read; i++) {
-                    size_t file_pos = offset + i;
-                    int frag_idx = file_pos % num_data_fragments;
-                    size_t pos = file_pos / num_data_fragments;
-                    buf[i] = fragments[frag_idx][pos];
-                }
-            } else {
-                // Reconstruct entire file into cache
-                fprintf(stderr, "[MYFS READ] Reconstructing and caching entire file (%zu bytes)...\n", file_size);
-                for (size_t i = 0; i < file_size; i++) {
-                    int frag_idx = i % num_data_fragments;
-                    size_t pos = i / num_data_fragments;
-                    cache->buffer[i] = fragments[frag_idx][pos];
-                }
-                cache->size = file_size;
-                
-                // Now copy requested portion to output buffer
-                memcpy(buf, cache->buffer + offset, bytes_to_read);
-                fprintf(stderr, "[MYFS READ] ✓ File cached! Serving %zu bytes from cache\n", bytes_to_read);
-                log_msg("[MYFS READ] Cached entire file (%zu bytes)\n", file_size);
-            }
-        }
+        fprintf(stderr, "[MYFS READ] ✓ Fragments reconstructed successfully\n");
+        log_msg("[MYFS READ] Successfully reconstructed %d fragment(s)\n", missing_needed);
+    }
+    
+    char* range_buffer = (char*)malloc(range_size);
+    if (!range_buffer) {
+        // Continue without caching and just reconstruct for this request
+        fprintf(stderr, "[MYFS READ ERROR] Failed to allocate cache buffer (%zu bytes)\n", range_size);
+        layout_gather(&layout, buf, fragments, frag_start, frag_len, offset, bytes_to_read);
     } else {
-        // Large file: use readahead window strategy
-        fprintf(stderr, "[MYFS READ] Large file - using readahead window strategy\n");
-        log_msg("[MYFS READ] Using readahead window for large file %s\n", path);
+        fprintf(stderr, "[MYFS READ] Reconstructing and caching %zu bytes...\n", range_size);
+        layout_gather(&layout, range_buffer, fragments, frag_start, frag_len,
+                      range_start, range_size);
+        memcpy(buf, range_buffer + (offset - range_start), bytes_to_read);
         
-        // Get or create readahead window
-        readahead_window_t* window = get_readahead_window(path, 1);
-        if (!window) {
-            fprintf(stderr, "[MYFS READ ERROR] Failed to get readahead window\n");
-            // Fallback: just reconstruct requested data without window
-            memset(buf, 0, bytes_to_read);
-            for (size_t i = 0; i < bytes_to_read; i++) {
-                size_t file_pos = offset + i;
-                int frag_idx = file_pos % num_data_fragments;
-                size_t pos = file_pos / num_data_fragments;
-                buf[i] = fragments[frag_idx][pos];
-            }
-        } else {
-            // Check if we need to reload window (if offset moved outside current window)
-            int need_reload = 0;
-            if (!window->buffer) {
-                // No buffer allocated yet
-                window->buffer = (char*)malloc(READAHEAD_WINDOW_SIZE);
-                if (!window->buffer) {
-                    fprintf(stderr, "[MYFS READ ERROR] Failed to allocate window buffer (%d bytes)\n", 
-                            READAHEAD_WINDOW_SIZE);
-                    // Fallback: just reconstruct requested data
-                    memset(buf, 0, bytes_to_read);
-                    for (size_t i = 0; i < bytes_to_read; i++) {
-                        size_t file_pos = offset + i;
-                        int frag_idx = file_pos % num_data_fragments;
-                        size_t pos = file_pos / num_data_fragments;
-                        buf[i] = fragments[frag_idx][pos];
-                    }
-                    return bytes_to_read;
-                }
-                need_reload = 1;
-            } else if (window->start_offset < 0 || 
-                       offset < window->start_offset || 
-                       offset >= window->start_offset + window->valid_size) {
-                // Current request is outside the existing window
-                need_reload = 1;
-                fprintf(stderr, "[MYFS READ] Window reload needed: offset=%ld not in current window [%ld,%ld]\n",
-                        offset, window->start_offset, window->start_offset + window->valid_size);
-            }
-            
-            if (need_reload) {
-                // Calculate new window range
-                window->start_offset = offset;  // Window starts at current request
-                size_t window_size = READAHEAD_WINDOW_SIZE;
-                
-                // Don't read beyond file end
-                if (window->start_offset + window_size > file_size) {
-                    window_size = file_size - window->start_offset;
-                }
-                window->valid_size = window_size;
-            
-                
-                fprintf(stderr, "[MYFS READ] Loading window [%ld - %ld] (%zu bytes)\n", 
-                        window->start_offset, window->start_offset + window_size, window_size);
-                log_msg("[MYFS READ] Window range: [%ld, %ld], size=%zu\n", 
-                        window->start_offset, window->start_offset + window_size, window_size);
-                
-                // Reconstruct window data from fragments
-                memset(window->buffer, 0, window_size);
-                for (size_t i = 0; i < window_size; i++) {
-                    size_t file_pos = window->start_offset + i;
-                    int frag_idx = file_pos % num_data_fragments;
-                    size_t pos = file_pos / num_data_fragments;
-                    
-                    // Make sure we don't read beyond fragment bounds
-                    if (pos < fragment_size) {
-                        window->buffer[i] = fragments[frag_idx][pos];
-                    }
-                }
-                
-                fprintf(stderr, "[MYFS READ] ✓ Window loaded with %zu bytes\n", window_size);
-            } else {
-                // Window already contains the data we need
-                fprintf(stderr, "[MYFS READ] Using existing window [%ld - %ld]\n", 
-                        window->start_offset, window->start_offset + window->valid_size);
-            }
-            
-            // Now copy requested data from window to output buffer
-            size_t window_offset = offset - window->start_offset;
-            size_t copy_size = bytes_to_read;
-            if (window_offset + copy_size > window->valid_size) {
-                copy_size = window->valid_size - window_offset;  // Safety check
-            }
-            memcpy(buf, window->buffer + window_offset, copy_size);
-            
-            fprintf(stderr, "[MYFS READ] ✓ Served %zu bytes from window at offset %ld\n", 
-                    copy_size, offset);
-            log_msg("[MYFS READ] Served %zu bytes from window\n", copy_size);
-        }
+        // The cache takes ownership of range_buffer
+        read_cache_insert(&st, generation, range_start, range_buffer, range_size);
+        fprintf(stderr, "[MYFS READ] ✓ Cached [%ld - %ld], served %zu bytes\n", 
+                (long)range_start, (long)(range_start + range_size), bytes_to_read);
+        log_msg("[MYFS READ] Cached %zu bytes of %s\n", range_size, path);
     }
     
     fprintf(stderr, "[MYFS READ] ✓ Read complete: %zu bytes (file_size %zu)\n", 
@@ -1131,6 +4984,129 @@ static int myfs_read(const char* path, char* buf, size_t size, off_t offset) {
     return bytes_to_read;  // Return actual bytes read, not requested size
 }
 
+// Cut a file's fragments to new_size on every node.  Only the stripe
+// holding the new end is rewritten, so that its bytes past the end read
+// as zeros and its parity matches; every fragment is then truncated in
+// place, all nodes in parallel.  A file that grows is cut at its old
+// size first, so the new range reads as zeros whatever the fragments
+// held.  Returns 0 or a negative errno.
+static int truncate_fragments(const char* path, off_t new_size) {
+    struct bb_state* state = BB_DATA;
+    int num_nodes = state->num_nodes;
+    char fpath[PATH_MAX];
+    snprintf(fpath, PATH_MAX, "%s%s", state->rootdir, path);
+    
+    struct stat st;
+    if (stat(fpath, &st) < 0) {
+        return -errno;
+    }
+    if (st.st_size == new_size) {
+        return 0;
+    }
+    
+    // Every node must be up: its capabilities are only known from a
+    // connection, and a cut that misses a node would leave the file
+    // half truncated.  Only nodes known to predate REQ_TRUNCATE keep
+    // their fragments, with just the metadata resized.
+    for (int i = 0; i < num_nodes; i++) {
+        if (reconnect_to_node(i) < 0) {
+            fprintf(stderr, "[MYFS TRUNCATE ERROR] Node %d is down, cannot truncate %s\n", i, path);
+            log_msg("[MYFS TRUNCATE ERROR] Node %d down, truncate of %s refused\n", i, path);
+            return -EIO;
+        }
+    }
+    for (int i = 0; i < num_nodes; i++) {
+        if (!(state->nodes[i].capabilities & MYFS_CAP_TRUNCATE)) {
+            fprintf(stderr, "[MYFS TRUNCATE] Node %d cannot truncate, only resizing metadata\n", i);
+            return 0;
+        }
+    }
+    
+    size_t cut = (new_size < st.st_size) ? (size_t)new_size : (size_t)st.st_size;
+    
+    myfs_layout_t layout;
+    int ret = load_file_layout(fpath, num_nodes, &layout);
+    if (ret < 0) {
+        return ret;
+    }
+    
+    fprintf(stderr, "[MYFS TRUNCATE] %s: %ld -> %ld bytes, cutting fragments at file offset %zu\n",
+            path, (long)st.st_size, (long)new_size, cut);
+    log_msg("[MYFS TRUNCATE] %s: %ld -> %ld\n", path, (long)st.st_size, (long)new_size);
+    
+    // Rewrite the stripe the cut falls into, zero padded past the cut
+    size_t width = layout_stripe_width(&layout);
+    size_t stripe_start = cut / width * width;
+    if (cut > stripe_start) {
+        size_t len = cut - stripe_start;
+        char* data = (char*)malloc(len);
+        if (!data) {
+            return -ENOMEM;
+        }
+        int n = myfs_read(path, data, len, stripe_start);
+        if (n == (int)len) {
+            ret = write_stripes(path, &layout, data, stripe_start, len, NULL, 0);
+        } else {
+            ret = (n < 0) ? n : -EIO;
+        }
+        free(data);
+        if (ret < 0) {
+            fprintf(stderr, "[MYFS TRUNCATE ERROR] Rewriting the last stripe failed: %d\n", ret);
+            return ret;
+        }
+    }
+    
+    // Every fragment (parity included) is as long as data fragment 0
+    size_t frag_len = layout_frag_offset(&layout, 0, cut);
+    node_op_t ops[MAX_NODES];
+    for (int i = 0; i < num_nodes; i++) {
+        init_node_op(&ops[i], i, REQ_TRUNCATE, layout_object_name(&layout, path), i, 0, frag_len);
+    }
+    run_node_ops(ops, num_nodes, num_nodes);
+    invalidate_read_cache(path);
+    
+    for (int i = 0; i < num_nodes; i++) {
+        if (ops[i].state != NODE_OP_DONE || ops[i].resp.status != 0) {
+            fprintf(stderr, "[MYFS TRUNCATE ERROR] Node %d: failed to truncate fragment\n", i);
+            log_msg("[MYFS TRUNCATE ERROR] Node %d failed for %s\n", i, path);
+            return (ops[i].state == NODE_OP_DONE && ops[i].resp.error_code) ?
+                   -ops[i].resp.error_code : -EIO;
+        }
+    }
+    return 0;
+}
+
+// Distributed truncate: the file's buffered writes are flushed, its
+// fragments cut and the metadata file resized (through fd unless it is
+// -1), all under the write buffer lock so that a write cannot land
+// between the flush and the cut.  Returns 0 or a negative errno.
+static int myfs_truncate(const char* path, off_t new_size, int fd) {
+    char fpath[PATH_MAX];
+    snprintf(fpath, PATH_MAX, "%s%s", BB_DATA->rootdir, path);
+    
+    write_buffer_t* wb = get_write_buffer(path, 1);
+    if (!wb) {
+        return -ENOMEM;
+    }
+    pthread_mutex_lock(&wb->lock);
+    
+    // The flushed buffer restarts at the next write, from the new size
+    int ret = flush_write_buffer_locked(wb, 0);
+    if (ret >= 0) {
+        ret = truncate_fragments(path, new_size);
+    }
+    if (ret >= 0) {
+        ret = (fd >= 0) ? ftruncate(fd, new_size) : truncate(fpath, new_size);
+        if (ret < 0) {
+            ret = log_error("myfs_truncate truncate");
+        }
+    }
+    
+    pthread_mutex_unlock(&wb->lock);
+    put_write_buffer(wb);
+    return (ret < 0) ? ret : 0;
+}
+
 ///////////////////////////////////////////////////////////
 //
 // Prototypes for all these functions, and the C-style comments,
@@ -1151,6 +5127,10 @@ int bb_getattr(const char *path, struct stat *statbuf)
 	  path, statbuf);
     bb_fullpath(fpath, path);
 
+    // The reclaimer's state is not part of the filesystem
+    if (BB_DATA->num_nodes > 0 && is_internal_path(path))
+	return -ENOENT;
+
     retstat = log_syscall("lstat", lstat(fpath, statbuf), 0);
     
     log_stat(statbuf);
@@ -1243,7 +5223,19 @@ int bb_unlink(const char *path)
 	    path);
     bb_fullpath(fpath, path);
 
-    return log_syscall("unlink", unlink(fpath), 0);
+    // Buffered data of a removed file must not be flushed later, and
+    // its fragments go to the reclaimer once the last link is gone
+    char object[MYFS_OBJECT_ID_LEN + 1] = "";
+    if (BB_DATA->num_nodes > 0) {
+	forget_write_buffer(path);
+	last_link_object(fpath, object);
+    }
+
+    int retstat = log_syscall("unlink", unlink(fpath), 0);
+    if (retstat == 0 && object[0])
+	release_object(fpath, object);
+    
+    return retstat;
 }
 
 /** Remove a directory */
@@ -1286,7 +5278,82 @@ int bb_rename(const char *path, const char *newpath)
     bb_fullpath(fpath, path);
     bb_fullpath(fnewpath, newpath);
 
-    return log_syscall("rename", rename(fpath, fnewpath), 0);
+    if (BB_DATA->num_nodes == 0)
+	return log_syscall("rename", rename(fpath, fnewpath), 0);
+
+    // Renames are serialized.  The buffers of the file, or of every
+    // file in the directory, are locked and written back first (the
+    // rename fails if that does not work), then stay locked while the
+    // rename is made and they move to their new paths, so no write can
+    // land in between.  A file replaced by the rename loses its
+    // fragments and its buffer like an unlinked one.
+    pthread_mutex_lock(&rename_lock);
+    write_buffer_t** bufs = NULL;
+    int n = collect_write_buffers(path, &bufs);
+    if (n < 0) {
+	pthread_mutex_unlock(&rename_lock);
+	return n;
+    }
+    int locked = 0;
+    int retstat = 0;
+    while (locked < n) {
+	write_buffer_t* wb = bufs[locked++];
+	pthread_mutex_lock(&wb->lock);
+	retstat = flush_write_buffer_locked(wb, 0);
+	if (retstat < 0)
+	    break;
+    }
+
+    char object[MYFS_OBJECT_ID_LEN + 1] = "";
+    write_buffer_t* target = NULL;
+    int target_dropped = 0;
+    struct stat from, to;
+    int from_ok = (lstat(fpath, &from) == 0);
+    int to_ok = (lstat(fnewpath, &to) == 0);
+    int same = from_ok && to_ok && from.st_dev == to.st_dev && from.st_ino == to.st_ino;
+    if (retstat >= 0 && to_ok && !same) {
+	last_link_object(fnewpath, object);
+	target = get_write_buffer(newpath, 0);
+	if (target) {
+	    // Nothing of the replaced file may still be on its way out
+	    pthread_mutex_lock(&target->lock);
+	    while (target->sealed_busy)
+		pthread_cond_wait(&target->sealed_done, &target->lock);
+	}
+    }
+
+    if (retstat >= 0) {
+	lock_write_buffer_table();
+	retstat = log_syscall("rename", rename(fpath, fnewpath), 0);
+	if (retstat == 0 && !same) {
+	    if (target && !target->unlinked) {
+		unchain_write_buffer_locked(target);
+		target->unlinked = 1;
+		target_dropped = 1;
+	    }
+	    rekey_write_buffers_locked(bufs, n, path, newpath);
+	}
+	unlock_write_buffer_table();
+    }
+
+    if (target) {
+	pthread_mutex_unlock(&target->lock);
+	if (target_dropped)
+	    put_write_buffer(target);  // The table's reference
+	put_write_buffer(target);
+    }
+    for (int i = 0; i < n; i++) {
+	if (i < locked)
+	    pthread_mutex_unlock(&bufs[i]->lock);
+	put_write_buffer(bufs[i]);
+    }
+    free(bufs);
+    pthread_mutex_unlock(&rename_lock);
+
+    if (retstat == 0 && object[0])
+	release_object(fnewpath, object);
+    
+    return retstat;
 }
 
 /** Create a hard link to a file */
@@ -1336,6 +5403,10 @@ int bb_truncate(const char *path, off_t newsize)
 	    path, newsize);
     bb_fullpath(fpath, path);
 
+    if (BB_DATA->num_nodes > 0) {
+	return myfs_truncate(path, newsize, -1);
+    }
+
     return log_syscall("truncate", truncate(fpath, newsize), 0);
 }
 
@@ -1411,8 +5482,15 @@ int bb_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_
     // no need to get fpath on this one, since I work from fi->fh not the path
     log_fi(fi);
 
-    // Use distributed read if nodes are configured
+    // Use distributed read if nodes are configured.  Buffered writes
+    // (window, sealed stripes, dirty extents) are only seen by the
+    // read once they are on the nodes, so send them first.
     if (BB_DATA->num_nodes > 0) {
+        if (has_unflushed_writes(path)) {
+            retstat = myfs_flush_write_buffer(path);
+            if (retstat < 0)
+                return retstat;
+        }
         return myfs_read(path, buf, size, offset);
     }
     
@@ -1566,6 +5644,8 @@ int bb_release(const char *path, struct fuse_file_info *fi)
         if (ret < 0) {
             log_msg("[MYFS] Final flush on release failed: %d\n", ret);
             // Continue with close even if flush fails
+        } else {
+            release_write_buffer_memory(path);
         }
     }
 
@@ -1587,6 +5667,15 @@ int bb_fsync(const char *path, int datasync, struct fuse_file_info *fi)
 	    path, datasync, fi);
     log_fi(fi);
     
+    // Buffered and in-flight writes must reach the nodes first
+    if (BB_DATA->num_nodes > 0) {
+        int ret = myfs_flush_write_buffer(path);
+        if (ret < 0) {
+            log_msg("[MYFS] Flush on fsync failed: %d\n", ret);
+            return ret;
+        }
+    }
+    
     // some unix-like systems (notably freebsd) don't have a datasync call
 #ifdef HAVE_FDATASYNC
     if (datasync)
@@ -1613,6 +5702,10 @@ int bb_setxattr(const char *path, const char *name, const char *value, size_t si
 	    path, name, value, size, flags);
     bb_fullpath(fpath, path);
 
+    // The stripe layout describes data already on the nodes
+    if (strcmp(name, MYFS_LAYOUT_XATTR) == 0)
+	return -EPERM;
+
     return log_syscall("lsetxattr", lsetxattr(fpath, name, value, size, flags), 0);
 }
 
@@ -1626,6 +5719,18 @@ int bb_getxattr(const char *path, const char *name, char *value, size_t size)
 	    path, name, value, size);
     bb_fullpath(fpath, path);
 
+    // Virtual attribute reporting cache counters, on any path
+    if (BB_DATA->num_nodes > 0 && strcmp(name, MYFS_STATS_XATTR) == 0) {
+	char stats[1024];
+	int len = format_myfs_stats(stats, sizeof(stats));
+	if (size == 0)
+	    return len;
+	if ((size_t) len > size)
+	    return -ERANGE;
+	memcpy(value, stats, len);
+	return len;
+    }
+
     retstat = log_syscall("lgetxattr", lgetxattr(fpath, name, value, size), 0);
     if (retstat >= 0)
 	log_msg("    value = \"%s\"\n", value);
@@ -1667,6 +5772,9 @@ int bb_removexattr(const char *path, const char *name)
 	    path, name);
     bb_fullpath(fpath, path);
 
+    if (strcmp(name, MYFS_LAYOUT_XATTR) == 0)
+	return -EPERM;
+
     return log_syscall("lremovexattr", lremovexattr(fpath, name), 0);
 }
 #endif
@@ -1752,6 +5860,9 @@ int bb_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset
     // returns something non-zero.  The first case just means I've
     // read the whole directory; the second means the buffer is full.
     do {
+	if (BB_DATA->num_nodes > 0 && strcmp(path, "/") == 0 &&
+	    strcmp(de->d_name, MYFS_INTERNAL_DIR + 1) == 0)
+	    continue;
 	log_msg("calling filler with name %s\n", de->d_name);
 	if (filler(buf, de->d_name, NULL, 0) != 0) {
 	    log_msg("    ERROR bb_readdir filler:  buffer full");
@@ -1825,14 +5936,19 @@ void *bb_init(struct fuse_conn_info *conn)
     log_conn(conn);
     log_fuse_context(fuse_get_context());
     
+    select_xor_kernel();
+    select_gf_kernel();
+    
     // Initialize connections to storage nodes
     if (BB_DATA->num_nodes > 0) {
         log_msg("Initializing connections to %d nodes\n", BB_DATA->num_nodes);
         if (init_node_connections() < 0) {
             fprintf(stderr, "Failed to initialize node connections\n");
         } else {
-            log_msg("Successfully connected to all nodes\n");
+            log_msg("Node connections initialized\n");
         }
+        start_flusher(BB_DATA);
+        start_reclaimer(BB_DATA);
     }
     
     return BB_DATA;
@@ -1851,14 +5967,34 @@ void bb_destroy(void *userdata)
     
     struct bb_state* state = (struct bb_state*)userdata;
     if (state && state->num_nodes > 0) {
-        // Clean up mutexes
+        stop_flusher();
+        stop_reclaimer();
+        
+        // Write back every dirty buffer before the connections go away
+        write_buffer_t* wb;
+        while ((wb = find_oldest_dirty_buffer()) != NULL) {
+            pthread_mutex_lock(&wb->lock);
+            int ret = flush_write_buffer_locked(wb, 0);
+            if (ret < 0) {
+                log_msg("[MYFS] Flush of %s on unmount failed: %d\n", wb->path, ret);
+            }
+            pthread_mutex_unlock(&wb->lock);
+            put_write_buffer(wb);
+            if (ret < 0) {
+                break;
+            }
+        }
+        
+        // Close the connections, then clean up mutexes
+        stop_node_io();
         for (int i = 0; i < state->num_nodes; i++) {
             pthread_mutex_destroy(&state->nodes[i].socket_mutex);
-            if (state->nodes[i].socket_fd >= 0) {
-                close(state->nodes[i].socket_fd);
-            }
         }
         pthread_mutex_destroy(&state->nodes_mutex);
+        
+        char stats[1024];
+        format_myfs_stats(stats, sizeof(stats));
+        log_msg("[MYFS] Statistics:\n%s", stats);
     }
 }
 
@@ -1925,6 +6061,10 @@ int bb_ftruncate(const char *path, off_t offset, struct fuse_file_info *fi)
 	    path, offset, fi);
     log_fi(fi);
     
+    if (BB_DATA->num_nodes > 0) {
+	return myfs_truncate(path, offset, fi->fh);
+    }
+    
     retstat = ftruncate(fi->fh, offset);
     if (retstat < 0)
 	retstat = log_error("bb_ftruncate ftruncate");
@@ -2013,7 +6153,18 @@ struct fuse_operations bb_oper = {
 
 void bb_usage()
 {
-    fprintf(stderr, "usage:  bbfs [FUSE and mount options] rootDir mountPoint [host1:port1 host2:port2 ...]\n");
+    fprintf(stderr, "usage:  bbfs [FUSE and mount options] [MYFS options] rootDir mountPoint [host1:port1 host2:port2 ...]\n");
+    fprintf(stderr, "\nMYFS options:\n");
+    fprintf(stderr, "  --cache-mb=N      total read cache budget in MB (default %d)\n",
+	    READ_CACHE_DEFAULT_BYTES / (1024 * 1024));
+    fprintf(stderr, "  --hedge-ms=N      delay before reading parity as a hedge, 0 reads all\n"
+	    "                    fragments up front (default %d)\n", HEDGE_DELAY_DEFAULT_MS);
+    fprintf(stderr, "  --stripe-kb=N     stripe unit of newly written files in KB (default %d)\n",
+	    STRIPE_UNIT_DEFAULT_BYTES / 1024);
+    fprintf(stderr, "  --parity=M        parity fragments of newly written files; 1 is XOR,\n"
+	    "                    more is Reed-Solomon surviving M node losses (default 1)\n");
+    fprintf(stderr, "  --conns=N         connections to each storage node, at most %d (default %d)\n",
+	    MAX_CONNS_PER_NODE, NODE_CONNS_DEFAULT);
     fprintf(stderr, "\nExample:\n");
     fprintf(stderr, "  bbfs rootdir mountdir\n");
     fprintf(stderr, "  bbfs rootdir mountdir 10.0.1.5:8001 10.0.1.6:8002 10.0.1.7:8003\n");
@@ -2058,6 +6209,63 @@ int main(int argc, char *argv[])
     
     // Initialize node count to 0
     bb_data->num_nodes = 0;
+    bb_data->read_cache_bytes = READ_CACHE_DEFAULT_BYTES;
+    bb_data->hedge_delay_ms = HEDGE_DELAY_DEFAULT_MS;
+    bb_data->stripe_unit = STRIPE_UNIT_DEFAULT_BYTES;
+    bb_data->parity_fragments = 1;
+    bb_data->conns_per_node = NODE_CONNS_DEFAULT;
+    
+    // Consume MYFS options (--name=value) so neither FUSE nor the
+    // rootdir/mountpoint/node parsing below sees them
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--hedge-ms=", 11) == 0) {
+            bb_data->hedge_delay_ms = atoi(argv[i] + 11);
+            if (bb_data->hedge_delay_ms < 0) {
+                fprintf(stderr, "Invalid hedge delay: %s\n", argv[i]);
+                bb_usage();
+            }
+            continue;
+        }
+        if (strncmp(argv[i], "--stripe-kb=", 12) == 0) {
+            long kb = atol(argv[i] + 12);
+            if (kb <= 0) {
+                fprintf(stderr, "Invalid stripe unit: %s\n", argv[i]);
+                bb_usage();
+            }
+            bb_data->stripe_unit = (size_t)kb * 1024;
+            continue;
+        }
+        if (strncmp(argv[i], "--parity=", 9) == 0) {
+            bb_data->parity_fragments = atoi(argv[i] + 9);
+            if (bb_data->parity_fragments < 1) {
+                fprintf(stderr, "Invalid parity count: %s\n", argv[i]);
+                bb_usage();
+            }
+            continue;
+        }
+        if (strncmp(argv[i], "--cache-mb=", 11) == 0) {
+            long mb = atol(argv[i] + 11);
+            if (mb <= 0) {
+                fprintf(stderr, "Invalid cache size: %s\n", argv[i]);
+                bb_usage();
+            }
+            bb_data->read_cache_bytes = (size_t)mb * 1024 * 1024;
+            continue;
+        }
+        if (strncmp(argv[i], "--conns=", 8) == 0) {
+            bb_data->conns_per_node = atoi(argv[i] + 8);
+            if (bb_data->conns_per_node < 1 || bb_data->conns_per_node > MAX_CONNS_PER_NODE) {
+                fprintf(stderr, "Invalid connection count: %s\n", argv[i]);
+                bb_usage();
+            }
+            continue;
+        }
+        argv[kept++] = argv[i];
+    }
+    argc = kept;
+    argv[argc] = NULL;
+    fprintf(stderr, "[MYFS] Read cache budget: %zu bytes\n", bb_data->read_cache_bytes);
     
     // Initialize global mutex
     pthread_mutex_init(&bb_data->nodes_mutex, NULL);
@@ -2093,7 +6301,6 @@ int main(int argc, char *argv[])
                     strncpy(bb_data->nodes[bb_data->num_nodes].host, argv[i], host_len);
                     bb_data->nodes[bb_data->num_nodes].host[host_len] = '\0';
                     bb_data->nodes[bb_data->num_nodes].port = atoi(colon + 1);
-                    bb_data->nodes[bb_data->num_nodes].socket_fd = -1;
                     
                     fprintf(stderr, "Node %d: %s:%d\n", bb_data->num_nodes,
                             bb_data->nodes[bb_data->num_nodes].host,
@@ -2107,6 +6314,25 @@ int main(int argc, char *argv[])
     
     fprintf(stderr, "Configured %d storage nodes\n", bb_data->num_nodes);
     
+    // Every file needs at least one data fragment next to its parity
+    int num_data_fragments = bb_data->num_nodes - bb_data->parity_fragments;
+    if (bb_data->num_nodes > 0 && num_data_fragments < 1) {
+        fprintf(stderr, "%d parity fragments need more than %d nodes\n",
+                bb_data->parity_fragments, bb_data->num_nodes);
+        bb_usage();
+    }
+    
+    // A write window must always have room for a partial stripe plus
+    // the incoming write
+    if (bb_data->num_nodes > 0 &&
+        bb_data->stripe_unit * num_data_fragments > WRITE_BUFFER_CAPACITY / 4) {
+        fprintf(stderr, "Stripe unit too large: a stripe of %d units must fit in %d KB\n",
+                num_data_fragments, WRITE_BUFFER_CAPACITY / 4 / 1024);
+        bb_usage();
+    }
+    fprintf(stderr, "[MYFS] New files: %d+%d fragments, stripe unit %zu bytes\n",
+            num_data_fragments, bb_data->parity_fragments, bb_data->stripe_unit);
+    
     // Find rootdir and mountpoint
     int rootdir_idx = -1, mountpoint_idx = -1;
     for (int i = 1; i < argc; i++) {
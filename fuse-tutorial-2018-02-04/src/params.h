@@ -24,15 +24,17 @@
 #include <limits.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <stdint.h>
 
 #define MAX_NODES 10
+#define MAX_CONNS_PER_NODE 8     // Largest connection pool per node
 
 // Node information
 typedef struct {
     char host[256];
     int port;
-    int socket_fd;
-    pthread_mutex_t socket_mutex;  // Mutex for thread-safe socket access
+    uint32_t capabilities;         // Protocol capabilities agreed at connect
+    pthread_mutex_t socket_mutex;  // Serializes connecting to the node
 } node_info_t;
 
 struct bb_state {
@@ -41,6 +43,11 @@ struct bb_state {
     int num_nodes;              // Number of storage nodes
     node_info_t nodes[MAX_NODES]; // Node information array
     pthread_mutex_t nodes_mutex;    // Global mutex for nodes operations
+    size_t read_cache_bytes;        // Total read cache budget (--cache-mb)
+    int hedge_delay_ms;             // Delay before hedging reads (--hedge-ms)
+    size_t stripe_unit;             // Stripe unit of newly written files (--stripe-kb)
+    int parity_fragments;           // Parity fragments of newly written files (--parity)
+    int conns_per_node;             // Connections to each storage node (--conns)
 };
 #define BB_DATA ((struct bb_state *) fuse_get_context()->private_data)
 
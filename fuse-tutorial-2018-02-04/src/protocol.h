@@ -8,6 +8,8 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
 
 // Maximum data size per request (1 MiB)
 #define MAX_CHUNK_SIZE (1024 * 1024)
@@ -17,7 +19,11 @@
 typedef enum {
     REQ_WRITE = 1,
     REQ_READ = 2,
-    REQ_DELETE = 3
+    REQ_DELETE = 3,
+    REQ_READV = 4,            // Batch of reads (v2, MYFS_CAP_VECTOR)
+    REQ_WRITEV = 5,           // Batch of writes (v2, MYFS_CAP_VECTOR)
+    REQ_TRUNCATE = 6,         // Cut a fragment to `offset` bytes (MYFS_CAP_TRUNCATE)
+    REQ_DELETEV = 7           // Batch of deletes (MYFS_CAP_DELETEV)
 } request_type_t;
 
 // Request header structure
@@ -36,5 +42,223 @@ typedef struct {
     int error_code;           // errno if error occurred
 } response_header_t;
 
+// Protocol v2
+//
+// The structs above (v1) are sent in host layout, padding included,
+// with a fixed 256-byte name.  v2 uses fixed-width little-endian
+// fields instead.  A v2 client opens each connection with a
+// myfs_hello_t and the server answers with its own, carrying the
+// capabilities both sides support.  After that every request is a
+// myfs_request_t followed by name_len bytes of fragment name (no
+// terminator), and every response a myfs_response_t followed by any
+// data.  Responses echo the request_id of their request; with
+// MYFS_CAP_MULTIPLEX they may arrive in any order, and a client may
+// have up to the server's `credits` requests outstanding.  A
+// connection whose first four bytes are not MYFS_MAGIC is served as
+// v1.
+//
+// REQ_READV and REQ_WRITEV carry no name.  Their header's fragment_id
+// is the number of extents, offset the length of the extent table and
+// size the length of the data after it (0 for READV).  The table is a
+// myfs_extent_t per extent, each followed by its name; WRITEV data is
+// the extents' bytes back to back.  The response data starts with a
+// myfs_extent_result_t per extent, followed for READV by the bytes
+// read for each extent back to back.  The response status only fails
+// for the batch as a whole; extents fail individually.
+//
+// REQ_DELETEV is laid out like REQ_READV, with offset and size 0 in
+// every extent, and its response carries only the result table.  A
+// fragment that does not exist counts as deleted, so a batch can be
+// sent again until every extent succeeds.
+
+#define MYFS_MAGIC 0x3253594d          // "MYS2" on the wire
+#define MYFS_PROTOCOL_VERSION 2
+#define MYFS_MAX_NAME_LEN 255          // Longest fragment name (fits request_header_t)
+
+// Capability bits
+#define MYFS_CAP_MULTIPLEX 0x1         // Requests served concurrently, answered out of order
+#define MYFS_CAP_VECTOR 0x2            // REQ_READV / REQ_WRITEV
+#define MYFS_CAP_TRUNCATE 0x4          // REQ_TRUNCATE; a write at offset 0 no longer truncates
+#define MYFS_CAP_DELETEV 0x8           // REQ_DELETEV
+
+// Bits this build supports
+#define MYFS_CAPABILITIES (MYFS_CAP_MULTIPLEX | MYFS_CAP_VECTOR | MYFS_CAP_TRUNCATE | \
+                           MYFS_CAP_DELETEV)
+
+#define MYFS_MAX_EXTENTS 64            // Extents in one batch
+#define MYFS_MAX_BATCH_DATA MAX_CHUNK_SIZE  // Data bytes in one batch
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;           // MYFS_MAGIC
+    uint16_t version;         // MYFS_PROTOCOL_VERSION
+    uint16_t credits;         // Requests the server takes in flight (0 from a client)
+    uint32_t capabilities;    // MYFS_CAP_* bits
+} myfs_hello_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;             // request_type_t
+    uint8_t flags;            // Reserved, 0
+    uint16_t name_len;        // Name bytes following the header
+    uint32_t fragment_id;
+    uint32_t request_id;      // Echoed in the response
+    uint64_t offset;
+    uint64_t size;
+} myfs_request_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t request_id;
+    int32_t status;
+    int32_t error_code;
+    uint64_t size;
+} myfs_response_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t fragment_id;
+    uint16_t name_len;        // Name bytes following the extent
+    uint16_t flags;           // Reserved, 0
+    uint64_t offset;
+    uint64_t size;
+} myfs_extent_t;
+
+typedef struct __attribute__((packed)) {
+    int32_t status;           // 0 = success, -1 = error
+    int32_t error_code;       // errno if the extent failed
+    uint64_t size;            // Bytes read or written
+} myfs_extent_result_t;
+
+// Largest extent table of a batch
+#define MYFS_MAX_EXTENT_TABLE (MYFS_MAX_EXTENTS * (sizeof(myfs_extent_t) + MYFS_MAX_NAME_LEN))
+
+// Largest v2 request header, name included
+#define MYFS_REQUEST_MAX (sizeof(myfs_request_t) + MYFS_MAX_NAME_LEN)
+
+// Little-endian field access, independent of host byte order
+static inline void myfs_put_le(void* field, uint64_t value, size_t bytes) {
+    unsigned char* p = (unsigned char*)field;
+    for (size_t i = 0; i < bytes; i++) {
+        p[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static inline uint64_t myfs_get_le(const void* field, size_t bytes) {
+    const unsigned char* p = (const unsigned char*)field;
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; i++) {
+        value |= (uint64_t)p[i] << (8 * i);
+    }
+    return value;
+}
+
+#define MYFS_PUT(field, value) myfs_put_le(&(field), (value), sizeof(field))
+#define MYFS_GET(field) myfs_get_le(&(field), sizeof(field))
+
+static inline void myfs_encode_hello(myfs_hello_t* hello, uint32_t capabilities,
+                                     uint16_t credits) {
+    MYFS_PUT(hello->magic, MYFS_MAGIC);
+    MYFS_PUT(hello->version, MYFS_PROTOCOL_VERSION);
+    MYFS_PUT(hello->credits, credits);
+    MYFS_PUT(hello->capabilities, capabilities);
+}
+
+// Encode a request into `out` (MYFS_REQUEST_MAX bytes), returns its length
+static inline size_t myfs_encode_request(const request_header_t* req, uint32_t request_id,
+                                         char* out) {
+    myfs_request_t wire;
+    size_t name_len = 0;
+    while (name_len < MYFS_MAX_NAME_LEN && req->filename[name_len]) {
+        name_len++;
+    }
+    
+    wire.type = (uint8_t)req->type;
+    wire.flags = 0;
+    MYFS_PUT(wire.name_len, name_len);
+    MYFS_PUT(wire.fragment_id, req->fragment_id);
+    MYFS_PUT(wire.request_id, request_id);
+    MYFS_PUT(wire.offset, (uint64_t)req->offset);
+    MYFS_PUT(wire.size, req->size);
+    memcpy(out, &wire, sizeof(wire));
+    memcpy(out + sizeof(wire), req->filename, name_len);
+    return sizeof(wire) + name_len;
+}
+
+// Decode a request header and its name (name_len bytes at `name`)
+static inline void myfs_decode_request(const myfs_request_t* wire, const char* name,
+                                       request_header_t* req) {
+    memset(req, 0, sizeof(*req));
+    req->type = (request_type_t)wire->type;
+    memcpy(req->filename, name, MYFS_GET(wire->name_len));
+    req->fragment_id = (uint32_t)MYFS_GET(wire->fragment_id);
+    req->offset = (off_t)MYFS_GET(wire->offset);
+    req->size = (size_t)MYFS_GET(wire->size);
+}
+
+static inline void myfs_encode_response(const response_header_t* resp, uint32_t request_id,
+                                        myfs_response_t* wire) {
+    MYFS_PUT(wire->request_id, request_id);
+    MYFS_PUT(wire->status, (uint32_t)resp->status);
+    MYFS_PUT(wire->error_code, (uint32_t)resp->error_code);
+    MYFS_PUT(wire->size, resp->size);
+}
+
+static inline void myfs_decode_response(const myfs_response_t* wire, response_header_t* resp) {
+    resp->status = (int32_t)(uint32_t)MYFS_GET(wire->status);
+    resp->error_code = (int32_t)(uint32_t)MYFS_GET(wire->error_code);
+    resp->size = (size_t)MYFS_GET(wire->size);
+}
+
+// Append an extent to a batch's table at `out`, returns the bytes added
+static inline size_t myfs_encode_extent(const char* name, uint32_t fragment_id, uint64_t offset,
+                                        uint64_t size, char* out) {
+    myfs_extent_t wire;
+    size_t name_len = 0;
+    while (name_len < MYFS_MAX_NAME_LEN && name[name_len]) {
+        name_len++;
+    }
+    
+    MYFS_PUT(wire.fragment_id, fragment_id);
+    MYFS_PUT(wire.name_len, name_len);
+    MYFS_PUT(wire.flags, 0);
+    MYFS_PUT(wire.offset, offset);
+    MYFS_PUT(wire.size, size);
+    memcpy(out, &wire, sizeof(wire));
+    memcpy(out + sizeof(wire), name, name_len);
+    return sizeof(wire) + name_len;
+}
+
+// Decode the extent at `in` (`avail` table bytes left) into `req`,
+// returns the bytes consumed or 0 if the table is malformed
+static inline size_t myfs_decode_extent(const char* in, size_t avail, request_header_t* req) {
+    myfs_extent_t wire;
+    if (avail < sizeof(wire)) {
+        return 0;
+    }
+    memcpy(&wire, in, sizeof(wire));
+    size_t name_len = MYFS_GET(wire.name_len);
+    if (name_len == 0 || name_len > MYFS_MAX_NAME_LEN || avail - sizeof(wire) < name_len) {
+        return 0;
+    }
+    
+    memset(req, 0, sizeof(*req));
+    memcpy(req->filename, in + sizeof(wire), name_len);
+    req->fragment_id = (uint32_t)MYFS_GET(wire.fragment_id);
+    req->offset = (off_t)MYFS_GET(wire.offset);
+    req->size = (size_t)MYFS_GET(wire.size);
+    return sizeof(wire) + name_len;
+}
+
+static inline void myfs_encode_extent_result(const response_header_t* result,
+                                             myfs_extent_result_t* wire) {
+    MYFS_PUT(wire->status, (uint32_t)result->status);
+    MYFS_PUT(wire->error_code, (uint32_t)result->error_code);
+    MYFS_PUT(wire->size, result->size);
+}
+
+static inline void myfs_decode_extent_result(const myfs_extent_result_t* wire,
+                                             response_header_t* result) {
+    result->status = (int32_t)(uint32_t)MYFS_GET(wire->status);
+    result->error_code = (int32_t)(uint32_t)MYFS_GET(wire->error_code);
+    result->size = (size_t)MYFS_GET(wire->size);
+}
+
 #endif
 
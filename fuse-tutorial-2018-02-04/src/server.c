@@ -3,6 +3,8 @@
   Each storage node runs this server to handle read/write requests
 */
 
+#define _GNU_SOURCE  // splice(), pipe2(), accept4(), F_SETPIPE_SZ
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,11 +16,42 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/epoll.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <pthread.h>
 #include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+// io_uring is driven through raw syscalls, so only the kernel header is needed
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
 
 #include "protocol.h"
 
+#define SENDFILE_MAX_CHUNK (4 * 1024 * 1024)   // Bytes per sendfile() call
+#define SPLICE_MAX_CHUNK (1024 * 1024)         // Bytes per splice() of a write payload
+#define IO_BUFFER_SIZE MAX_CHUNK_SIZE          // Pooled buffer for copied payloads
+#define IO_POOL_MAX_BYTES (64 * 1024 * 1024)   // Cap on pooled buffer memory
+#define MAX_EVENTS 256                         // epoll events handled per wakeup
+#define MIN_WORKERS 2                          // Disk workers on single-CPU machines
+#define CLIENT_IO_TIMEOUT_SECS 30              // Drop a client stalled mid-request
+#define CLIENT_CREDITS 64                      // Requests a v2 client may keep in flight
+#define BENCH_DEFAULT_MB 256                   // Data per worker in --bench mode
+#define FD_CACHE_CAPACITY 1024                 // Fragment files kept open, at most
+#define FD_CACHE_SHARDS 16                     // Independently locked fd cache shards
+#define FD_CACHE_BUCKETS 64                    // Hash buckets per shard
+
 // Global storage directory
 char storage_dir[PATH_MAX];
 
@@ -41,240 +74,2092 @@ static ssize_t send_all(int sockfd, const void* buf, size_t len) {
     return total_sent;
 }
 
-// Function to handle client request
-void* handle_client(void* arg) {
-    int client_sock = *(int*)arg;
-    free(arg);
+// Receive exactly len bytes (handles partial receives)
+static ssize_t recv_all(int sockfd, void* buf, size_t len) {
+    size_t total_received = 0;
+    char* ptr = (char*)buf;
     
-    request_header_t req;
-    response_header_t resp;
-    // Initialize response to avoid sending garbage
-    memset(&resp, 0, sizeof(resp));
-    char filepath[PATH_MAX];
-    char* data_buffer = NULL;
+    while (total_received < len) {
+        ssize_t n = recv(sockfd, ptr + total_received, len - total_received, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;  // Interrupted, retry
+            return -1;  // Error
+        }
+        if (n == 0) {
+            return -1;  // Connection closed
+        }
+        total_received += n;
+    }
+    return total_received;
+}
+
+// Send a gathered buffer list in full (handles partial sends)
+static int send_iov_all(int sockfd, struct iovec* iov, int iovcnt) {
+    while (iovcnt > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        ssize_t sent = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;  // Interrupted, retry
+            return -1;
+        }
+        while (iovcnt > 0 && (size_t)sent >= iov->iov_len) {
+            sent -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + sent;
+            iov->iov_len -= sent;
+        }
+    }
+    return 0;
+}
+
+// Pool of IO_BUFFER_SIZE buffers for payload data that has to be
+// copied through userspace.  Buffers are allocated on first use and
+// recycled, and no more than IO_POOL_MAX_BYTES are ever handed out: a
+// request needing one beyond that waits until another is returned,
+// which holds back its connection instead of growing the heap.  Each
+// request holds at most one buffer at a time, so waiting cannot
+// deadlock.
+typedef struct io_buffer {
+    struct io_buffer* next;  // Free list link, only while pooled
+} io_buffer_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t available;
+    io_buffer_t* free_list;
+    size_t allocated;        // Buffers currently allocated
+    size_t limit;            // Most buffers allowed at once
+} io_pool = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0,
+    IO_POOL_MAX_BYTES / IO_BUFFER_SIZE
+};
+
+// Take a buffer from the pool, waiting while the cap is reached.
+// Returns NULL only if a new buffer cannot be allocated.
+static char* io_buffer_get(void) {
+    pthread_mutex_lock(&io_pool.lock);
+    while (!io_pool.free_list && io_pool.allocated >= io_pool.limit) {
+        pthread_cond_wait(&io_pool.available, &io_pool.lock);
+    }
+    io_buffer_t* buf = io_pool.free_list;
+    if (buf) {
+        io_pool.free_list = buf->next;
+        pthread_mutex_unlock(&io_pool.lock);
+        return (char*)buf;
+    }
+    io_pool.allocated++;
+    pthread_mutex_unlock(&io_pool.lock);
     
-    while (1) {
-        // Read request header
-        ssize_t n = recv(client_sock, &req, sizeof(req), MSG_WAITALL);
-        if (n <= 0) {
-            if (n < 0) perror("recv request header");
-            break;
+    buf = (io_buffer_t*)malloc(IO_BUFFER_SIZE);
+    if (!buf) {
+        perror("malloc I/O buffer");
+        pthread_mutex_lock(&io_pool.lock);
+        io_pool.allocated--;
+        pthread_cond_signal(&io_pool.available);
+        pthread_mutex_unlock(&io_pool.lock);
+    }
+    return (char*)buf;
+}
+
+// Return a buffer obtained from io_buffer_get()
+static void io_buffer_put(char* data) {
+    io_buffer_t* buf = (io_buffer_t*)data;
+    pthread_mutex_lock(&io_pool.lock);
+    buf->next = io_pool.free_list;
+    io_pool.free_list = buf;
+    pthread_cond_signal(&io_pool.available);
+    pthread_mutex_unlock(&io_pool.lock);
+}
+
+// Send `len` bytes of a file starting at `offset`.  Uses sendfile() so
+// the data goes from the page cache to the socket without a userspace
+// copy, and falls back to pread()/send() through a pooled buffer where
+// sendfile() is not supported.  Returns the bytes sent, or -1 on error.
+static ssize_t send_file_range(int sockfd, int fd, off_t offset, size_t len) {
+    size_t total_sent = 0;
+    
+    while (total_sent < len) {
+        size_t chunk = len - total_sent;
+        if (chunk > SENDFILE_MAX_CHUNK) {
+            chunk = SENDFILE_MAX_CHUNK;
         }
-        
-        // Build file path
-        snprintf(filepath, PATH_MAX, "%s/%s.frag%u", storage_dir, req.filename, req.fragment_id);
-        
-        printf("[Server] Request type=%d, file=%s, size=%zu, offset=%ld\n", 
-               req.type, filepath, req.size, req.offset);
-        
-        // Always reset response for each request
-        memset(&resp, 0, sizeof(resp));
-        
-        if (req.type == REQ_WRITE) {
-            // Allocate buffer for data
-            data_buffer = (char*)malloc(req.size);
-            if (!data_buffer) {
-                resp.status = -1;
-                resp.error_code = ENOMEM;
-                resp.size = 0;
-                send_all(client_sock, &resp, sizeof(resp));
-                continue;
+        off_t pos = offset + total_sent;
+        ssize_t sent = sendfile(sockfd, fd, &pos, chunk);
+        if (sent < 0) {
+            if (errno == EINTR) continue;  // Interrupted, retry
+            if ((errno == EINVAL || errno == ENOSYS) && total_sent == 0) {
+                break;  // Not supported for this file, copy instead
             }
-            
-            // Receive data
-            n = recv(client_sock, data_buffer, req.size, MSG_WAITALL);
-            if (n != (ssize_t)req.size) {
-                perror("recv data");
-                resp.status = -1;
-                resp.error_code = errno;
-                resp.size = 0;
-                send_all(client_sock, &resp, sizeof(resp));
-                free(data_buffer);
-                continue;
+            return -1;  // Error
+        }
+        if (sent == 0) {
+            return total_sent;  // File ended early
+        }
+        total_sent += sent;
+    }
+    
+    if (total_sent < len) {
+        char* buf = io_buffer_get();
+        if (!buf) {
+            return -1;
+        }
+        while (total_sent < len) {
+            size_t chunk = len - total_sent;
+            if (chunk > IO_BUFFER_SIZE) {
+                chunk = IO_BUFFER_SIZE;
             }
-            
-            // Open/create file
-            // Use O_TRUNC when offset is 0 to ensure we start fresh
-            int flags = O_WRONLY | O_CREAT;
-            if (req.offset == 0) {
-                flags |= O_TRUNC;  // Clear file when writing from beginning
+            ssize_t n = pread(fd, buf, chunk, offset + total_sent);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                io_buffer_put(buf);
+                return -1;
             }
-            int fd = open(filepath, flags, 0644);
-            if (fd < 0) {
-                perror("open file for write");
-                resp.status = -1;
-                resp.error_code = errno;
-                resp.size = 0;
-                send_all(client_sock, &resp, sizeof(resp));
-                free(data_buffer);
-                continue;
+            if (n == 0) {
+                break;  // File ended early
             }
-            
-            // Write data at offset
-            ssize_t written = pwrite(fd, data_buffer, req.size, req.offset);
-            close(fd);
-            free(data_buffer);
-            
-            if (written != (ssize_t)req.size) {
-                perror("pwrite");
-                resp.status = -1;
-                resp.error_code = errno;
-                resp.size = 0;
-            } else {
-                resp.status = 0;
-                resp.error_code = 0;
-                resp.size = written;
+            if (send_all(sockfd, buf, n) < 0) {
+                io_buffer_put(buf);
+                return -1;
             }
-            
-            send_all(client_sock, &resp, sizeof(resp));
-            
-        } else if (req.type == REQ_READ) {
-            // Open file
-            int fd = open(filepath, O_RDONLY);
-            if (fd < 0) {
-                perror("open file for read");
-                resp.status = -1;
-                resp.error_code = errno;
-                resp.size = 0;
-                send_all(client_sock, &resp, sizeof(resp));
-                continue;
+            total_sent += n;
+        }
+        io_buffer_put(buf);
+    }
+    return total_sent;
+}
+
+static int fd_cache_trim(void);
+
+// Create the pipe a connection splices write payloads through, sized
+// to SPLICE_MAX_CHUNK where the kernel allows.  Leaves pipefd at -1 if
+// no pipe is available, in which case payloads are copied.
+static void open_splice_pipe(int pipefd[2]) {
+    int ret = pipe2(pipefd, O_CLOEXEC);
+    if (ret < 0 && (errno == EMFILE || errno == ENFILE) && fd_cache_trim() > 0) {
+        ret = pipe2(pipefd, O_CLOEXEC);
+    }
+    if (ret < 0) {
+        perror("pipe2");
+        pipefd[0] = pipefd[1] = -1;
+        return;
+    }
+    fcntl(pipefd[1], F_SETPIPE_SZ, SPLICE_MAX_CHUNK);  // Best effort
+}
+
+// Move `len` bytes sitting in the pipe to the file at `offset` by
+// copying them, or just discard them once a file write has failed
+static int copy_pipe_to_file(int pipe_out, size_t len, int fd, off_t offset, int* file_errno) {
+    char* buf = io_buffer_get();
+    if (!buf) {
+        return -1;
+    }
+    
+    while (len > 0) {
+        ssize_t n = read(pipe_out, buf, len < IO_BUFFER_SIZE ? len : IO_BUFFER_SIZE);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            io_buffer_put(buf);
+            return -1;
+        }
+        if (n == 0) {
+            io_buffer_put(buf);
+            return -1;
+        }
+        if (*file_errno == 0) {
+            ssize_t written = pwrite(fd, buf, n, offset);
+            if (written != n) {
+                *file_errno = (written < 0) ? errno : EIO;
             }
-            
-            // Allocate buffer
-            data_buffer = (char*)malloc(req.size);
-            if (!data_buffer) {
-                resp.status = -1;
-                resp.error_code = ENOMEM;
-                resp.size = 0;
-                send_all(client_sock, &resp, sizeof(resp));
-                close(fd);
-                continue;
+        }
+        offset += n;
+        len -= n;
+    }
+    io_buffer_put(buf);
+    return 0;
+}
+
+// Receive a `len` byte request payload from the socket into a file at
+// `offset`.  Data moves socket -> pipe -> file with splice() in chunks
+// of at most SPLICE_MAX_CHUNK, so it never passes through userspace
+// and no buffer proportional to the request is needed.  Without a
+// pipe, or where splice() is not supported, it is copied through a
+// pooled buffer instead.  The whole payload is always consumed so the
+// connection stays in sync: a failed file write (or fd < 0) is
+// reported through *file_errno.  Returns 0, or -1 if the connection
+// failed.
+static int recv_file_range(int sockfd, int pipefd[2], int fd, off_t offset, size_t len, int* file_errno) {
+    char* buf = NULL;  // Taken from the pool once copying starts
+    int use_splice = (pipefd[0] >= 0 && fd >= 0);
+    size_t done = 0;
+    
+    if (fd < 0 && *file_errno == 0) {
+        *file_errno = EBADF;
+    }
+    
+    while (done < len) {
+        size_t chunk = len - done;
+        
+        if (use_splice && *file_errno == 0) {
+            if (chunk > SPLICE_MAX_CHUNK) {
+                chunk = SPLICE_MAX_CHUNK;
             }
-            
-            // Read data at offset
-            ssize_t nread = pread(fd, data_buffer, req.size, req.offset);
-            close(fd);
-            
-            if (nread < 0) {
-                perror("pread");
-                resp.status = -1;
-                resp.error_code = errno;
-                resp.size = 0;
-                send_all(client_sock, &resp, sizeof(resp));
-                free(data_buffer);
-                continue;
+            ssize_t in = splice(sockfd, NULL, pipefd[1], NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (in < 0) {
+                if (errno == EINTR) continue;  // Interrupted, retry
+                if (errno == EINVAL && done == 0) {
+                    use_splice = 0;  // Not supported here, copy instead
+                    continue;
+                }
+                return -1;
             }
-            
-            // Send response
-            resp.status = 0;
-            resp.error_code = 0;
-            resp.size = nread;
-            send_all(client_sock, &resp, sizeof(resp));
-            
-            // Send data
-            if (nread > 0) {
-                send_all(client_sock, data_buffer, nread);
+            if (in == 0) {
+                return -1;  // Connection closed
             }
             
-            free(data_buffer);
-            
-        } else if (req.type == REQ_DELETE) {
-            // Delete file
-            if (unlink(filepath) < 0) {
-                perror("unlink");
-                resp.status = -1;
-                resp.error_code = errno;
-            } else {
-                resp.status = 0;
-                resp.error_code = 0;
+            // Drain the pipe into the file
+            size_t left = in;
+            while (left > 0) {
+                off_t pos = offset + done;
+                ssize_t out = splice(pipefd[0], NULL, fd, &pos, left, SPLICE_F_MOVE);
+                if (out < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (out <= 0) {
+                    // The file refuses splice (or the write failed):
+                    // copy or discard what is already in the pipe
+                    if (out < 0 && errno == EINVAL) {
+                        use_splice = 0;
+                    } else {
+                        *file_errno = (out < 0) ? errno : EIO;
+                    }
+                    if (copy_pipe_to_file(pipefd[0], left, fd, offset + done, file_errno) < 0) {
+                        return -1;
+                    }
+                    out = left;
+                }
+                left -= out;
+                done += out;
             }
-            resp.size = 0;
-            send_all(client_sock, &resp, sizeof(resp));
+            continue;
+        }
+        
+        // Copy path, also used to discard the payload after an error
+        if (!buf && !(buf = io_buffer_get())) {
+            return -1;
+        }
+        if (chunk > IO_BUFFER_SIZE) {
+            chunk = IO_BUFFER_SIZE;
+        }
+        ssize_t n = recv(sockfd, buf, chunk, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;  // Interrupted, retry
+            io_buffer_put(buf);
+            return -1;
         }
+        if (n == 0) {
+            io_buffer_put(buf);
+            return -1;  // Connection closed
+        }
+        if (*file_errno == 0) {
+            ssize_t written = pwrite(fd, buf, n, offset + done);
+            if (written != n) {
+                *file_errno = (written < 0) ? errno : EIO;
+            }
+        }
+        done += n;
+    }
+    if (buf) {
+        io_buffer_put(buf);
+    }
+    return 0;
+}
+
+// Cache of open fragment files, so back-to-back requests on the same
+// fragment skip the path lookup and open()/close().  Entries are keyed
+// by fragment path, spread over independently locked shards, each
+// with its own LRU list and a share of fd_cache_capacity.  An entry
+// in use holds a reference; evicted or invalidated entries close
+// their fd once the last user is done.
+typedef struct fd_entry {
+    char* path;
+    int fd;                      // Opened O_RDWR
+    int refcount;                // Shard reference + requests using it
+    struct fd_entry* hash_next;
+    struct fd_entry* lru_prev;   // Towards most recently used
+    struct fd_entry* lru_next;   // Towards least recently used
+} fd_entry_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    fd_entry_t* buckets[FD_CACHE_BUCKETS];
+    fd_entry_t* lru_head;
+    fd_entry_t* lru_tail;
+    int count;
+    unsigned long generation;    // Bumped by every invalidation
+} fd_cache_shard_t;
+
+static fd_cache_shard_t fd_cache[FD_CACHE_SHARDS];
+static int fd_cache_capacity = FD_CACHE_CAPACITY;
+
+// Raise the open file limit as far as we may, and let the cache use at
+// most half of it: the rest is for client sockets, splice pipes and
+// files opened outside the cache
+static void init_fd_cache(void) {
+    for (int i = 0; i < FD_CACHE_SHARDS; i++) {
+        memset(&fd_cache[i], 0, sizeof(fd_cache_shard_t));
+        pthread_mutex_init(&fd_cache[i].lock, NULL);
     }
     
-    close(client_sock);
-    printf("[Server] Client disconnected\n");
-    return NULL;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) {
+        perror("getrlimit");
+        return;
+    }
+    if (rl.rlim_cur < rl.rlim_max) {
+        rlim_t soft = rl.rlim_cur;
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0) {
+            rl.rlim_cur = soft;  // Best effort
+        }
+    }
+    if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur / 2 < FD_CACHE_CAPACITY) {
+        fd_cache_capacity = (int)(rl.rlim_cur / 2);
+        if (fd_cache_capacity < FD_CACHE_SHARDS) {
+            fd_cache_capacity = FD_CACHE_SHARDS;
+        }
+    }
+    printf("[Server] Open file limit %lld, caching up to %d fragment files\n",
+           rl.rlim_cur == RLIM_INFINITY ? -1LL : (long long)rl.rlim_cur, fd_cache_capacity);
 }
 
-int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <port> <storage_dir>\n", argv[0]);
-        return 1;
+// FNV-1a hash of a fragment path
+static unsigned int hash_path(const char* path) {
+    unsigned int h = 2166136261u;
+    for (const unsigned char* p = (const unsigned char*)path; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void fd_entry_release(fd_entry_t* e) {
+    close(e->fd);
+    free(e->path);
+    free(e);
+}
+
+// Unlink an entry from its shard.  Called with the shard lock held;
+// returns 1 if the caller must release it (no users left).
+static int fd_cache_unlink_locked(fd_cache_shard_t* shard, fd_entry_t* e) {
+    fd_entry_t** link = &shard->buckets[hash_path(e->path) % FD_CACHE_BUCKETS];
+    while (*link != e) {
+        link = &(*link)->hash_next;
     }
+    *link = e->hash_next;
     
-    int port = atoi(argv[1]);
-    strncpy(storage_dir, argv[2], PATH_MAX - 1);
+    if (e->lru_prev) {
+        e->lru_prev->lru_next = e->lru_next;
+    } else {
+        shard->lru_head = e->lru_next;
+    }
+    if (e->lru_next) {
+        e->lru_next->lru_prev = e->lru_prev;
+    } else {
+        shard->lru_tail = e->lru_prev;
+    }
+    shard->count--;
+    return --e->refcount == 0;
+}
+
+static fd_entry_t* fd_cache_find_locked(fd_cache_shard_t* shard, const char* path) {
+    fd_entry_t* e = shard->buckets[hash_path(path) % FD_CACHE_BUCKETS];
+    while (e && strcmp(e->path, path) != 0) {
+        e = e->hash_next;
+    }
+    return e;
+}
+
+// Move an entry to the most recently used end of its shard's LRU list
+static void fd_cache_touch_locked(fd_cache_shard_t* shard, fd_entry_t* e) {
+    if (shard->lru_head == e) {
+        return;
+    }
+    e->lru_prev->lru_next = e->lru_next;
+    if (e->lru_next) {
+        e->lru_next->lru_prev = e->lru_prev;
+    } else {
+        shard->lru_tail = e->lru_prev;
+    }
+    e->lru_prev = NULL;
+    e->lru_next = shard->lru_head;
+    shard->lru_head->lru_prev = e;
+    shard->lru_head = e;
+}
+
+// Get an open fd for a fragment file, creating the file if `create`
+// is set.  Returns the entry with a reference held (release it with
+// fd_cache_put()), or NULL with errno set.
+static fd_entry_t* fd_cache_get(const char* path, int create) {
+    fd_cache_shard_t* shard = &fd_cache[hash_path(path) % FD_CACHE_SHARDS];
     
-    // Create storage directory if not exists
-    mkdir(storage_dir, 0755);
+    pthread_mutex_lock(&shard->lock);
+    fd_entry_t* e = fd_cache_find_locked(shard, path);
+    if (e) {
+        fd_cache_touch_locked(shard, e);
+        e->refcount++;
+        pthread_mutex_unlock(&shard->lock);
+        return e;
+    }
+    unsigned long generation = shard->generation;
+    pthread_mutex_unlock(&shard->lock);
     
-    printf("[Server] Starting on port %d, storage dir: %s\n", port, storage_dir);
+    // Miss: open outside the lock.  Out of descriptors, close the idle
+    // cached files and try again.
+    int fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0644);
+    if (fd < 0 && (errno == EMFILE || errno == ENFILE) && fd_cache_trim() > 0) {
+        fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0644);
+    }
+    if (fd < 0) {
+        return NULL;
+    }
+    e = (fd_entry_t*)calloc(1, sizeof(fd_entry_t));
+    if (e) {
+        e->path = strdup(path);
+    }
+    if (!e || !e->path) {
+        if (e) {
+            free(e);
+        }
+        close(fd);
+        errno = ENOMEM;
+        return NULL;
+    }
+    e->fd = fd;
+    e->refcount = 1;  // Our reference
     
-    // Create socket
-    int server_sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_sock < 0) {
-        perror("socket");
-        return 1;
+    pthread_mutex_lock(&shard->lock);
+    fd_entry_t* existing = fd_cache_find_locked(shard, path);
+    if (existing) {
+        // Another request opened it meanwhile
+        fd_cache_touch_locked(shard, existing);
+        existing->refcount++;
+        pthread_mutex_unlock(&shard->lock);
+        fd_entry_release(e);
+        return existing;
+    }
+    if (shard->generation != generation) {
+        // A delete ran while we opened: the fd may name the removed
+        // file, so use it for this request only
+        pthread_mutex_unlock(&shard->lock);
+        return e;
     }
     
-    // Set socket option to reuse address
-    int opt = 1;
-    setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    e->refcount++;  // Reference held by the shard
+    unsigned int bucket = hash_path(path) % FD_CACHE_BUCKETS;
+    e->hash_next = shard->buckets[bucket];
+    shard->buckets[bucket] = e;
+    e->lru_next = shard->lru_head;
+    if (shard->lru_head) {
+        shard->lru_head->lru_prev = e;
+    } else {
+        shard->lru_tail = e;
+    }
+    shard->lru_head = e;
+    shard->count++;
     
-    // Bind
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(port);
+    // Evict the least recently used entries beyond this shard's share
+    fd_entry_t* evicted = NULL;
+    while (shard->count > fd_cache_capacity / FD_CACHE_SHARDS) {
+        fd_entry_t* victim = shard->lru_tail;
+        if (fd_cache_unlink_locked(shard, victim)) {
+            victim->hash_next = evicted;
+            evicted = victim;
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
     
-    if (bind(server_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        perror("bind");
-        close(server_sock);
-        return 1;
+    while (evicted) {
+        fd_entry_t* next = evicted->hash_next;
+        fd_entry_release(evicted);
+        evicted = next;
     }
+    return e;
+}
+
+// Drop a reference obtained from fd_cache_get()
+static void fd_cache_put(fd_entry_t* e) {
+    fd_cache_shard_t* shard = &fd_cache[hash_path(e->path) % FD_CACHE_SHARDS];
+    pthread_mutex_lock(&shard->lock);
+    int last = (--e->refcount == 0);
+    pthread_mutex_unlock(&shard->lock);
     
-    // Listen
-    if (listen(server_sock, 10) < 0) {
-        perror("listen");
-        close(server_sock);
-        return 1;
+    if (last) {
+        fd_entry_release(e);
     }
+}
+
+// Forget a fragment file (called when it is deleted)
+static void fd_cache_invalidate(const char* path) {
+    fd_cache_shard_t* shard = &fd_cache[hash_path(path) % FD_CACHE_SHARDS];
+    pthread_mutex_lock(&shard->lock);
+    shard->generation++;
+    fd_entry_t* e = fd_cache_find_locked(shard, path);
+    int last = e ? fd_cache_unlink_locked(shard, e) : 0;
+    pthread_mutex_unlock(&shard->lock);
     
-    printf("[Server] Listening on port %d...\n", port);
+    if (last) {
+        fd_entry_release(e);
+    }
+}
+
+// Close every cached file no request is using, to free descriptors
+// when the process runs out.  Returns the number closed.
+static int fd_cache_trim(void) {
+    int closed = 0;
     
-    // Accept connections
-    while (1) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
+    for (int i = 0; i < FD_CACHE_SHARDS; i++) {
+        fd_cache_shard_t* shard = &fd_cache[i];
+        fd_entry_t* idle = NULL;
         
-        int* client_sock = malloc(sizeof(int));
-        *client_sock = accept(server_sock, (struct sockaddr*)&client_addr, &client_len);
+        pthread_mutex_lock(&shard->lock);
+        fd_entry_t* e = shard->lru_head;
+        while (e) {
+            fd_entry_t* next = e->lru_next;
+            if (e->refcount == 1 && fd_cache_unlink_locked(shard, e)) {
+                e->hash_next = idle;
+                idle = e;
+            }
+            e = next;
+        }
+        pthread_mutex_unlock(&shard->lock);
         
-        if (*client_sock < 0) {
-            perror("accept");
-            free(client_sock);
+        while (idle) {
+            fd_entry_t* next = idle->hash_next;
+            fd_entry_release(idle);
+            idle = next;
+            closed++;
+        }
+    }
+    if (closed > 0) {
+        printf("[Server] Out of file descriptors, closed %d cached files\n", closed);
+    }
+    return closed;
+}
+
+// A disk worker.  Workers are numbered so the io_uring backend can
+// give each one its own registered buffers and fixed file slot.
+typedef struct {
+    int index;
+    pthread_mutex_t lock;        // Guards completions of this worker's I/O
+    pthread_cond_t cond;
+} worker_t;
+
+// Storage backend: moves fragment bytes between a file and a client
+// socket for the READ and WRITE paths
+typedef struct {
+    const char* name;
+    // Send `len` bytes of the file at `offset`; returns bytes sent or -1
+    ssize_t (*send_range)(worker_t* w, int sockfd, int fd, off_t offset, size_t len);
+    // Store a `len` byte payload at `offset` (see recv_file_range)
+    int (*recv_range)(worker_t* w, int sockfd, int pipefd[2], int fd, off_t offset, size_t len,
+                      int* file_errno);
+} storage_backend_t;
+
+// Synchronous backend: sendfile() and splice() on the worker thread
+static ssize_t sync_send_range(worker_t* w, int sockfd, int fd, off_t offset, size_t len) {
+    (void)w;
+    return send_file_range(sockfd, fd, offset, len);
+}
+
+static int sync_recv_range(worker_t* w, int sockfd, int pipefd[2], int fd, off_t offset, size_t len,
+                           int* file_errno) {
+    (void)w;
+    return recv_file_range(sockfd, pipefd, fd, offset, len, file_errno);
+}
+
+static const storage_backend_t sync_backend = { "sync", sync_send_range, sync_recv_range };
+
+// Backend used by the workers (--io=)
+static const storage_backend_t* backend = &sync_backend;
+
+#ifdef HAVE_IO_URING
+// io_uring backend.  All workers share one ring: each queues its
+// reads/writes and submits them under sq_lock, together with whatever
+// other workers queued meanwhile.  A reaper
+// thread collects completions and wakes the owning worker.  Every
+// worker has URING_DEPTH registered buffers, so a read keeps that many
+// chunks of the file in flight while it sends the oldest one.  Write
+// payloads are spliced from the socket into the file like the sync
+// backend does; the buffers only carry them where no pipe is
+// available.  Files are passed as plain fds, so a request needs no
+// registration syscall.  Raw syscalls are used so liburing is not
+// needed.
+
+#define URING_BUFFER_SIZE (256 * 1024)   // Each registered buffer
+#define URING_DEPTH 4                    // Buffers (ops in flight) per worker
+#define URING_MIN_ENTRIES 64             // Smallest submission queue
+
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    pthread_mutex_t sq_lock;     // Serializes filling and submitting entries
+    int broken;                  // Submission failed for good, use sync I/O
+    char* buffers;               // Registered buffers, URING_DEPTH per worker
+} uring_t;
+
+static uring_t uring = { .fd = -1 };
+
+// One read or write in flight, completed by the reaper
+typedef struct {
+    worker_t* worker;
+    size_t len;                  // Bytes asked for
+    int done;
+    int res;                     // Bytes transferred or -errno
+} uring_op_t;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static char* uring_buffer(worker_t* w, int slot) {
+    return uring.buffers + ((size_t)w->index * URING_DEPTH + slot) * URING_BUFFER_SIZE;
+}
+
+// Collect completions and wake the workers waiting for them
+static void* uring_reaper(void* arg) {
+    (void)arg;
+    
+    while (1) {
+        if (sys_io_uring_enter(uring.fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            perror("io_uring_enter");
+            sleep(1);
             continue;
         }
         
-        printf("[Server] Client connected from %s:%d\n", 
-               inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+        unsigned head = *uring.cq_head;
+        unsigned tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe* cqe = &uring.cqes[head & *uring.cq_mask];
+            uring_op_t* op = (uring_op_t*)(uintptr_t)cqe->user_data;
+            int res = cqe->res;
+            head++;
+            
+            worker_t* w = op->worker;
+            pthread_mutex_lock(&w->lock);
+            op->res = res;
+            op->done = 1;  // op may be gone once the lock is dropped
+            pthread_cond_broadcast(&w->cond);
+            pthread_mutex_unlock(&w->lock);
+        }
+        __atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// Queue a fixed-buffer read or write of fd and submit it together with
+// anything else pending.  Returns 0, or -1 if the ring cannot submit:
+// it is then marked broken so the entry left in it is never submitted,
+// and the caller carries on with synchronous I/O.
+static int uring_submit(worker_t* w, uint8_t opcode, int fd, int slot, size_t len, off_t offset,
+                        uring_op_t* op) {
+    op->worker = w;
+    op->len = len;
+    op->done = 0;
+    op->res = 0;
+    
+    pthread_mutex_lock(&uring.sq_lock);
+    if (uring.broken) {
+        pthread_mutex_unlock(&uring.sq_lock);
+        return -1;
+    }
+    unsigned tail = *uring.sq_tail;
+    unsigned index = tail & *uring.sq_mask;
+    struct io_uring_sqe* sqe = &uring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)uring_buffer(w, slot);
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->buf_index = w->index * URING_DEPTH + slot;
+    sqe->user_data = (uintptr_t)op;
+    uring.sq_array[index] = index;
+    __atomic_store_n(uring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    
+    // Each worker has at most URING_DEPTH ops in flight and the ring
+    // is sized for that, so submission only fails transiently unless
+    // the ring itself is unusable
+    int ret = 0;
+    while (sys_io_uring_enter(uring.fd, uring.entries, 0, 0) < 0) {
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            perror("io_uring_enter");
+            fprintf(stderr, "[Server] io_uring submission failed, using synchronous I/O\n");
+            uring.broken = 1;
+            ret = -1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&uring.sq_lock);
+    return ret;
+}
+
+static int uring_wait(uring_op_t* op) {
+    worker_t* w = op->worker;
+    pthread_mutex_lock(&w->lock);
+    while (!op->done) {
+        pthread_cond_wait(&w->cond, &w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return op->res;
+}
+
+static ssize_t uring_send_range(worker_t* w, int sockfd, int fd, off_t offset, size_t len) {
+    uring_op_t ops[URING_DEPTH];
+    size_t queued = 0;           // Bytes whose read has been submitted
+    size_t sent = 0;
+    int head = 0;                // Oldest op, the next to send
+    int in_flight = 0;
+    int failed = 0;
+    int eof = 0;
+    
+    while (1) {
+        // Keep reading ahead while the socket drains
+        while (!failed && !eof && in_flight < URING_DEPTH && queued < len) {
+            int slot = (head + in_flight) % URING_DEPTH;
+            size_t chunk = len - queued < URING_BUFFER_SIZE ? len - queued : URING_BUFFER_SIZE;
+            if (uring_submit(w, IORING_OP_READ_FIXED, fd, slot, chunk, offset + queued,
+                             &ops[slot]) < 0) {
+                break;
+            }
+            queued += chunk;
+            in_flight++;
+        }
+        if (in_flight == 0) {
+            break;
+        }
         
-        // Create thread to handle client
-        pthread_t thread;
-        if (pthread_create(&thread, NULL, handle_client, client_sock) != 0) {
-            perror("pthread_create");
-            close(*client_sock);
-            free(client_sock);
+        int slot = head;
+        int res = uring_wait(&ops[slot]);
+        head = (head + 1) % URING_DEPTH;
+        in_flight--;
+        if (failed || eof) {
+            continue;  // Just collecting what is still in flight
+        }
+        if (res < 0) {
+            errno = -res;
+            failed = 1;
             continue;
         }
-        
-        pthread_detach(thread);
+        if (res > 0 && send_all(sockfd, uring_buffer(w, slot), res) < 0) {
+            failed = 1;
+            continue;
+        }
+        sent += res;
+        if (res == 0) {
+            eof = 1;  // File ended early
+        } else if ((size_t)res < ops[slot].len) {
+            // Short read: the chunks read ahead are no longer
+            // contiguous, collect them and read on from here
+            while (in_flight > 0) {
+                uring_wait(&ops[head]);
+                head = (head + 1) % URING_DEPTH;
+                in_flight--;
+            }
+            queued = sent;
+        }
     }
     
-    close(server_sock);
-    return 0;
+    if (failed) {
+        return -1;
+    }
+    if (!eof && sent < len) {
+        // The ring stopped taking submissions
+        ssize_t rest = send_file_range(sockfd, fd, offset + sent, len - sent);
+        return rest < 0 ? -1 : (ssize_t)(sent + rest);
+    }
+    return sent;
+}
+
+// Record the outcome of a chunk write on *file_errno
+static void uring_finish_write(uring_op_t* op, int* file_errno) {
+    int res = uring_wait(op);
+    if (res != (int)op->len && *file_errno == 0) {
+        *file_errno = (res < 0) ? -res : EIO;
+    }
 }
 
+static int uring_recv_range(worker_t* w, int sockfd, int pipefd[2], int fd, off_t offset, size_t len,
+                            int* file_errno) {
+    if (pipefd[0] >= 0) {
+        return recv_file_range(sockfd, pipefd, fd, offset, len, file_errno);
+    }
+    if (fd < 0 && *file_errno == 0) {
+        *file_errno = EBADF;
+    }
+    
+    uring_op_t ops[URING_DEPTH];
+    int in_flight[URING_DEPTH] = { 0 };
+    size_t done = 0;
+    int ret = 0;
+    int cur = 0;
+    
+    while (done < len) {
+        size_t chunk = len - done;
+        if (chunk > URING_BUFFER_SIZE) {
+            chunk = URING_BUFFER_SIZE;
+        }
+        
+        // The buffer may still be on its way to the file
+        if (in_flight[cur]) {
+            uring_finish_write(&ops[cur], file_errno);
+            in_flight[cur] = 0;
+        }
+        
+        // Receive the next chunk while the previous ones are written;
+        // after a write error the rest of the payload is discarded
+        char* buf = uring_buffer(w, cur);
+        if (recv_all(sockfd, buf, chunk) < 0) {
+            ret = -1;
+            break;
+        }
+        if (*file_errno == 0) {
+            if (uring_submit(w, IORING_OP_WRITE_FIXED, fd, cur, chunk, offset + done, &ops[cur]) == 0) {
+                in_flight[cur] = 1;
+            } else {
+                ssize_t written = pwrite(fd, buf, chunk, offset + done);
+                if (written != (ssize_t)chunk) {
+                    *file_errno = (written < 0) ? errno : EIO;
+                }
+            }
+        }
+        done += chunk;
+        cur = (cur + 1) % URING_DEPTH;
+    }
+    
+    for (int i = 0; i < URING_DEPTH; i++) {
+        if (in_flight[i]) {
+            uring_finish_write(&ops[i], file_errno);
+        }
+    }
+    return ret;
+}
+
+static const storage_backend_t uring_backend = { "io_uring", uring_send_range, uring_recv_range };
+
+// Set up the shared ring for `nworkers` workers.  Returns -1 (with the
+// reason printed) if io_uring is unavailable here.
+static int uring_init(int nworkers) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    
+    unsigned entries = URING_MIN_ENTRIES;
+    while (entries < (unsigned)nworkers * URING_DEPTH) {
+        entries *= 2;
+    }
+    
+    uring.fd = sys_io_uring_setup(entries, &p);
+    if (uring.fd < 0) {
+        perror("io_uring_setup");
+        return -1;
+    }
+    uring.entries = p.sq_entries;
+    
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_size = cq_size = (sq_size > cq_size) ? sq_size : cq_size;
+    }
+    
+    char* sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    uring.fd, IORING_OFF_SQ_RING);
+    char* cq = sq;
+    if (sq != MAP_FAILED && !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  uring.fd, IORING_OFF_CQ_RING);
+    }
+    void* sqes = MAP_FAILED;
+    if (sq != MAP_FAILED && cq != MAP_FAILED) {
+        sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQES);
+    }
+    if (sqes == MAP_FAILED) {
+        perror("mmap io_uring");
+        close(uring.fd);  // Also releases the mappings made so far
+        uring.fd = -1;
+        return -1;
+    }
+    
+    uring.sq_head = (unsigned*)(sq + p.sq_off.head);
+    uring.sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    uring.sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    uring.sq_array = (unsigned*)(sq + p.sq_off.array);
+    uring.sqes = (struct io_uring_sqe*)sqes;
+    uring.cq_head = (unsigned*)(cq + p.cq_off.head);
+    uring.cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    uring.cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    uring.cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    pthread_mutex_init(&uring.sq_lock, NULL);
+    
+    // Registered buffers, URING_DEPTH per worker
+    size_t nbuffers = (size_t)nworkers * URING_DEPTH;
+    uring.buffers = mmap(NULL, nbuffers * URING_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    struct iovec* iov = calloc(nbuffers, sizeof(struct iovec));
+    int ok = (uring.buffers != MAP_FAILED && iov);
+    if (ok) {
+        for (size_t i = 0; i < nbuffers; i++) {
+            iov[i].iov_base = uring.buffers + i * URING_BUFFER_SIZE;
+            iov[i].iov_len = URING_BUFFER_SIZE;
+        }
+        if (sys_io_uring_register(uring.fd, IORING_REGISTER_BUFFERS, iov, nbuffers) < 0) {
+            perror("io_uring register buffers");
+            ok = 0;
+        }
+    }
+    free(iov);
+    
+    pthread_t reaper;
+    if (ok && pthread_create(&reaper, NULL, uring_reaper, NULL) != 0) {
+        perror("pthread_create");
+        ok = 0;
+    }
+    if (!ok) {
+        if (uring.buffers != MAP_FAILED) {
+            munmap(uring.buffers, nbuffers * URING_BUFFER_SIZE);
+        }
+        close(uring.fd);
+        uring.fd = -1;
+        return -1;
+    }
+    pthread_detach(reaper);
+    
+    printf("[Server] io_uring ready: %u entries, %zu registered buffers of %d KB\n",
+           uring.entries, nbuffers, URING_BUFFER_SIZE / 1024);
+    return 0;
+}
+#endif
+
+// Pick the storage backend by name for `nworkers` workers.  io_uring
+// falls back to the synchronous backend where it cannot be used.
+static void select_backend(const char* name, int nworkers) {
+    backend = &sync_backend;
+    if (strcmp(name, "uring") == 0) {
+#ifdef HAVE_IO_URING
+        if (uring_init(nworkers) == 0) {
+            backend = &uring_backend;
+        } else {
+            fprintf(stderr, "[Server] io_uring unavailable, using synchronous I/O\n");
+        }
+#else
+        (void)nworkers;
+        fprintf(stderr, "[Server] Built without io_uring, using synchronous I/O\n");
+#endif
+    } else if (strcmp(name, "sync") != 0) {
+        fprintf(stderr, "[Server] Unknown I/O backend '%s', using synchronous I/O\n", name);
+    }
+}
+
+// One client connection.  Its input side belongs to the reactor while
+// waiting for a request header, then to the worker the request goes
+// to until that worker has consumed the payload.  On a multiplexed
+// connection the worker hands the input back at that point, so more
+// requests are read and served while it works on the response;
+// responses are serialized by send_lock.  The connection is freed
+// when its last reference goes.
+typedef struct {
+    int sock;
+    int version;                 // Protocol version, 0 until the first bytes arrive
+    uint32_t capabilities;       // MYFS_CAP_* bits agreed with a v2 client
+    int refs;                    // Input side + requests being served
+    pthread_mutex_t send_lock;   // Held while a response is written
+    request_header_t req;        // Request being received
+    uint32_t request_id;         // Its id (v2)
+    union {                      // Header bytes as they arrive
+        myfs_hello_t hello;
+        request_header_t v1;
+        char v2[MYFS_REQUEST_MAX];
+    } wire;
+    size_t header_received;      // Bytes of wire received so far
+    int pipefd[2];               // Splice pipe, created on the first write
+} connection_t;
+
+// A batch request read in full, waiting for a disk worker
+typedef struct {
+    size_t count;
+    request_header_t extents[MYFS_MAX_EXTENTS];
+    char* data;                  // Pooled buffer: WRITEV payload or READV data
+} received_batch_t;
+
+// Requests ready to be served, handed from the reactor to the threads.
+// An item holds a reference to its connection.
+typedef struct work_item {
+    connection_t* conn;
+    request_header_t req;
+    uint32_t request_id;
+    int input_released;          // Input given back to the reactor
+    received_batch_t* batch;     // Set once a batch has been received
+    struct work_item* next;
+} work_item_t;
+
+typedef struct {
+    work_item_t* head;
+    work_item_t* tail;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} work_queue_t;
+
+// Requests carrying a payload (writes and batches) go to the receive
+// threads, which own the socket until the payload is in; everything
+// else, and the disk part of a batch, goes to the disk workers.  A
+// client stalling mid-payload ties up a receive thread, never a disk
+// worker.
+static work_queue_t recv_queue = { NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+static work_queue_t disk_queue = { NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+// epoll instance of the reactor
+static int epfd = -1;
+
+// Drop a reference to a connection; the last one closes it
+static void put_connection(connection_t* conn) {
+    if (__atomic_sub_fetch(&conn->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+    if (conn->pipefd[0] >= 0) {
+        close(conn->pipefd[0]);
+        close(conn->pipefd[1]);
+    }
+    close(conn->sock);  // Also removes it from the epoll set
+    pthread_mutex_destroy(&conn->send_lock);
+    free(conn);
+    printf("[Server] Client disconnected\n");
+}
+
+// Wait for the next request header on a connection.  One-shot: after
+// an event the input side belongs to whoever handles it until re-armed.
+static int arm_connection(connection_t* conn, int add) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+    ev.data.ptr = conn;
+    return epoll_ctl(epfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, conn->sock, &ev);
+}
+
+// Is `type` a batch request on this connection?
+static int is_batch_request(const connection_t* conn, int type) {
+    if (type == REQ_READV || type == REQ_WRITEV) {
+        return (conn->capabilities & MYFS_CAP_VECTOR) != 0;
+    }
+    return type == REQ_DELETEV && (conn->capabilities & MYFS_CAP_DELETEV);
+}
+
+static void push_work(work_queue_t* queue, work_item_t* item) {
+    item->next = NULL;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail) {
+        queue->tail->next = item;
+    } else {
+        queue->head = item;
+    }
+    queue->tail = item;
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static work_item_t* pop_work(work_queue_t* queue) {
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->head) {
+        pthread_cond_wait(&queue->cond, &queue->lock);
+    }
+    work_item_t* item = queue->head;
+    queue->head = item->next;
+    if (!queue->head) {
+        queue->tail = NULL;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return item;
+}
+
+// Queue the request whose header was just read
+static void queue_work(connection_t* conn) {
+    work_item_t* item = (work_item_t*)malloc(sizeof(work_item_t));
+    if (!item) {
+        put_connection(conn);
+        return;
+    }
+    item->conn = conn;
+    item->req = conn->req;
+    item->request_id = conn->request_id;
+    item->input_released = 0;
+    item->batch = NULL;
+    __atomic_add_fetch(&conn->refs, 1, __ATOMIC_RELAXED);
+    
+    int payload = (conn->req.type == REQ_WRITE || is_batch_request(conn, conn->req.type));
+    push_work(payload ? &recv_queue : &disk_queue, item);
+}
+
+// Give a multiplexed connection's input back to the reactor once the
+// request has been read in full, so the next request can be served
+// while this one is still being answered
+static void release_input(work_item_t* item) {
+    connection_t* conn = item->conn;
+    if (!(conn->capabilities & MYFS_CAP_MULTIPLEX)) {
+        return;
+    }
+    item->input_released = 1;
+    conn->header_received = 0;
+    if (arm_connection(conn, 0) < 0) {
+        perror("epoll_ctl");
+        shutdown(conn->sock, SHUT_RDWR);
+        put_connection(conn);
+    }
+}
+
+// Send a response header in the connection's protocol version.  The
+// caller holds conn->send_lock.
+static int send_response(work_item_t* item, const response_header_t* resp) {
+    connection_t* conn = item->conn;
+    if (conn->version == 2) {
+        myfs_response_t wire;
+        myfs_encode_response(resp, item->request_id, &wire);
+        return send_all(conn->sock, &wire, sizeof(wire)) < 0 ? -1 : 0;
+    }
+    return send_all(conn->sock, resp, sizeof(*resp)) < 0 ? -1 : 0;
+}
+
+// Send a complete response that carries no data
+static int respond(work_item_t* item, const response_header_t* resp) {
+    pthread_mutex_lock(&item->conn->send_lock);
+    int ret = send_response(item, resp);
+    pthread_mutex_unlock(&item->conn->send_lock);
+    return ret;
+}
+
+// Write one extent of a REQ_WRITEV, with the semantics of REQ_WRITE
+static void write_extent(const char* filepath, const request_header_t* extent, const char* src,
+                         int truncate_at_zero, response_header_t* result) {
+    fd_entry_t* file = fd_cache_get(filepath, 1);
+    if (!file) {
+        result->status = -1;
+        result->error_code = errno;
+        perror("open file for write");
+        return;
+    }
+    
+    size_t done = 0;
+    if (truncate_at_zero && extent->offset == 0 && ftruncate(file->fd, 0) < 0) {
+        result->status = -1;
+        result->error_code = errno;
+        perror("ftruncate");
+    }
+    while (result->status == 0 && done < extent->size) {
+        ssize_t n = pwrite(file->fd, src + done, extent->size - done, extent->offset + done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            result->status = -1;
+            result->error_code = errno;
+            perror("pwrite");
+        }
+        done += (n > 0) ? n : 0;
+    }
+    result->size = done;
+    fd_cache_put(file);
+}
+
+// Read one extent of a REQ_READV into dest, stopping at end of file
+static void read_extent(const char* filepath, const request_header_t* extent, char* dest,
+                        response_header_t* result) {
+    fd_entry_t* file = fd_cache_get(filepath, 0);
+    if (!file) {
+        result->status = -1;
+        result->error_code = errno;
+        return;
+    }
+    
+    size_t done = 0;
+    while (done < extent->size) {
+        ssize_t n = pread(file->fd, dest + done, extent->size - done, extent->offset + done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            result->status = -1;
+            result->error_code = errno;
+            perror("pread");
+            done = 0;
+            break;
+        }
+        if (n == 0) {
+            break;  // End of the fragment
+        }
+        done += n;
+    }
+    result->size = done;
+    fd_cache_put(file);
+}
+
+// Delete one fragment of a REQ_DELETEV; one that is already gone counts
+static void delete_extent(const char* filepath, response_header_t* result) {
+    int ret = unlink(filepath);
+    int err = errno;
+    fd_cache_invalidate(filepath);
+    if (ret < 0 && err != ENOENT) {
+        errno = err;
+        perror("unlink");
+        result->status = -1;
+        result->error_code = err;
+    }
+}
+
+// Read the extent table (and the data of a REQ_WRITEV) of a batch into
+// item->batch, on a receive thread.  Returns 0, or -1 to close the
+// connection.
+static int receive_batch(work_item_t* item) {
+    connection_t* conn = item->conn;
+    const request_header_t* batch = &item->req;
+    size_t count = batch->fragment_id;
+    size_t table_len = (size_t)batch->offset;
+    size_t data_len = batch->size;
+    
+    printf("[Server] Batch type=%d, %zu extents, table=%zu, data=%zu\n",
+           batch->type, count, table_len, data_len);
+    
+    // A malformed batch leaves the stream position unknown: drop the connection
+    if (count == 0 || count > MYFS_MAX_EXTENTS || batch->offset < 0 ||
+        table_len > MYFS_MAX_EXTENT_TABLE || data_len > MYFS_MAX_BATCH_DATA ||
+        (batch->type != REQ_WRITEV && data_len != 0)) {
+        fprintf(stderr, "[Server] Malformed batch request\n");
+        return -1;
+    }
+    char table[MYFS_MAX_EXTENT_TABLE];
+    if (recv_all(conn->sock, table, table_len) < 0) {
+        perror("recv extent table");
+        return -1;
+    }
+    received_batch_t* received = (received_batch_t*)malloc(sizeof(received_batch_t));
+    if (!received) {
+        perror("malloc batch");
+        return -1;
+    }
+    request_header_t* extents = received->extents;
+    size_t pos = 0;
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t n = myfs_decode_extent(table + pos, table_len - pos, &extents[i]);
+        if (n == 0 || extents[i].size > MYFS_MAX_BATCH_DATA || extents[i].offset < 0 ||
+            (batch->type == REQ_DELETEV && extents[i].size != 0)) {
+            fprintf(stderr, "[Server] Malformed extent %zu in batch\n", i);
+            free(received);
+            return -1;
+        }
+        pos += n;
+        total += extents[i].size;
+    }
+    if (pos != table_len || total > MYFS_MAX_BATCH_DATA ||
+        (batch->type == REQ_WRITEV && total != data_len)) {
+        fprintf(stderr, "[Server] Batch extents do not add up\n");
+        free(received);
+        return -1;
+    }
+    
+    char* data = io_buffer_get();
+    if (!data) {
+        free(received);
+        return -1;
+    }
+    if (batch->type == REQ_WRITEV && recv_all(conn->sock, data, data_len) < 0) {
+        perror("recv batch data");
+        io_buffer_put(data);
+        free(received);
+        return -1;
+    }
+    received->count = count;
+    received->data = data;
+    item->batch = received;
+    release_input(item);
+    return 0;
+}
+
+// Serve a batch received by receive_batch(), on a disk worker.
+// Extents go through one pooled buffer with pread()/pwrite(), and the
+// whole response (header, result table and data) leaves in one
+// gathered sendmsg().  Returns 0 to keep the connection, -1 to close
+// it.
+static int serve_batch(work_item_t* item) {
+    connection_t* conn = item->conn;
+    const request_header_t* batch = &item->req;
+    size_t count = item->batch->count;
+    const request_header_t* extents = item->batch->extents;
+    char* data = item->batch->data;
+    
+    myfs_extent_result_t results[MYFS_MAX_EXTENTS];
+    size_t at = 0;  // Position in data
+    for (size_t i = 0; i < count; i++) {
+        char filepath[PATH_MAX];
+        response_header_t result;
+        memset(&result, 0, sizeof(result));
+        if (snprintf(filepath, PATH_MAX, "%s/%s.frag%u", storage_dir, extents[i].filename,
+                     extents[i].fragment_id) >= PATH_MAX) {
+            // The extent is refused, the rest of the batch goes on
+            result.status = -1;
+            result.error_code = ENAMETOOLONG;
+            if (batch->type == REQ_WRITEV) {
+                at += extents[i].size;
+            }
+        } else if (batch->type == REQ_WRITEV) {
+            write_extent(filepath, &extents[i], data + at, !(conn->capabilities & MYFS_CAP_TRUNCATE),
+                         &result);
+            at += extents[i].size;
+        } else if (batch->type == REQ_DELETEV) {
+            delete_extent(filepath, &result);
+        } else {
+            read_extent(filepath, &extents[i], data + at, &result);
+            at += result.size;
+        }
+        myfs_encode_extent_result(&result, &results[i]);
+    }
+    
+    response_header_t resp;
+    memset(&resp, 0, sizeof(resp));
+    resp.size = count * sizeof(myfs_extent_result_t) + (batch->type == REQ_READV ? at : 0);
+    myfs_response_t wire;
+    myfs_encode_response(&resp, item->request_id, &wire);
+    struct iovec iov[3] = {
+        { &wire, sizeof(wire) },
+        { results, count * sizeof(myfs_extent_result_t) },
+        { data, batch->type == REQ_READV ? at : 0 }
+    };
+    pthread_mutex_lock(&conn->send_lock);
+    int ret = send_iov_all(conn->sock, iov, 3);
+    pthread_mutex_unlock(&conn->send_lock);
+    io_buffer_put(data);
+    free(item->batch);
+    item->batch = NULL;
+    if (ret < 0) {
+        perror("send batch response");
+    }
+    return ret;
+}
+
+// Serve a request.  Returns 0 to keep the connection, -1 to close it,
+// or 1 once a batch has been received and goes on to the disk workers.
+static int handle_request(work_item_t* item, worker_t* w) {
+    connection_t* conn = item->conn;
+    int client_sock = conn->sock;
+    request_header_t req = item->req;
+    response_header_t resp;
+    char filepath[PATH_MAX];
+    
+    if (is_batch_request(conn, req.type)) {
+        if (item->batch) {
+            return serve_batch(item);
+        }
+        return receive_batch(item) < 0 ? -1 : 1;
+    }
+    
+    // Build file path
+    snprintf(filepath, PATH_MAX, "%s/%s.frag%u", storage_dir, req.filename, req.fragment_id);
+    
+    printf("[Server] Request type=%d, file=%s, size=%zu, offset=%ld\n", 
+           req.type, filepath, req.size, req.offset);
+    
+    // Always reset response for each request
+    memset(&resp, 0, sizeof(resp));
+    
+    if (req.type == REQ_WRITE) {
+        // Open/create file
+        int write_errno = 0;
+        int fd = -1;
+        fd_entry_t* file = fd_cache_get(filepath, 1);
+        if (!file) {
+            write_errno = errno;  // The payload is still consumed below
+            perror("open file for write");
+        } else {
+            fd = file->fd;
+            // Clients without REQ_TRUNCATE rewrite a fragment from
+            // offset 0 to shrink it: start fresh
+            if (req.offset == 0 && !(conn->capabilities & MYFS_CAP_TRUNCATE) &&
+                ftruncate(fd, 0) < 0) {
+                write_errno = errno;
+                perror("ftruncate");
+            }
+        }
+        
+        // The pipe used for splicing is set up on the first write
+        if (conn->pipefd[0] < 0 && fd >= 0) {
+            open_splice_pipe(conn->pipefd);
+        }
+        
+        // Move the data from the socket into the file at offset
+        int ret = backend->recv_range(w, client_sock, conn->pipefd, fd, req.offset, req.size,
+                                      &write_errno);
+        if (file) {
+            fd_cache_put(file);
+        }
+        if (ret < 0) {
+            perror("recv data");
+            return -1;  // Stream position lost, the client will reconnect
+        }
+        release_input(item);
+        
+        if (write_errno != 0) {
+            fprintf(stderr, "[Server] Write to %s failed: %s\n", filepath, strerror(write_errno));
+            resp.status = -1;
+            resp.error_code = write_errno;
+            resp.size = 0;
+        } else {
+            resp.status = 0;
+            resp.error_code = 0;
+            resp.size = req.size;
+        }
+        
+        return respond(item, &resp);
+        
+    } else if (req.type == REQ_READ) {
+        release_input(item);
+        
+        // Open file
+        fd_entry_t* file = fd_cache_get(filepath, 0);
+        if (!file) {
+            resp.status = -1;
+            resp.error_code = errno;
+            resp.size = 0;
+            perror("open file for read");
+            return respond(item, &resp);
+        }
+        int fd = file->fd;
+        
+        // The response announces its length up front, so clamp the
+        // range to the fragment file like pread would
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            perror("fstat");
+            resp.status = -1;
+            resp.error_code = errno;
+            resp.size = 0;
+            fd_cache_put(file);
+            return respond(item, &resp);
+        }
+        size_t nread = 0;
+        if (req.offset >= 0 && req.offset < st.st_size) {
+            nread = st.st_size - req.offset;
+            if (nread > req.size) {
+                nread = req.size;
+            }
+        }
+        
+        // Send response, with the data through the storage backend
+        resp.status = 0;
+        resp.error_code = 0;
+        resp.size = nread;
+        pthread_mutex_lock(&conn->send_lock);
+        ssize_t sent = -1;
+        if (send_response(item, &resp) == 0) {
+            sent = backend->send_range(w, client_sock, fd, req.offset, nread);
+        }
+        pthread_mutex_unlock(&conn->send_lock);
+        fd_cache_put(file);
+        if (sent != (ssize_t)nread) {
+            // The client is waiting for bytes we no longer have
+            // (file shrank or connection failed): drop the connection
+            perror("send fragment data");
+            return -1;
+        }
+        return 0;
+        
+    } else if (req.type == REQ_DELETE) {
+        release_input(item);
+        
+        // Delete file, and drop the cached fd so a later write recreates it
+        int ret = unlink(filepath);
+        fd_cache_invalidate(filepath);
+        if (ret < 0) {
+            perror("unlink");
+            resp.status = -1;
+            resp.error_code = errno;
+        } else {
+            resp.status = 0;
+            resp.error_code = 0;
+        }
+        resp.size = 0;
+        return respond(item, &resp);
+        
+    } else if (req.type == REQ_TRUNCATE) {
+        release_input(item);
+        
+        // Cut through the path: a cached fd sees the same inode.  A
+        // fragment that was never written has nothing to cut.
+        if (truncate(filepath, req.offset) < 0 && errno != ENOENT) {
+            perror("truncate");
+            resp.status = -1;
+            resp.error_code = errno;
+        } else {
+            resp.status = 0;
+            resp.error_code = 0;
+        }
+        resp.size = 0;
+        return respond(item, &resp);
+    }
+    
+    // Unknown request: the payload length is meaningless, resync by reconnecting
+    fprintf(stderr, "[Server] Unknown request type %d\n", req.type);
+    return -1;
+}
+
+// Serve the requests of a queue, then give each connection's input
+// back to the reactor if the request did not already
+static void serve_queue(work_queue_t* queue, worker_t* w) {
+    while (1) {
+        work_item_t* item = pop_work(queue);
+        connection_t* conn = item->conn;
+        
+        int ret = handle_request(item, w);
+        if (ret > 0) {
+            push_work(&disk_queue, item);
+            continue;
+        }
+        if (!item->input_released) {
+            if (ret == 0) {
+                conn->header_received = 0;
+                ret = arm_connection(conn, 0);
+            }
+            if (ret < 0) {
+                put_connection(conn);
+            }
+        } else if (ret < 0) {
+            // The reactor owns the input: wake it up to drop the connection
+            shutdown(conn->sock, SHUT_RDWR);
+        }
+        put_connection(conn);
+        free(item);
+    }
+}
+
+static void* worker_main(void* arg) {
+    serve_queue(&disk_queue, (worker_t*)arg);
+    return NULL;
+}
+
+static void* receiver_main(void* arg) {
+    serve_queue(&recv_queue, (worker_t*)arg);
+    return NULL;
+}
+
+// Receive header bytes into conn->wire until `need` are there.
+// Returns 1 when complete, 0 if more is needed, -1 if the connection
+// is gone.
+static int recv_header_bytes(connection_t* conn, size_t need) {
+    char* dest = (char*)&conn->wire;
+    
+    while (conn->header_received < need) {
+        ssize_t n = recv(conn->sock, dest + conn->header_received,
+                         need - conn->header_received, MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;  // Wait for more
+            perror("recv request header");
+            return -1;
+        }
+        if (n == 0) {
+            return -1;  // Connection closed
+        }
+        conn->header_received += n;
+    }
+    return 1;
+}
+
+// Read as much of the next request header as the socket has and
+// decode it into conn->req.  The first four bytes of a connection pick
+// the protocol: a v2 hello is answered here, anything else is the
+// start of a v1 header.  Returns 1 once a request header is complete,
+// 0 if more is needed, -1 if the connection is gone or malformed.
+static int read_request_header(connection_t* conn) {
+    int ret;
+    
+    if (conn->version == 0) {
+        if ((ret = recv_header_bytes(conn, sizeof(uint32_t))) <= 0) {
+            return ret;
+        }
+        conn->version = (MYFS_GET(conn->wire.hello.magic) == MYFS_MAGIC) ? 2 : 1;
+        if (conn->version == 2) {
+            if ((ret = recv_header_bytes(conn, sizeof(myfs_hello_t))) <= 0) {
+                conn->version = 0;  // Finish the hello on the next event
+                return ret;
+            }
+            conn->capabilities = MYFS_GET(conn->wire.hello.capabilities) & MYFS_CAPABILITIES;
+            
+            myfs_hello_t reply;
+            myfs_encode_hello(&reply, conn->capabilities, CLIENT_CREDITS);
+            if (send_all(conn->sock, &reply, sizeof(reply)) < 0) {
+                perror("send hello");
+                return -1;
+            }
+            printf("[Server] Client speaks protocol v%u, capabilities 0x%x\n",
+                   (unsigned)MYFS_GET(conn->wire.hello.version), conn->capabilities);
+            conn->header_received = 0;
+        }
+    }
+    
+    if (conn->version == 1) {
+        if ((ret = recv_header_bytes(conn, sizeof(request_header_t))) > 0) {
+            conn->req = conn->wire.v1;
+        }
+        return ret;
+    }
+    
+    // v2: fixed header, then the name
+    if ((ret = recv_header_bytes(conn, sizeof(myfs_request_t))) <= 0) {
+        return ret;
+    }
+    const myfs_request_t* wire = (const myfs_request_t*)conn->wire.v2;
+    size_t name_len = MYFS_GET(wire->name_len);
+    int batch = is_batch_request(conn, wire->type);
+    if ((name_len == 0 && !batch) || name_len > MYFS_MAX_NAME_LEN) {
+        fprintf(stderr, "[Server] Bad name length %zu in request\n", name_len);
+        return -1;
+    }
+    if ((ret = recv_header_bytes(conn, sizeof(myfs_request_t) + name_len)) > 0) {
+        myfs_decode_request(wire, conn->wire.v2 + sizeof(myfs_request_t), &conn->req);
+        conn->request_id = (uint32_t)MYFS_GET(wire->request_id);
+    }
+    return ret;
+}
+
+// Descriptor held in reserve so that a connection can still be
+// accepted (and refused) when the process is out of them
+static int spare_fd = -1;
+
+// Accept every pending connection and register it with the reactor.
+// The listener is edge-triggered, so this must drain the backlog even
+// when out of descriptors: idle cached files are closed first, and if
+// that frees none the connection is accepted on the spare descriptor
+// and closed at once.
+static void accept_connections(int server_sock) {
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        
+        int sock = accept4(server_sock, (struct sockaddr*)&client_addr, &client_len,
+                           SOCK_CLOEXEC);
+        if (sock < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EMFILE || errno == ENFILE) {
+                if (fd_cache_trim() > 0) {
+                    continue;
+                }
+                if (spare_fd >= 0) {
+                    close(spare_fd);
+                    sock = accept4(server_sock, NULL, NULL, SOCK_CLOEXEC);
+                    int accept_errno = errno;
+                    if (sock >= 0) {
+                        close(sock);
+                        fprintf(stderr, "[Server] Out of file descriptors, refused a connection\n");
+                    }
+                    spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                    if (sock >= 0) {
+                        continue;
+                    }
+                    errno = accept_errno;
+                }
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
+            return;
+        }
+        
+        printf("[Server] Client connected from %s:%d\n", 
+               inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+        
+        // A thread never waits forever on a stalled client
+        struct timeval tv = { CLIENT_IO_TIMEOUT_SECS, 0 };
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        
+        connection_t* conn = (connection_t*)calloc(1, sizeof(connection_t));
+        if (!conn) {
+            close(sock);
+            continue;
+        }
+        conn->sock = sock;
+        conn->refs = 1;
+        pthread_mutex_init(&conn->send_lock, NULL);
+        conn->pipefd[0] = conn->pipefd[1] = -1;
+        
+        if (arm_connection(conn, 1) < 0) {
+            perror("epoll_ctl");
+            put_connection(conn);
+        }
+    }
+}
+
+// Number of disk workers: one per online CPU
+static int worker_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < MIN_WORKERS) {
+        n = MIN_WORKERS;
+    }
+    return (int)n;
+}
+
+// Benchmark (--bench): every worker streams data through a backend
+// into its own fragment file and back out over a socketpair, in
+// MAX_CHUNK_SIZE requests as a client flush or read would.  The page
+// cache of the files is dropped between the write and read phases.
+typedef struct {
+    worker_t* worker;
+    const storage_backend_t* backend;
+    int sock;                    // Server end of the socketpair
+    int peer;                    // Client end
+    int pipefd[2];
+    char path[PATH_MAX];
+    size_t bytes;
+    int failed;
+} bench_job_t;
+
+static char bench_pattern[MAX_CHUNK_SIZE];
+
+static void* bench_client_send(void* arg) {
+    bench_job_t* job = (bench_job_t*)arg;
+    for (size_t done = 0; done < job->bytes; done += MAX_CHUNK_SIZE) {
+        if (send_all(job->peer, bench_pattern, MAX_CHUNK_SIZE) < 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void* bench_client_recv(void* arg) {
+    bench_job_t* job = (bench_job_t*)arg;
+    char* buf = malloc(MAX_CHUNK_SIZE);
+    for (size_t done = 0; buf && done < job->bytes; done += MAX_CHUNK_SIZE) {
+        if (recv_all(job->peer, buf, MAX_CHUNK_SIZE) < 0) {
+            break;
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+static void* bench_write(void* arg) {
+    bench_job_t* job = (bench_job_t*)arg;
+    pthread_t client;
+    pthread_create(&client, NULL, bench_client_send, job);
+    
+    int fd = open(job->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    for (size_t done = 0; done < job->bytes; done += MAX_CHUNK_SIZE) {
+        int file_errno = (fd < 0) ? errno : 0;
+        if (job->backend->recv_range(job->worker, job->sock, job->pipefd, fd, done,
+                                     MAX_CHUNK_SIZE, &file_errno) < 0 || file_errno) {
+            job->failed = 1;
+            break;
+        }
+    }
+    if (fd >= 0) {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);  // Make the read phase hit the disk
+        close(fd);
+    }
+    
+    shutdown(job->sock, SHUT_RD);  // Unblock the client after a failure
+    pthread_join(client, NULL);
+    return NULL;
+}
+
+static void* bench_read(void* arg) {
+    bench_job_t* job = (bench_job_t*)arg;
+    pthread_t client;
+    pthread_create(&client, NULL, bench_client_recv, job);
+    
+    int fd = open(job->path, O_RDONLY);
+    for (size_t done = 0; done < job->bytes; done += MAX_CHUNK_SIZE) {
+        if (fd < 0 || job->backend->send_range(job->worker, job->sock, fd, done,
+                                               MAX_CHUNK_SIZE) != MAX_CHUNK_SIZE) {
+            job->failed = 1;
+            break;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    
+    shutdown(job->sock, SHUT_WR);  // Unblock the client after a failure
+    pthread_join(client, NULL);
+    return NULL;
+}
+
+// Run one phase on all jobs at once; returns elapsed seconds
+static double bench_phase(bench_job_t* jobs, int njobs, void* (*phase)(void*)) {
+    struct timespec start, end;
+    pthread_t* threads = malloc(njobs * sizeof(pthread_t));
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < njobs; i++) {
+        pthread_create(&threads[i], NULL, phase, &jobs[i]);
+    }
+    for (int i = 0; i < njobs; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    
+    free(threads);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static int bench_backend(const storage_backend_t* be, worker_t* workers, int nworkers, size_t mb) {
+    bench_job_t* jobs = calloc(nworkers, sizeof(bench_job_t));
+    int failed = 0;
+    
+    for (int i = 0; i < nworkers; i++) {
+        if (snprintf(jobs[i].path, PATH_MAX, "%s/bench-%d.frag0", storage_dir, i) >= PATH_MAX) {
+            printf("[Bench] Storage path too long\n");
+            free(jobs);
+            return -1;
+        }
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+            perror("socketpair");
+            return -1;
+        }
+        jobs[i].worker = &workers[i];
+        jobs[i].backend = be;
+        jobs[i].sock = sv[0];
+        jobs[i].peer = sv[1];
+        jobs[i].pipefd[0] = jobs[i].pipefd[1] = -1;
+        open_splice_pipe(jobs[i].pipefd);
+        jobs[i].bytes = mb * 1024 * 1024;
+    }
+    
+    double write_secs = bench_phase(jobs, nworkers, bench_write);
+    double read_secs = bench_phase(jobs, nworkers, bench_read);
+    double total_mb = (double)mb * nworkers;
+    
+    for (int i = 0; i < nworkers; i++) {
+        failed |= jobs[i].failed;
+        close(jobs[i].sock);
+        close(jobs[i].peer);
+        if (jobs[i].pipefd[0] >= 0) {
+            close(jobs[i].pipefd[0]);
+            close(jobs[i].pipefd[1]);
+        }
+        unlink(jobs[i].path);
+    }
+    free(jobs);
+    
+    printf("[Bench] %-8s write %8.1f MB/s   read %8.1f MB/s%s\n", be->name,
+           total_mb / write_secs, total_mb / read_secs, failed ? "   (FAILED)" : "");
+    return failed ? -1 : 0;
+}
+
+// Compare the backends on this node's storage
+static int run_benchmark(worker_t* workers, int nworkers, size_t mb) {
+    memset(bench_pattern, 0x5a, sizeof(bench_pattern));
+    printf("[Bench] %d workers x %zu MB in %d KB requests, storage dir: %s\n",
+           nworkers, mb, MAX_CHUNK_SIZE / 1024, storage_dir);
+    
+    int ret = bench_backend(&sync_backend, workers, nworkers, mb);
+#ifdef HAVE_IO_URING
+    if (uring_init(nworkers) == 0) {
+        ret |= bench_backend(&uring_backend, workers, nworkers, mb);
+    } else {
+        printf("[Bench] io_uring unavailable\n");
+    }
+#else
+    printf("[Bench] Built without io_uring\n");
+#endif
+    return ret ? 1 : 0;
+}
+
+// Create the disk worker descriptors
+static worker_t* create_workers(int nworkers) {
+    worker_t* workers = calloc(nworkers, sizeof(worker_t));
+    if (!workers) {
+        return NULL;
+    }
+    for (int i = 0; i < nworkers; i++) {
+        workers[i].index = i;
+        pthread_mutex_init(&workers[i].lock, NULL);
+        pthread_cond_init(&workers[i].cond, NULL);
+    }
+    return workers;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [--io=sync|uring] <port> <storage_dir>\n", prog);
+    fprintf(stderr, "       %s --bench <storage_dir> [MB per worker]\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+    const char* io_backend = "sync";
+    int bench = 0;
+    
+    // Options come first
+    int argi = 1;
+    while (argi < argc && strncmp(argv[argi], "--", 2) == 0) {
+        if (strncmp(argv[argi], "--io=", 5) == 0) {
+            io_backend = argv[argi] + 5;
+        } else if (strcmp(argv[argi], "--bench") == 0) {
+            bench = 1;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+        argi++;
+    }
+    
+    // The disk workers come first, then as many receive threads
+    int nworkers = worker_count();
+    int nthreads = bench ? nworkers : 2 * nworkers;
+    worker_t* workers = create_workers(nthreads);
+    if (!workers) {
+        perror("calloc");
+        return 1;
+    }
+    
+    if (bench) {
+        if (argc - argi < 1 || argc - argi > 2) {
+            usage(argv[0]);
+            return 1;
+        }
+        strncpy(storage_dir, argv[argi], PATH_MAX - 1);
+        mkdir(storage_dir, 0755);
+        size_t mb = (argc - argi == 2) ? strtoul(argv[argi + 1], NULL, 10) : BENCH_DEFAULT_MB;
+        return run_benchmark(workers, nworkers, mb ? mb : BENCH_DEFAULT_MB);
+    }
+    
+    if (argc - argi != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    int port = atoi(argv[argi]);
+    strncpy(storage_dir, argv[argi + 1], PATH_MAX - 1);
+    
+    // A client dropping its connection mid-response must not kill the
+    // server (sendfile() cannot be told MSG_NOSIGNAL)
+    signal(SIGPIPE, SIG_IGN);
+    
+    // Create storage directory if not exists
+    mkdir(storage_dir, 0755);
+    init_fd_cache();
+    spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    
+    printf("[Server] Starting on port %d, storage dir: %s\n", port, storage_dir);
+    
+    // Create socket
+    int server_sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server_sock < 0) {
+        perror("socket");
+        return 1;
+    }
+    
+    // Set socket option to reuse address
+    int opt = 1;
+    setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    
+    // Bind
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
+    
+    if (bind(server_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        perror("bind");
+        close(server_sock);
+        return 1;
+    }
+    
+    // Listen
+    if (listen(server_sock, SOMAXCONN) < 0) {
+        perror("listen");
+        close(server_sock);
+        return 1;
+    }
+    
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        close(server_sock);
+        return 1;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;  // NULL marks the listening socket
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, server_sock, &ev) < 0) {
+        perror("epoll_ctl");
+        close(server_sock);
+        return 1;
+    }
+    
+    select_backend(io_backend, nthreads);
+    
+    // Start the disk workers and the receive threads
+    for (int i = 0; i < nthreads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, i < nworkers ? worker_main : receiver_main,
+                           &workers[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+        pthread_detach(thread);
+    }
+    
+    printf("[Server] Listening on port %d with %d workers and %d receive threads, %s I/O...\n",
+           port, nworkers, nthreads - nworkers, backend->name);
+    
+    // Reactor: accept connections and collect request headers; idle
+    // connections cost no thread
+    struct epoll_event events[MAX_EVENTS];
+    while (1) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        
+        for (int i = 0; i < n; i++) {
+            connection_t* conn = (connection_t*)events[i].data.ptr;
+            if (!conn) {
+                accept_connections(server_sock);
+                continue;
+            }
+            
+            int ret = read_request_header(conn);
+            if (ret > 0) {
+                queue_work(conn);
+            } else if (ret == 0 && !(events[i].events & (EPOLLHUP | EPOLLERR))) {
+                if (arm_connection(conn, 0) < 0) {
+                    put_connection(conn);
+                }
+            } else {
+                put_connection(conn);
+            }
+        }
+    }
+    
+    close(server_sock);
+    return 0;
+}